@@ -0,0 +1,1067 @@
+/* archive.c
+ * This file includes functions for creating, listing, and extracting tar files.
+ * None of these functions exit the process; failures are reported with the
+ * error codes defined in libmytar.h so they can be embedded in other programs.
+ */
+
+#include "archive.h"
+#include "digest.h"
+#include "filelist.h"
+#include "gz.h"
+#include "header.h"
+#include "io.h"
+#include "libmytar.h"
+#include "manifest.h"
+#include "mytar.h"
+#include "reader.h"
+#include "writer.h"
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+
+extern int snprintf(char *str, size_t size, const char *format, ...);
+extern int symlink(const char *target, const char *linkpath);
+extern int lstat(const char *path, struct stat *buf);
+extern struct tm *localtime_r(const time_t *timep, struct tm *result);
+extern int fdatasync(int fd);
+extern int ftruncate(int fd, off_t length);
+
+void init_flags(Flags *flags) {
+  flags->create = false;
+  flags->list = false;
+  flags->extract = false;
+  flags->compare = false;
+  flags->verbose = false;
+  flags->strict = false;
+  flags->to_stdout = false;
+  flags->gzip = false;
+  flags->digest = false;
+  flags->align = 0;
+  flags->verify = false;
+  flags->keep_newer = false;
+  flags->skip_identical = SKIP_NONE;
+  flags->preserve = false;
+  flags->same_owner = false;
+  flags->restorer = NULL;
+  flags->sync_mode = SYNC_NONE;
+  flags->bwlimit = 0;
+  flags->ionice_idle = false;
+  flags->syncer = NULL;
+  flags->checkpoint_file = NULL;
+  flags->checkpoint_every = 0;
+  flags->resume = false;
+  flags->checkpoint = NULL;
+  flags->matcher = NULL;
+  flags->files_from = NULL;
+  flags->null = false;
+  flags->no_recursion = false;
+  flags->manifest = NULL;
+  flags->rewrite = NULL;
+  flags->strip_components = 0;
+  flags->rename_from = NULL;
+  flags->rename_to = NULL;
+  flags->shards = 1;
+  /* 0 until --threads is given, which d takes as one thread per CPU */
+  flags->threads = 0;
+  flags->blocking_factor = NUM_HUNKS;
+  flags->stats_json = false;
+  flags->stats = NULL;
+  flags->listing = NULL;
+  flags->print0 = false;
+  flags->members = NULL;
+  flags->recording = NULL;
+  flags->tarfile = NULL;
+  flags->paths = NULL;
+  flags->n_paths = 0;
+}
+
+/* Writes the member whose header is in writer->header: any PAX header it
+ * needs, the header itself and, for a regular file, its contents, read from
+ * writer->src_fd or taken from data when that is not NULL. */
+int write_member(Writer *writer, const void *data) {
+  size_t size;
+  int err;
+
+  err = writer_begin_member(writer);
+
+  if (err == MYTAR_OK && writer->header->typeflag == '0') {
+    if (data != NULL && writer->digest) {
+      /* the contents are at hand, so the digest is known up front */
+      size = strtol((const char *)writer->header->size, NULL, 8);
+      err = writer_write_known_digest(writer, crc32c(0, data, size));
+    } else {
+      err = writer->digest ? writer_write_digest_header(writer)
+                           : writer_align(writer);
+    }
+  }
+
+  if (err == MYTAR_OK) {
+    stats_entry(writer->stats, writer->header);
+    err = writer_write_header(writer);
+  }
+
+  if (err == MYTAR_OK && writer->header->typeflag == '0') {
+    if (data != NULL) {
+      size = strtol((const char *)writer->header->size, NULL, 8);
+      err = writer_write_buffer(writer, data, size);
+    } else {
+      err = writer_write_file(writer);
+      if (err == MYTAR_OK && writer->digest) {
+        err = writer_write_digest(writer);
+      }
+    }
+  }
+
+  return err;
+}
+
+/* Processes a file or directory and writes it into a tar file */
+int process_path(const char *src, Writer *writer, bool is_verbose) {
+  double start = stats_now();
+  int err;
+
+  if ((writer->header = init_header()) == NULL) {
+    return MYTAR_ERR_NOMEM;
+  }
+
+  stats_syscall(writer->stats, SYS_STAT);
+  err = populate_header_from_file(src, writer->header);
+  stats_phase(writer->stats, PHASE_HEADER, start);
+
+  if (err == MYTAR_OK) {
+    err = write_member(writer, NULL);
+  }
+
+  switch (writer->header->typeflag) {
+  case '0':
+  case '2':
+    stats_syscall(writer->stats, SYS_CLOSE);
+    close(writer->src_fd);
+    break;
+  case '5':
+  default:
+    break;
+  }
+
+  /* verbose output must not end up inside an archive written to stdout */
+  if (err == MYTAR_OK && is_verbose) {
+    fprintf(writer->dst_fd == STDOUT_FILENO ? stderr : stdout, "%s\n", src);
+  }
+
+  free(writer->header);
+  writer->header = NULL;
+  return err;
+}
+
+/* Performes dfs on directory and its directories until all files are read,
+ * calling visit on every path. Directory paths are given a trailing slash and
+ * are visited before their contents, which are not walked if visit returns
+ * WALK_PRUNE. */
+int walk_path(const char *path, visit_fn visit, void *ctx, Stats *stats) {
+  DIR *dir;
+  struct dirent *entry;
+  struct stat entry_stat;
+  struct stat path_stat;
+  char pathBuff[PATH_MAX];
+  int path_len;
+  int err;
+
+  path_len = strlen(path);
+  if (path_len + 1 >= sizeof(pathBuff)) {
+    fprintf(stderr, "Path too long %s\n", path);
+    return MYTAR_ERR_NAME;
+  }
+  strcpy(pathBuff, path);
+
+  stats_syscall(stats, SYS_STAT);
+  if (stat(path, &path_stat) != 0) {
+    fprintf(stderr, "Cannot stat path %s\n", path);
+    return MYTAR_OK;
+  }
+
+  /* append a slash if its a directory and doesnt already have slash */
+  if (path_len == 0 ||
+      (S_ISDIR(path_stat.st_mode) && path[path_len - 1] != '/'))
+    strcat(pathBuff, "/");
+
+  /* if the given path is a file or link */
+
+  if (!S_ISDIR(path_stat.st_mode)) {
+    err = visit(pathBuff, &path_stat, ctx);
+    return err == WALK_PRUNE ? MYTAR_OK : err;
+  }
+
+  /* must process dir before opening it, it may prune everything below */
+  if ((err = visit(pathBuff, &path_stat, ctx)) != MYTAR_OK) {
+    return err == WALK_PRUNE ? MYTAR_OK : err;
+  }
+
+  stats_syscall(stats, SYS_OPEN);
+  if ((dir = opendir(path)) == NULL) {
+    perror("Failed to open dir.");
+    return MYTAR_ERR_IO;
+  }
+
+  while ((entry = readdir(dir)) != NULL) {
+    if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+      continue;
+
+    if (path_len + strlen(entry->d_name) + 2 >= sizeof(pathBuff)) {
+      fprintf(stderr, "Path too long %s%s\n", pathBuff, entry->d_name);
+      continue;
+    }
+
+    sprintf(pathBuff + path_len + (path[path_len - 1] != '/'), "%s",
+            entry->d_name);
+
+    stats_syscall(stats, SYS_STAT);
+    if (stat(pathBuff, &entry_stat) != 0) {
+      fprintf(stderr, "Cannot stat file %s\n", pathBuff);
+      continue;
+    }
+
+    if (S_ISDIR(entry_stat.st_mode)) {
+      strcat(pathBuff, "/");
+      err = walk_path(pathBuff, visit, ctx, stats);
+    } else if ((err = visit(pathBuff, &entry_stat, ctx)) == WALK_PRUNE) {
+      err = MYTAR_OK;
+    }
+
+    if (err != MYTAR_OK) {
+      closedir(dir);
+      return err;
+    }
+  }
+
+  stats_syscall(stats, SYS_CLOSE);
+  closedir(dir);
+  return MYTAR_OK;
+}
+
+/* Opens the source of a file or link and writes it into the archive */
+int archive_path(const char *path, Writer *writer, bool is_verbose) {
+  /* Directories dont need src fd because we are just parsing meta data. */
+  if (path[strlen(path) - 1] != '/') {
+    stats_syscall(writer->stats, SYS_OPEN);
+    if ((writer->src_fd = open(path, O_RDONLY)) == -1) {
+      fprintf(stderr, "%s: ", path);
+      perror("Failed to open source file");
+      return MYTAR_OK;
+    }
+  }
+
+  return process_path(path, writer, is_verbose);
+}
+
+typedef struct {
+  Writer *writer;
+  const Flags *flags;
+} ArchiveVisit;
+
+/* Records a checkpoint after path, the last member written, once one is due.
+ * The archive is made durable up to there first. */
+static int checkpoint_writer(Writer *writer, Checkpoint *checkpoint,
+                             const char *path) {
+  int err;
+
+  if (!checkpoint_due(checkpoint, writer->offset + get_buffer_index(writer))) {
+    return MYTAR_OK;
+  }
+
+  if ((err = writer_flush(writer)) != MYTAR_OK) {
+    return err;
+  }
+
+  if (fdatasync(writer->dst_fd) == -1) {
+    perror("Failed to sync archive");
+    return MYTAR_ERR_IO;
+  }
+
+  return checkpoint_save(checkpoint, writer->offset, path);
+}
+
+static int archive_visit(const char *path, struct stat *path_stat,
+                         void *ctx) {
+  ArchiveVisit *visit = ctx;
+  const Flags *flags = visit->flags;
+  int err;
+
+  if (flags == NULL) {
+    return archive_path(path, visit->writer, false);
+  }
+
+  if (matcher_skips(flags->matcher, path, S_ISDIR(path_stat->st_mode))) {
+    return WALK_PRUNE;
+  }
+
+  /* on --resume, every path up to the checkpoint is already archived */
+  if (flags->checkpoint != NULL && flags->checkpoint->resuming) {
+    flags->checkpoint->resuming =
+        strcmp(path, flags->checkpoint->resume_member) != 0;
+    err = MYTAR_OK;
+  } else {
+    err = archive_path(path, visit->writer, flags->verbose);
+  }
+
+  if (err == MYTAR_OK && flags->checkpoint != NULL &&
+      !flags->checkpoint->resuming) {
+    err = checkpoint_writer(visit->writer, flags->checkpoint, path);
+  }
+
+  if (err == MYTAR_OK && flags->no_recursion && S_ISDIR(path_stat->st_mode)) {
+    return WALK_PRUNE;
+  }
+  return err;
+}
+
+/* Writes path, and everything below it if it is a directory, into the archive.
+ * With flags, paths its matcher skips are left out along with everything below
+ * them, and --no-recursion writes directories without their contents. flags
+ * may be NULL. */
+int traverse_path(const char *path, Writer *writer, const Flags *flags) {
+  ArchiveVisit visit;
+
+  visit.writer = writer;
+  visit.flags = flags;
+
+  return walk_path(path, archive_visit, &visit, writer->stats);
+}
+
+/* Lists an archive entry, with its permissions, owner, size and mtime under
+ * v, through the flags' listing buffer */
+int list_member(Flags *flags, const TarHeader *header, const char *name,
+                size_t len) {
+  if (flags->verbose) {
+    return listing_verbose(flags->listing, header, name, len);
+  }
+  return listing_name(flags->listing, name, len);
+}
+
+/* Names the member whose contents failed their digest check */
+static int report_digest(int err, const char *name) {
+  if (err == MYTAR_ERR_DIGEST) {
+    fprintf(stderr, "%s: Contents do not match their digest\n", name);
+  }
+  return err;
+}
+
+int print_entry(Flags *flags, Reader *reader, char *name) {
+  size_t len = strlen(name);
+  int err;
+
+  if ((err = list_member(flags, reader->current_entry->header, name, len)) !=
+      MYTAR_OK) {
+    return err;
+  }
+
+  /* if this is a file, not a dir. Skip the file contents */
+  if (name[len - 1] != '/') {
+    if (flags->verify) {
+      return report_digest(reader_verify_contents(reader), name);
+    }
+    return reader_skip_file_contents(reader);
+  }
+
+  return MYTAR_OK;
+}
+
+/* This function takes a path, and will guarentee the path will exist in the
+ * filesysem. If the path points to a file, it will return a file descriptor of
+ * the file opened. etc. Returns -1 on failure.*/
+int path_to_filesystem(const char *path, TarHeader *header, Stats *stats) {
+  char opath[PATH_MAX];
+  char *p;
+  size_t len;
+  mode_t mode;
+  int fd;
+  char link_name[sizeof(header->linkname) + 1];
+
+  int stat_res;
+  struct stat path_stat;
+
+  strncpy(opath, path, sizeof(opath));
+  opath[sizeof(opath) - 1] = '\0';
+  len = strlen(opath);
+
+  if (len == 0)
+    return -1;
+
+  for (p = opath; *p; p++) {
+    if (*p == '/') {
+      *p = '\0';
+      stats_syscall(stats, SYS_STAT);
+      stat_res = stat(opath, &path_stat);
+      if (stat_res != 0) {
+        if (mkdir(opath, RWX_ALL) != 0 && errno != EEXIST) {
+          return -1;
+        }
+      }
+      *p = '/';
+    }
+  }
+  if (opath[len - 1] != '/') {
+
+    /* is this a file or a synmlink */
+
+    if (header->typeflag == '2') {
+      /* this is a symlink. linkname is not terminated when it uses all 100
+       * bytes */
+      memcpy(link_name, header->linkname, sizeof(header->linkname));
+      link_name[sizeof(header->linkname)] = '\0';
+      if (symlink(link_name, opath) == -1) {
+        fprintf(stderr, "Failed to create symlink.\n");
+      };
+      return 0;
+    }
+
+    /* the umask applies here; p sets the exact mode once it is written */
+    mode = strtol((char *)header->mode, NULL, OCTAL_SIZE) & RWX_ALL;
+
+    stats_syscall(stats, SYS_OPEN);
+    fd = open(opath, O_WRONLY | O_CREAT | O_TRUNC, mode);
+    if (fd == -1) {
+      perror("Failed to create/open when converting path to filesystem.\n");
+      return -1;
+    }
+    return fd;
+  } else if (access(opath, F_OK) != 0) {
+    /* another extractor may have created it in the meantime */
+    if (mkdir(opath, RWX_ALL) != 0 && errno != EEXIST) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+/* Returns true if a regular file member may be left alone because the file on
+ * disk is newer (--keep-newer) or already identical (--skip-identical). */
+static bool is_up_to_date(Flags *flags, Reader *reader, const char *name) {
+  TarHeader *header = reader->current_entry->header;
+  struct stat path_stat;
+  long size;
+  long mtime;
+  uint32_t crc = 0;
+  int fd;
+  bool same;
+
+  if (!flags->keep_newer && flags->skip_identical == SKIP_NONE) {
+    return false;
+  }
+
+  stats_syscall(reader->stats, SYS_STAT);
+  if (lstat(name, &path_stat) != 0 || !S_ISREG(path_stat.st_mode)) {
+    return false;
+  }
+
+  size = strtol((char *)header->size, NULL, OCTAL_SIZE);
+  mtime = strtol((char *)header->mtime, NULL, OCTAL_SIZE);
+
+  if (flags->keep_newer && path_stat.st_mtime > mtime) {
+    return true;
+  }
+
+  if (flags->skip_identical == SKIP_NONE || path_stat.st_size != size) {
+    return false;
+  }
+
+  /* without a digest to compare against, content falls back to mtime */
+  if (flags->skip_identical != SKIP_CONTENT ||
+      !reader->current_entry->has_digest) {
+    return path_stat.st_mtime == mtime;
+  }
+
+  stats_syscall(reader->stats, SYS_OPEN);
+  if ((fd = open(name, O_RDONLY)) == -1) {
+    return false;
+  }
+  same = io_copy_crc32c(fd, -1, size, &crc, reader->stats) == size &&
+         crc == reader->current_entry->digest;
+  stats_syscall(reader->stats, SYS_CLOSE);
+  close(fd);
+
+  return same;
+}
+
+/* This function handels extracting a path, and writing to it in the filesystem.
+ */
+int extract_path(Flags *flags, Reader *reader, char *name) {
+
+  Entry *entry = reader->current_entry;
+  double start;
+  int err;
+
+  /* If this is strict dont extract header with special int */
+  if (flags->strict) {
+    if ((unsigned char)entry->header->uid[0] & 0x80) {
+      fprintf(stderr, "Uid not strictly compliant. Skipping: %s", name);
+      return reader_skip_file_contents(reader);
+    }
+  }
+
+  /* on --resume, members that end before the checkpoint are already
+   * extracted, but directories still need their metadata restored */
+  if (flags->checkpoint != NULL && flags->checkpoint->resuming) {
+    if (reader_offset(reader) <= flags->checkpoint->resume_offset) {
+      if (entry->header->typeflag == '5' && flags->restorer != NULL &&
+          (err = restorer_defer_dir(flags->restorer, entry->header, name)) !=
+              MYTAR_OK) {
+        return err;
+      }
+      return reader_skip_file_contents(reader);
+    }
+    flags->checkpoint->resuming = false;
+  }
+
+  /* O writes the data of matching files to stdout in archive order */
+  if (flags->to_stdout) {
+    if (entry->header->typeflag != '0' && entry->header->typeflag != '\0') {
+      return reader_skip_file_contents(reader);
+    }
+
+    if (flags->verbose) {
+      fprintf(stderr, "%s\n", name);
+    }
+
+    reader->dst_fd = STDOUT_FILENO;
+    return report_digest(reader_translate_to_file(reader), name);
+  }
+
+  switch (entry->header->typeflag) {
+    /* file */
+  case '0':
+  case '\0':
+
+    if (is_up_to_date(flags, reader, name)) {
+      return reader_skip_file_contents(reader);
+    }
+
+    start = stats_now();
+    reader->dst_fd =
+        path_to_filesystem(name, reader->current_entry->header, reader->stats);
+    stats_phase(reader->stats, PHASE_PATH_SETUP, start);
+
+    if (reader->dst_fd == -1) {
+      fprintf(stderr, "Failed to extract %s\n", name);
+      return MYTAR_ERR_IO;
+    }
+
+    err = reader_translate_to_file(reader);
+    if (err == MYTAR_OK && flags->restorer != NULL) {
+      restorer_file(flags->restorer, reader->dst_fd, entry->header, name);
+    }
+    stats_syscall(reader->stats, SYS_CLOSE);
+    if (flags->syncer != NULL) {
+      if (syncer_close(flags->syncer, reader->dst_fd, name) != MYTAR_OK &&
+          err == MYTAR_OK) {
+        err = MYTAR_ERR_IO;
+      }
+    } else {
+      close(reader->dst_fd);
+    }
+
+    if (err != MYTAR_OK) {
+      return report_digest(err, name);
+    }
+
+    if (flags->verbose) {
+      printf("%s\n", name);
+    }
+
+    break;
+    /* dir or symlink */
+  case '5':
+  case '2':
+    start = stats_now();
+    path_to_filesystem(name, reader->current_entry->header, reader->stats);
+    stats_phase(reader->stats, PHASE_PATH_SETUP, start);
+    if (flags->restorer != NULL && entry->header->typeflag == '2') {
+      restorer_link(flags->restorer, entry->header, name);
+    } else if (flags->restorer != NULL &&
+               (err = restorer_defer_dir(flags->restorer, entry->header,
+                                         name)) != MYTAR_OK) {
+      return err;
+    }
+    if (flags->syncer != NULL &&
+        (err = syncer_touch(flags->syncer, name,
+                            entry->header->typeflag == '5')) != MYTAR_OK) {
+      return err;
+    }
+    if (flags->verbose) {
+      printf("%s\n", name);
+    }
+    break;
+  default:
+    return reader_skip_file_contents(reader);
+  }
+
+  return MYTAR_OK;
+}
+
+/* Returns true if path was asked for on the command line. Every operand is
+ * treated as a prefix that matches if the next character of path is either
+ * null or /. With no operands every path matches, and with --exclude or
+ * --include only those that are not filtered out.
+ */
+bool path_matches(Flags *flags, const char *path) {
+  int i;
+  int prefix_len = 0;
+  char *prefix;
+
+  if (matcher_skips_member(flags->matcher, path)) {
+    return false;
+  }
+
+  if (flags->n_paths == 0 && !matcher_has_operands(flags->matcher)) {
+    return true;
+  }
+
+  if (matcher_selects(flags->matcher, path)) {
+    return true;
+  }
+
+  for (i = 0; i < flags->n_paths; i++) {
+
+    prefix_len = strlen(flags->paths[i]);
+    prefix = flags->paths[i];
+
+    if (prefix[prefix_len - 1] == '/') {
+      prefix_len -= 1;
+    }
+
+    /* the prefix matches */
+    if (strncmp(path, prefix, prefix_len) == 0) {
+      /* Is this an exact match, or a directory */
+      if (prefix_len == strlen(path) || path[prefix_len] == '/') {
+        return true;
+      }
+    }
+  }
+
+  return false;
+}
+
+/* This function will traverse the archive, and will execute the function
+ * process_entry on any desired archive entries.
+ */
+int traverse_execute_archive(Reader *reader, Flags *flags,
+                             int (*process_entry)(Flags *, Reader *, char *)) {
+  /* 257 to include normalizing / if need be */
+  char path[PATH_MAX];
+  int reader_status;
+  int err = MYTAR_OK;
+
+  while (err == MYTAR_OK && (reader_status = reader_cycle_entry(reader)) != 0) {
+
+    if (reader_status == MYTAR_ERR_STRICT) {
+      fprintf(stderr, "Encountered non-compliant entry. Skipping.\n");
+      err = reader_skip_file_contents(reader);
+      continue;
+    }
+
+    if (reader_status < 0) {
+      return reader_status;
+    }
+
+    /* the daemon caches every member, not just the ones listed now */
+    if (flags->recording != NULL) {
+      members_record(flags->recording, reader->current_entry->header);
+    }
+
+    memset(path, 0, sizeof(path));
+    extract_name(reader->current_entry->header, path);
+
+    if (path_matches(flags, path)) {
+      err = process_entry(flags, reader, path);
+    } else if (path[strlen(path) - 1] != '/') {
+      /* if this path was a file and not asked for, skip its contents */
+      err = reader_skip_file_contents(reader);
+    }
+  }
+
+  return err;
+}
+
+/* Opens the archive and runs process_entry over it */
+int read_archive(Flags *flags,
+                 int (*process_entry)(Flags *, Reader *, char *)) {
+
+  Reader reader;
+  GzReader gz;
+  double start = stats_now();
+  int err;
+  int gz_err;
+  int fd;
+  reader_init(&reader, flags->strict);
+  reader_set_record(&reader, flags->blocking_factor);
+  reader.stats = flags->stats;
+
+  if (strcmp(flags->tarfile, "-") == 0) {
+    fd = STDIN_FILENO;
+  } else {
+    stats_syscall(reader.stats, SYS_OPEN);
+    if ((fd = open(flags->tarfile, O_RDONLY)) == -1) {
+      perror("Could not open archive");
+      return MYTAR_ERR_IO;
+    }
+  }
+
+  /* z archives are read through a pipe that a thread inflates into */
+  reader_set_src(&reader, flags->gzip ? gz_reader_start(&gz, flags, fd) : fd);
+
+  if (reader.src_fd == -1) {
+    err = MYTAR_ERR_IO;
+  } else {
+    err = traverse_execute_archive(&reader, flags, process_entry);
+  }
+  stats_phase(reader.stats, PHASE_TRAVERSAL, start);
+
+  if (flags->gzip && reader.src_fd != -1 &&
+      (gz_err = gz_reader_finish(&gz)) != MYTAR_OK && err == MYTAR_OK) {
+    err = gz_err;
+  }
+
+  reader_free(&reader);
+  if (fd != STDIN_FILENO) {
+    stats_syscall(reader.stats, SYS_CLOSE);
+    close(fd);
+  }
+  return err;
+}
+
+/* Lists the archive from the daemon's table of its members, reading the
+ * archive and keeping its table first if it is not cached as it is now */
+static int list_cached(Flags *flags) {
+  struct stat before;
+  struct stat after;
+  MemberTable *table;
+  char path[PATH_MAX];
+  long i;
+  int err = MYTAR_OK;
+
+  if (stat(flags->tarfile, &before) == -1 || !S_ISREG(before.st_mode)) {
+    return read_archive(flags, print_entry);
+  }
+
+  if ((table = members_lookup(flags->members, &before)) == NULL) {
+    if ((flags->recording = members_new(&before)) == NULL) {
+      return MYTAR_ERR_NOMEM;
+    }
+    err = read_archive(flags, print_entry);
+
+    /* an archive that changed while it was read is not kept */
+    if (err == MYTAR_OK && stat(flags->tarfile, &after) == 0 &&
+        after.st_mtime == before.st_mtime && after.st_size == before.st_size) {
+      members_insert(flags->members, flags->recording);
+    } else {
+      members_free_table(flags->recording);
+    }
+    flags->recording = NULL;
+    return err;
+  }
+
+  for (i = 0; i < table->count && err == MYTAR_OK; i++) {
+    memset(path, 0, sizeof(path));
+    extract_name(&table->headers[i], path);
+    if (path_matches(flags, path)) {
+      err = list_member(flags, &table->headers[i], path, strlen(path));
+    }
+  }
+
+  return err;
+}
+
+/* Lists the archive once the -T list, if any, has been loaded */
+int list_members(Flags *flags) {
+  /* --verify has to read the data, which the index cannot provide */
+  if (flags->gzip && !flags->verify) {
+    return gz_list(flags);
+  }
+
+  /* -S and --verify both need the archive itself */
+  if (flags->members != NULL && !flags->strict && !flags->verify &&
+      strcmp(flags->tarfile, "-") != 0) {
+    return list_cached(flags);
+  }
+  return read_archive(flags, print_entry);
+}
+
+int list_archive(Flags *flags) {
+  int err;
+
+  if ((err = load_operands(flags)) != MYTAR_OK) {
+    return err;
+  }
+  return list_members(flags);
+}
+
+/* Extracts a member, then records a checkpoint after it once one is due. The
+ * extracted files are made durable first. */
+static int extract_checkpointed(Flags *flags, Reader *reader, char *name) {
+  off_t offset;
+  int err;
+
+  if ((err = extract_path(flags, reader, name)) != MYTAR_OK ||
+      flags->checkpoint->resuming) {
+    return err;
+  }
+
+  offset = reader_offset(reader);
+  if (!checkpoint_due(flags->checkpoint, offset)) {
+    return MYTAR_OK;
+  }
+
+  if ((err = syncer_checkpoint(flags->syncer)) != MYTAR_OK) {
+    return err;
+  }
+  return checkpoint_save(flags->checkpoint, offset, name);
+}
+
+/* Checks that the archive can be checkpointed, and loads the checkpoint to
+ * resume from under --resume */
+static int checkpoint_start(Flags *flags, Checkpoint *checkpoint) {
+  if (strcmp(flags->tarfile, "-") == 0 || flags->gzip || flags->to_stdout) {
+    fprintf(stderr, "--checkpoint needs an uncompressed archive file\n");
+    return MYTAR_ERR_INVAL;
+  }
+
+  return checkpoint_init(checkpoint, flags->checkpoint_file,
+                         flags->checkpoint_every, flags->resume);
+}
+
+int extract_archive(Flags *flags) {
+  Restorer restorer;
+  Syncer syncer;
+  Checkpoint checkpoint;
+  int err;
+  int restore_err;
+  int sync_err = MYTAR_OK;
+
+  if ((err = load_operands(flags)) != MYTAR_OK) {
+    return err;
+  }
+
+  if (flags->checkpoint_file != NULL) {
+    if ((err = checkpoint_start(flags, &checkpoint)) != MYTAR_OK) {
+      return err;
+    }
+    flags->checkpoint = &checkpoint;
+  }
+
+  /* O writes nothing to the filesystem that would need restoring or
+   * syncing */
+  if (flags->to_stdout) {
+    return read_archive(flags, extract_path);
+  }
+
+  restorer_init(&restorer, flags->preserve, flags->same_owner);
+  flags->restorer = &restorer;
+  if (flags->sync_mode != SYNC_NONE) {
+    syncer_init(&syncer, flags->sync_mode);
+    flags->syncer = &syncer;
+  }
+
+  err = read_archive(flags, flags->checkpoint != NULL ? extract_checkpointed
+                                                      : extract_path);
+
+  /* directories extracted before a failure still get their metadata, and
+   * everything is made durable after it */
+  restore_err = restorer_finish(&restorer);
+  flags->restorer = NULL;
+  if (flags->syncer != NULL) {
+    sync_err = syncer_finish(&syncer);
+    flags->syncer = NULL;
+  }
+
+  if (err == MYTAR_OK) {
+    err = restore_err != MYTAR_OK ? restore_err : sync_err;
+  }
+
+  /* the checkpoint is kept for a later --resume unless everything worked */
+  if (flags->checkpoint != NULL) {
+    if (err == MYTAR_OK) {
+      err = checkpoint_finish(flags->checkpoint);
+    }
+    flags->checkpoint = NULL;
+  }
+  return err;
+}
+
+/* Calls fn on every path operand, first those on the command line, then those
+ * read one at a time from the -T file list */
+int for_each_operand(Flags *flags, operand_fn fn, void *ctx) {
+  FileList list;
+  char path[PATH_MAX];
+  int status;
+  int i;
+  int err = MYTAR_OK;
+
+  for (i = 0; i < flags->n_paths && err == MYTAR_OK; i++) {
+    err = fn(flags, flags->paths[i], ctx);
+  }
+
+  if (err != MYTAR_OK || flags->files_from == NULL) {
+    return err;
+  }
+
+  if ((err = filelist_open(&list, flags->files_from, flags->null)) !=
+      MYTAR_OK) {
+    return err;
+  }
+
+  while (err == MYTAR_OK &&
+         (status = filelist_next(&list, path, sizeof(path))) != 0) {
+    err = status < 0 ? status : fn(flags, path, ctx);
+  }
+
+  filelist_close(&list);
+  return err;
+}
+
+/* Adds the paths of the -T file list to the matcher, where they select
+ * members on list and extract */
+int load_operands(Flags *flags) {
+  FileList list;
+  char path[PATH_MAX];
+  int status;
+  int err;
+
+  if (flags->files_from == NULL) {
+    return MYTAR_OK;
+  }
+
+  if (strcmp(flags->files_from, "-") == 0 &&
+      strcmp(flags->tarfile, "-") == 0) {
+    fprintf(stderr, "The archive and the file list cannot both be stdin\n");
+    return MYTAR_ERR_INVAL;
+  }
+
+  if (flags->matcher == NULL && (flags->matcher = matcher_new()) == NULL) {
+    return MYTAR_ERR_NOMEM;
+  }
+
+  if ((err = filelist_open(&list, flags->files_from, flags->null)) !=
+      MYTAR_OK) {
+    return err;
+  }
+
+  while (err == MYTAR_OK &&
+         (status = filelist_next(&list, path, sizeof(path))) != 0) {
+    err = status < 0 ? status : matcher_add_operand(flags->matcher, path);
+  }
+
+  filelist_close(&list);
+  return err;
+}
+
+static int create_operand(Flags *flags, const char *path, void *ctx) {
+  return traverse_path(path, ctx, flags);
+}
+
+int create_archive(Flags *flags) {
+  Writer writer;
+  GzWriter gz;
+  Checkpoint checkpoint;
+  bool compressed = false;
+  bool resuming;
+  int fd;
+  int err = MYTAR_OK;
+  double start;
+
+  writer_init(&writer);
+  writer.stats = flags->stats;
+
+  if (flags->checkpoint_file != NULL) {
+    if ((err = checkpoint_start(flags, &checkpoint)) != MYTAR_OK) {
+      return err;
+    }
+    flags->checkpoint = &checkpoint;
+  }
+
+  if (strcmp(flags->tarfile, "-") == 0) {
+    writer_set_dst(&writer, STDOUT_FILENO);
+  } else {
+    /* a resumed archive keeps everything up to its checkpoint */
+    resuming = flags->checkpoint != NULL && flags->checkpoint->resuming;
+    stats_syscall(writer.stats, SYS_OPEN);
+    if ((fd = open(flags->tarfile,
+                   resuming ? O_WRONLY | O_CREAT : O_WRONLY | O_CREAT | O_TRUNC,
+                   0644)) == -1) {
+      perror("Failed to open destination file");
+      return MYTAR_ERR_IO;
+    }
+    if (resuming &&
+        (ftruncate(fd, checkpoint.resume_offset) == -1 ||
+         lseek(fd, checkpoint.resume_offset, SEEK_SET) == -1)) {
+      perror("Failed to resume destination file");
+      close(fd);
+      return MYTAR_ERR_IO;
+    }
+    writer_set_dst(&writer, fd);
+  }
+
+  /* digests are patched in after the data, which needs a seekable archive */
+  if (flags->digest && !io_is_seekable(writer.dst_fd)) {
+    fprintf(stderr, "--digest needs an archive that can seek\n");
+    err = MYTAR_ERR_INVAL;
+  }
+  writer.digest = flags->digest;
+  writer.align = flags->align;
+  writer.record_blocks = flags->blocking_factor;
+
+  /* offsets in a z archive are those of the compressed stream */
+  if (flags->gzip && (flags->digest || flags->align)) {
+    fprintf(stderr, "z cannot be combined with --digest or --align\n");
+    err = MYTAR_ERR_INVAL;
+  } else if (flags->gzip) {
+    err = gz_writer_init(&gz, &writer, writer.dst_fd);
+    compressed = err == MYTAR_OK;
+  }
+
+  start = stats_now();
+  if (err == MYTAR_OK) {
+    err = for_each_operand(flags, create_operand, &writer);
+  }
+  if (err == MYTAR_OK && flags->manifest != NULL) {
+    err = manifest_archive(flags, &writer);
+  }
+  stats_phase(writer.stats, PHASE_TRAVERSAL, start);
+
+  /* a walk that never met the checkpoint's member is not the walk that
+   * wrote the archive */
+  if (err == MYTAR_OK && flags->checkpoint != NULL &&
+      flags->checkpoint->resuming) {
+    fprintf(stderr, "%s was not found again, cannot resume\n",
+            checkpoint.resume_member);
+    err = MYTAR_ERR_INVAL;
+  }
+
+  if (err == MYTAR_OK && (err = writer_pad(&writer)) == MYTAR_OK) {
+    err = writer_flush(&writer);
+  }
+
+  if (flags->checkpoint != NULL) {
+    if (err == MYTAR_OK) {
+      err = checkpoint_finish(flags->checkpoint);
+    }
+    flags->checkpoint = NULL;
+  }
+
+  if (compressed) {
+    err = err == MYTAR_OK ? gz_writer_finish(&gz) : err;
+    gz_writer_free(&gz);
+  }
+
+  if (writer.dst_fd != STDOUT_FILENO) {
+    stats_syscall(writer.stats, SYS_CLOSE);
+    close(writer.dst_fd);
+  }
+  return err;
+}
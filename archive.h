@@ -0,0 +1,45 @@
+#ifndef ARCHIVE
+#define ARCHIVE
+
+#include "header.h"
+#include "match.h"
+#include "mytar.h"
+#include "reader.h"
+#include "stats.h"
+#include "writer.h"
+#include <stdbool.h>
+#include <sys/stat.h>
+
+/* returned by a visit_fn to leave a path, and anything below it, out */
+#define WALK_PRUNE 1
+
+/* called by walk_path for every file, link and directory */
+typedef int (*visit_fn)(const char *path, struct stat *path_stat, void *ctx);
+
+/* called by for_each_operand for every path operand */
+typedef int (*operand_fn)(Flags *flags, const char *path, void *ctx);
+
+void init_flags(Flags *flags);
+int write_member(Writer *writer, const void *data);
+int process_path(const char *src, Writer *writer, bool is_verbose);
+int walk_path(const char *path, visit_fn visit, void *ctx, Stats *stats);
+int archive_path(const char *path, Writer *writer, bool is_verbose);
+int traverse_path(const char *path, Writer *writer, const Flags *flags);
+int list_member(Flags *flags, const TarHeader *header, const char *name,
+                size_t len);
+int print_entry(Flags *flags, Reader *reader, char *name);
+int path_to_filesystem(const char *path, TarHeader *header, Stats *stats);
+int extract_path(Flags *flags, Reader *reader, char *name);
+bool path_matches(Flags *flags, const char *path);
+int traverse_execute_archive(Reader *reader, Flags *flags,
+                             int (*process_entry)(Flags *, Reader *, char *));
+int read_archive(Flags *flags, int (*process_entry)(Flags *, Reader *, char *));
+
+int for_each_operand(Flags *flags, operand_fn fn, void *ctx);
+int load_operands(Flags *flags);
+int create_archive(Flags *flags);
+int list_members(Flags *flags);
+int list_archive(Flags *flags);
+int extract_archive(Flags *flags);
+
+#endif
@@ -0,0 +1,126 @@
+/* checkpoint.c
+ * This file keeps the --checkpoint file of a long create or extract. Every
+ * interval of archive bytes, once the output up to the last completed member
+ * is durable, the archive offset at the end of that member and its name are
+ * recorded. A --resume run picks up from there: create truncates the archive
+ * back to the offset and walks the same operands without writing anything up
+ * to and including the recorded member, and extract skips the members that
+ * end before the offset. The file is written next to itself and renamed into
+ * place, so a crash leaves either the old checkpoint or the new one. It is
+ * removed once the job completes.
+ */
+#define _GNU_SOURCE
+
+#include "checkpoint.h"
+#include "libmytar.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* first line of a checkpoint file, followed by the offset and member name */
+#define CHECKPOINT_MAGIC "mytar checkpoint 1\n"
+
+/* Reads the checkpoint left by an interrupted run. Without one, the job
+ * starts from the beginning. */
+static int checkpoint_load(Checkpoint *checkpoint) {
+  char contents[sizeof(CHECKPOINT_MAGIC) + 32 + PATH_MAX];
+  char *member;
+  char *end;
+  ssize_t len;
+  int fd;
+
+  if ((fd = open(checkpoint->path, O_RDONLY)) == -1) {
+    if (errno == ENOENT) {
+      return MYTAR_OK;
+    }
+    perror(checkpoint->path);
+    return MYTAR_ERR_IO;
+  }
+
+  len = read(fd, contents, sizeof(contents) - 1);
+  close(fd);
+
+  if (len <= 0) {
+    fprintf(stderr, "%s: Invalid checkpoint\n", checkpoint->path);
+    return MYTAR_ERR_FORMAT;
+  }
+  contents[len] = '\0';
+
+  if (strncmp(contents, CHECKPOINT_MAGIC, strlen(CHECKPOINT_MAGIC)) != 0 ||
+      (member = strchr(contents + strlen(CHECKPOINT_MAGIC), '\n')) == NULL ||
+      (end = strrchr(member, '\n')) == member) {
+    fprintf(stderr, "%s: Invalid checkpoint\n", checkpoint->path);
+    return MYTAR_ERR_FORMAT;
+  }
+
+  *end = '\0';
+  checkpoint->resume_offset =
+      strtol(contents + strlen(CHECKPOINT_MAGIC), NULL, 10);
+  strcpy(checkpoint->resume_member, member + 1);
+  checkpoint->saved = checkpoint->resume_offset;
+  checkpoint->resuming = true;
+  return MYTAR_OK;
+}
+
+/* Sets up checkpoints every interval_mb MiB in path, loading the one left
+ * behind by an interrupted run when resume is set */
+int checkpoint_init(Checkpoint *checkpoint, const char *path, long interval_mb,
+                    bool resume) {
+  checkpoint->path = path;
+  checkpoint->interval =
+      interval_mb > 0 ? interval_mb * 1024 * 1024 : CHECKPOINT_INTERVAL;
+  checkpoint->saved = 0;
+  checkpoint->resuming = false;
+  checkpoint->resume_offset = 0;
+  checkpoint->resume_member[0] = '\0';
+
+  return resume ? checkpoint_load(checkpoint) : MYTAR_OK;
+}
+
+/* Returns true once a full interval has passed since the last checkpoint */
+bool checkpoint_due(const Checkpoint *checkpoint, off_t offset) {
+  return offset - checkpoint->saved >= checkpoint->interval;
+}
+
+/* Records that everything up to offset, ending with member, is durable. The
+ * caller syncs the output first. */
+int checkpoint_save(Checkpoint *checkpoint, off_t offset, const char *member) {
+  char tmp[PATH_MAX];
+  FILE *file;
+  int failed;
+
+  if (snprintf(tmp, sizeof(tmp), "%s.tmp", checkpoint->path) >=
+      (int)sizeof(tmp)) {
+    fprintf(stderr, "Path too long %s\n", checkpoint->path);
+    return MYTAR_ERR_NAME;
+  }
+
+  if ((file = fopen(tmp, "w")) == NULL) {
+    perror(tmp);
+    return MYTAR_ERR_IO;
+  }
+
+  fprintf(file, "%s%ld\n%s\n", CHECKPOINT_MAGIC, (long)offset, member);
+  failed = fflush(file) != 0 || fsync(fileno(file)) == -1;
+  failed = fclose(file) != 0 || failed;
+
+  if (failed || rename(tmp, checkpoint->path) == -1) {
+    perror(checkpoint->path);
+    return MYTAR_ERR_IO;
+  }
+
+  checkpoint->saved = offset;
+  return MYTAR_OK;
+}
+
+/* Removes the checkpoint of a job that completed */
+int checkpoint_finish(Checkpoint *checkpoint) {
+  if (unlink(checkpoint->path) == -1 && errno != ENOENT) {
+    perror(checkpoint->path);
+    return MYTAR_ERR_IO;
+  }
+  return MYTAR_OK;
+}
@@ -0,0 +1,32 @@
+#ifndef CHECKPOINT
+#define CHECKPOINT
+
+#include <linux/limits.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+/* archive bytes between checkpoints unless --checkpoint-every says otherwise
+ */
+#define CHECKPOINT_INTERVAL (64L * 1024 * 1024)
+
+typedef struct {
+  const char *path;
+  off_t interval;
+
+  /* archive offset recorded by the last checkpoint */
+  off_t saved;
+
+  /* --resume: where the interrupted run got to, and the name of the last
+   * member it completed */
+  bool resuming;
+  off_t resume_offset;
+  char resume_member[PATH_MAX];
+} Checkpoint;
+
+int checkpoint_init(Checkpoint *checkpoint, const char *path, long interval_mb,
+                    bool resume);
+bool checkpoint_due(const Checkpoint *checkpoint, off_t offset);
+int checkpoint_save(Checkpoint *checkpoint, off_t offset, const char *member);
+int checkpoint_finish(Checkpoint *checkpoint);
+
+#endif
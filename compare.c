@@ -0,0 +1,365 @@
+/* compare.c
+ * This file implements d, which checks an archive against the filesystem.
+ * Members are read in order with the Reader, and each one's type, size, mode,
+ * mtime or link target is compared with lstat of its path. Only differences
+ * are printed. When the archive can be mapped into memory the contents of
+ * regular files are compared by a pool of threads, each mapping the file on
+ * disk and comparing it with the member in place, while the main thread moves
+ * on to the next header. Otherwise the contents are compared as they stream
+ * past.
+ */
+#define _GNU_SOURCE
+
+#include "compare.h"
+#include "archive.h"
+#include "gz.h"
+#include "header.h"
+#include "io.h"
+#include "libmytar.h"
+#include "pool.h"
+#include "reader.h"
+#include "writer.h"
+#include <fcntl.h>
+#include <linux/limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* contents waiting to be compared, per worker */
+#define COMPARE_QUEUE 256
+
+typedef struct {
+  /* the mapped archive, or NULL when contents are compared while reading */
+  const unsigned char *base;
+  off_t length;
+  Pool pool;
+  long differences;
+  pthread_mutex_t lock;
+} Compare;
+
+typedef struct {
+  char *path;
+  off_t offset;
+  long size;
+} CompareTask;
+
+static void report_difference(Compare *compare, const char *path,
+                              const char *what) {
+  pthread_mutex_lock(&compare->lock);
+  compare->differences++;
+  printf("%s: %s\n", path, what);
+  pthread_mutex_unlock(&compare->lock);
+}
+
+/* Compares a member held in the mapped archive with the file on disk. Runs
+ * on a pool thread. */
+static void compare_mapped(void *arg, void *ctx) {
+  CompareTask *task = arg;
+  Compare *compare = ctx;
+  struct stat path_stat;
+  void *data;
+  int fd;
+
+  if ((fd = open(task->path, O_RDONLY)) == -1) {
+    report_difference(compare, task->path, "Cannot open");
+  } else if (fstat(fd, &path_stat) == -1 || path_stat.st_size != task->size) {
+    report_difference(compare, task->path, "Size differs");
+  } else if ((data = mmap(NULL, task->size, PROT_READ, MAP_PRIVATE, fd, 0)) ==
+             MAP_FAILED) {
+    report_difference(compare, task->path, "Cannot read");
+  } else {
+    madvise(data, task->size, MADV_SEQUENTIAL);
+    if (memcmp(compare->base + task->offset, data, task->size) != 0) {
+      report_difference(compare, task->path, "Contents differ");
+    }
+    munmap(data, task->size);
+  }
+
+  if (fd != -1) {
+    close(fd);
+  }
+  free(task->path);
+  free(task);
+}
+
+/* Compares the member's contents with the file on disk as they are read from
+ * the archive. What is left of the member is skipped by the caller. */
+static int compare_stream(Compare *compare, Reader *reader, const char *path) {
+  char archive_buf[IO_CHUNK];
+  char file_buf[IO_CHUNK];
+  ssize_t archive_read;
+  ssize_t file_read;
+  int fd;
+
+  if ((fd = open(path, O_RDONLY)) == -1) {
+    report_difference(compare, path, "Cannot open");
+    return MYTAR_OK;
+  }
+
+  while ((archive_read = reader_read_contents(reader, archive_buf,
+                                              sizeof(archive_buf))) > 0) {
+    file_read = io_read_full(fd, file_buf, archive_read, reader->stats);
+
+    if (file_read != archive_read ||
+        memcmp(archive_buf, file_buf, archive_read) != 0) {
+      report_difference(compare, path, "Contents differ");
+      break;
+    }
+  }
+
+  close(fd);
+  return archive_read < 0 ? archive_read : MYTAR_OK;
+}
+
+/* Queues or performs the comparison of a regular file's contents */
+static int compare_contents(Compare *compare, Reader *reader, const char *path,
+                            long size) {
+  CompareTask *task;
+  off_t offset;
+
+  if (size == 0) {
+    return MYTAR_OK;
+  }
+
+  if (compare->base == NULL) {
+    return compare_stream(compare, reader, path);
+  }
+
+  if ((offset = reader_offset(reader)) == -1) {
+    return MYTAR_ERR_IO;
+  }
+
+  /* a truncated member is left to the reader to report */
+  if (offset + size > compare->length) {
+    return compare_stream(compare, reader, path);
+  }
+
+  if ((task = malloc(sizeof(CompareTask))) == NULL ||
+      (task->path = malloc(strlen(path) + 1)) == NULL) {
+    free(task);
+    return MYTAR_ERR_NOMEM;
+  }
+
+  strcpy(task->path, path);
+  task->offset = offset;
+  task->size = size;
+  pool_submit(&compare->pool, task);
+  return MYTAR_OK;
+}
+
+/* Compares one member's metadata with the filesystem, then its contents */
+static int compare_entry(Flags *flags, Compare *compare, Reader *reader,
+                         const char *path) {
+  TarHeader *header = reader->current_entry->header;
+  struct stat path_stat;
+  char target[sizeof(header->linkname) + 1];
+  char on_disk[sizeof(header->linkname) + 1];
+  ssize_t len;
+  long size;
+  long mode;
+  int err = MYTAR_OK;
+
+  if (flags->verbose) {
+    printf("%s\n", path);
+  }
+
+  stats_syscall(reader->stats, SYS_STAT);
+  if (lstat(path, &path_stat) == -1) {
+    report_difference(compare, path, "Does not exist");
+    return reader_skip_file_contents(reader);
+  }
+
+  size = strtol((char *)header->size, NULL, OCTAL_SIZE);
+  mode = strtol((char *)header->mode, NULL, OCTAL_SIZE) & 07777;
+
+  switch (header->typeflag) {
+  case '0':
+  case '\0':
+    if (!S_ISREG(path_stat.st_mode)) {
+      report_difference(compare, path, "File type differs");
+      break;
+    }
+    if (mode != (path_stat.st_mode & 07777)) {
+      report_difference(compare, path, "Mode differs");
+    }
+    if (strtol((char *)header->mtime, NULL, OCTAL_SIZE) !=
+        path_stat.st_mtime) {
+      report_difference(compare, path, "Mod time differs");
+    }
+    if (size != path_stat.st_size) {
+      report_difference(compare, path, "Size differs");
+    } else {
+      err = compare_contents(compare, reader, path, size);
+    }
+    break;
+  case '5':
+    if (!S_ISDIR(path_stat.st_mode)) {
+      report_difference(compare, path, "File type differs");
+    } else if (mode != (path_stat.st_mode & 07777)) {
+      report_difference(compare, path, "Mode differs");
+    }
+    break;
+  case '2':
+    if (!S_ISLNK(path_stat.st_mode)) {
+      report_difference(compare, path, "File type differs");
+      break;
+    }
+
+    memcpy(target, header->linkname, sizeof(header->linkname));
+    target[sizeof(header->linkname)] = '\0';
+    len = readlink(path, on_disk, sizeof(on_disk));
+    if (len < 0 || len == sizeof(on_disk)) {
+      report_difference(compare, path, "Symlink differs");
+      break;
+    }
+    on_disk[len] = '\0';
+    if (strcmp(target, on_disk) != 0) {
+      report_difference(compare, path, "Symlink differs");
+    }
+    break;
+  default:
+    break;
+  }
+
+  if (err != MYTAR_OK) {
+    return err;
+  }
+
+  return reader_skip_file_contents(reader);
+}
+
+static int compare_members(Flags *flags, Compare *compare, Reader *reader) {
+  char path[PATH_MAX];
+  int reader_status;
+  int err = MYTAR_OK;
+
+  while (err == MYTAR_OK && (reader_status = reader_cycle_entry(reader)) != 0) {
+
+    if (reader_status == MYTAR_ERR_STRICT) {
+      fprintf(stderr, "Encountered non-compliant entry. Skipping.\n");
+      err = reader_skip_file_contents(reader);
+      continue;
+    }
+
+    if (reader_status < 0) {
+      return reader_status;
+    }
+
+    memset(path, 0, sizeof(path));
+    extract_name(reader->current_entry->header, path);
+
+    if (path_matches(flags, path)) {
+      err = compare_entry(flags, compare, reader, path);
+    } else {
+      err = reader_skip_file_contents(reader);
+    }
+  }
+
+  return err;
+}
+
+/* Maps a regular-file archive and starts the pool that compares contents.
+ * Leaves compare->base NULL if the archive cannot be mapped. */
+static void compare_map(Flags *flags, Compare *compare, int fd,
+                        struct stat *archive_stat) {
+  void *base;
+  int n_threads = flags->threads;
+
+  if (fstat(fd, archive_stat) == -1 || !S_ISREG(archive_stat->st_mode) ||
+      archive_stat->st_size == 0) {
+    return;
+  }
+
+  base = mmap(NULL, archive_stat->st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (base == MAP_FAILED) {
+    return;
+  }
+
+  /* one thread per CPU unless --threads was given */
+  if (n_threads == 0 && (n_threads = sysconf(_SC_NPROCESSORS_ONLN)) < 1) {
+    n_threads = 1;
+  }
+
+  if (pool_init(&compare->pool, n_threads, COMPARE_QUEUE * n_threads,
+                compare_mapped, compare) != MYTAR_OK) {
+    munmap(base, archive_stat->st_size);
+    return;
+  }
+
+  compare->base = base;
+  compare->length = archive_stat->st_size;
+}
+
+/* Compares the archive with the filesystem. Returns MYTAR_ERR_DIFFERS if any
+ * difference was found. */
+int compare_archive(Flags *flags) {
+  Reader reader;
+  Compare compare;
+  GzReader gz;
+  struct stat archive_stat;
+  double start = stats_now();
+  int err;
+  int gz_err;
+  int fd;
+
+  if ((err = load_operands(flags)) != MYTAR_OK) {
+    return err;
+  }
+
+  reader_init(&reader, flags->strict);
+  reader_set_record(&reader, flags->blocking_factor);
+  reader.stats = flags->stats;
+
+  if (strcmp(flags->tarfile, "-") == 0) {
+    fd = STDIN_FILENO;
+  } else {
+    stats_syscall(reader.stats, SYS_OPEN);
+    if ((fd = open(flags->tarfile, O_RDONLY)) == -1) {
+      perror("Could not open archive");
+      return MYTAR_ERR_IO;
+    }
+  }
+  /* z archives are inflated into a pipe, which is compared as it streams */
+  reader_set_src(&reader, flags->gzip ? gz_reader_start(&gz, flags, fd) : fd);
+  if (reader.src_fd == -1) {
+    reader_free(&reader);
+    if (fd != STDIN_FILENO) {
+      close(fd);
+    }
+    return MYTAR_ERR_IO;
+  }
+
+  compare.base = NULL;
+  compare.differences = 0;
+  pthread_mutex_init(&compare.lock, NULL);
+  compare_map(flags, &compare, reader.src_fd, &archive_stat);
+
+  err = compare_members(flags, &compare, &reader);
+  if (flags->gzip && (gz_err = gz_reader_finish(&gz)) != MYTAR_OK &&
+      err == MYTAR_OK) {
+    err = gz_err;
+  }
+
+  if (compare.base != NULL) {
+    pool_finish(&compare.pool);
+    munmap((void *)compare.base, archive_stat.st_size);
+  }
+  pthread_mutex_destroy(&compare.lock);
+  fflush(stdout);
+  stats_phase(reader.stats, PHASE_TRAVERSAL, start);
+
+  reader_free(&reader);
+  if (fd != STDIN_FILENO) {
+    stats_syscall(reader.stats, SYS_CLOSE);
+    close(fd);
+  }
+
+  if (err == MYTAR_OK && compare.differences > 0) {
+    return MYTAR_ERR_DIFFERS;
+  }
+  return err;
+}
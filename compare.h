@@ -0,0 +1,8 @@
+#ifndef COMPARE
+#define COMPARE
+
+#include "mytar.h"
+
+int compare_archive(Flags *flags);
+
+#endif
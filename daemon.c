@@ -0,0 +1,525 @@
+/* daemon.c
+ * This file implements mytar --daemon SOCKET, which runs command lines sent
+ * to it over a Unix socket by mytar --client SOCKET, so that runs of many
+ * short jobs skip process startup and keep the owner names and archive member
+ * tables they looked up warm between jobs. A client sends its working
+ * directory and arguments along with its stdin, stdout and stderr, and gets
+ * back the exit status, so the job reads and writes exactly where it would
+ * have on its own. Every job runs in a process forked from the daemon, so
+ * jobs run side by side (one can read what another writes) and start with
+ * the daemon's caches; when it is done, the job sends back the names it
+ * looked up and the member tables it read or used. Only clients of the
+ * daemon's own user are served.
+ */
+
+#define _GNU_SOURCE
+#include "daemon.h"
+#include "header.h"
+#include "io.h"
+#include "libmytar.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+/* the client's stdin, stdout and stderr travel with its request */
+#define DAEMON_FDS 3
+
+/* the most jobs running at once */
+#define DAEMON_JOBS 64
+
+/* a job being served, the channel it reports back on and the client that
+ * waits for its exit status */
+typedef struct {
+  pid_t pid;
+  int channel;
+  int conn;
+} DaemonJob;
+
+/* names the archive a member table reported by a job belongs to, followed
+ * by count headers, or by none if count is -1 and the job only used it */
+typedef struct {
+  dev_t dev;
+  ino_t ino;
+  time_t mtime;
+  off_t size;
+  long count;
+} MemberKey;
+
+static int daemon_address(const char *path, struct sockaddr_un *addr) {
+  memset(addr, 0, sizeof(*addr));
+  addr->sun_family = AF_UNIX;
+
+  if (strlen(path) >= sizeof(addr->sun_path)) {
+    fprintf(stderr, "Socket path too long:\n%s\n", path);
+    return MYTAR_ERR_NAME;
+  }
+
+  strcpy(addr->sun_path, path);
+  return MYTAR_OK;
+}
+
+/* Receives the length of a request and the descriptors sent with it */
+static int daemon_receive(int conn, uint32_t *len, int *fds) {
+  union {
+    char buf[CMSG_SPACE(sizeof(int) * DAEMON_FDS)];
+    struct cmsghdr align;
+  } control;
+  struct msghdr msg;
+  struct iovec iov;
+  struct cmsghdr *cmsg;
+
+  memset(&msg, 0, sizeof(msg));
+  iov.iov_base = len;
+  iov.iov_len = sizeof(*len);
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control.buf;
+  msg.msg_controllen = sizeof(control.buf);
+
+  if (recvmsg(conn, &msg, MSG_CMSG_CLOEXEC) != sizeof(*len)) {
+    return MYTAR_ERR_IO;
+  }
+
+  cmsg = CMSG_FIRSTHDR(&msg);
+  if (cmsg == NULL || cmsg->cmsg_level != SOL_SOCKET ||
+      cmsg->cmsg_type != SCM_RIGHTS ||
+      cmsg->cmsg_len != CMSG_LEN(sizeof(int) * DAEMON_FDS)) {
+    return MYTAR_ERR_FORMAT;
+  }
+
+  memcpy(fds, CMSG_DATA(cmsg), sizeof(int) * DAEMON_FDS);
+  return MYTAR_OK;
+}
+
+/* Sends the length of a request along with the caller's stdin, stdout and
+ * stderr */
+static int daemon_send(int sock, uint32_t len) {
+  union {
+    char buf[CMSG_SPACE(sizeof(int) * DAEMON_FDS)];
+    struct cmsghdr align;
+  } control;
+  int fds[DAEMON_FDS] = {STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO};
+  struct msghdr msg;
+  struct iovec iov;
+  struct cmsghdr *cmsg;
+
+  memset(&msg, 0, sizeof(msg));
+  memset(&control, 0, sizeof(control));
+  iov.iov_base = &len;
+  iov.iov_len = sizeof(len);
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control.buf;
+  msg.msg_controllen = sizeof(control.buf);
+
+  cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+  memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+  if (sendmsg(sock, &msg, 0) != sizeof(len)) {
+    perror("Failed to send the request");
+    return MYTAR_ERR_IO;
+  }
+  return MYTAR_OK;
+}
+
+/* Splits a request, the working directory followed by the arguments, each
+ * NUL-terminated, into an argv headed by "mytar". Returns NULL if it cannot
+ * be allocated. */
+static char **daemon_argv(char *request, uint32_t len, int *argc) {
+  char **argv;
+  uint32_t i;
+  int n = 0;
+
+  for (i = 0; i < len; i++) {
+    n += request[i] == '\0';
+  }
+
+  /* the directory's place is taken by argv[0] */
+  if ((argv = malloc((n + 1) * sizeof(char *))) == NULL) {
+    return NULL;
+  }
+
+  argv[0] = "mytar";
+  *argc = 1;
+  for (i = strlen(request) + 1; i < len; i += strlen(request + i) + 1) {
+    argv[(*argc)++] = request + i;
+  }
+  argv[*argc] = NULL;
+
+  return argv;
+}
+
+/* Runs one client's request in this job's process, with the client's
+ * descriptors as stdin, stdout and stderr and its directory as the working
+ * directory, and lets go of them afterwards. Returns the exit status. */
+static int daemon_request(int conn, daemon_fn run, MemberCache *members) {
+  struct ucred cred;
+  socklen_t cred_len = sizeof(cred);
+  uint32_t len;
+  int fds[DAEMON_FDS];
+  char *request = NULL;
+  char **argv = NULL;
+  int argc;
+  int status = EXIT_FAILURE;
+  int null_fd;
+  int err;
+  int i;
+
+  if (getsockopt(conn, SOL_SOCKET, SO_PEERCRED, &cred, &cred_len) == -1 ||
+      cred.uid != getuid()) {
+    fprintf(stderr, "Refused a client of another user\n");
+    return EXIT_FAILURE;
+  }
+
+  /* a connection closed without a request is only someone probing */
+  if ((err = daemon_receive(conn, &len, fds)) != MYTAR_OK) {
+    if (err == MYTAR_ERR_FORMAT) {
+      fprintf(stderr, "Malformed request\n");
+    }
+    return EXIT_FAILURE;
+  }
+
+  if (len > 0 && len <= DAEMON_REQUEST_MAX &&
+      (request = malloc(len)) != NULL &&
+      io_read_full(conn, request, len, NULL) == len &&
+      request[len - 1] == '\0') {
+    argv = daemon_argv(request, len, &argc);
+  }
+
+  for (i = 0; i < DAEMON_FDS; i++) {
+    dup2(fds[i], i);
+    close(fds[i]);
+  }
+
+  if (argv == NULL) {
+    fprintf(stderr, "mytar: the daemon could not read the request\n");
+  } else if (chdir(request) == -1) {
+    perror(request);
+  } else {
+    status = run(argc, argv, members);
+  }
+
+  /* whoever reads the client's stdout waits for every copy to be closed */
+  fflush(stdout);
+  fflush(stderr);
+  if ((null_fd = open("/dev/null", O_RDWR)) != -1) {
+    for (i = 0; i < DAEMON_FDS; i++) {
+      dup2(null_fd, i);
+    }
+    close(null_fd);
+  }
+
+  free(argv);
+  free(request);
+  return status;
+}
+
+/* Sends the daemon what a job learned: every cached owner name, the member
+ * tables it read and the keys of those it used */
+static void daemon_report(int channel, MemberCache *members) {
+  NameCache names;
+  MemberKey key;
+  MemberTable *table;
+
+  names_snapshot(&names);
+  if (io_write_full(channel, &names, sizeof(names), NULL) != MYTAR_OK) {
+    return;
+  }
+
+  for (table = members->tail; table != NULL; table = table->prev) {
+    if (!table->fresh && !table->used) {
+      continue;
+    }
+
+    memset(&key, 0, sizeof(key));
+    key.dev = table->dev;
+    key.ino = table->ino;
+    key.mtime = table->mtime;
+    key.size = table->size;
+    key.count = table->fresh ? table->count : -1;
+
+    if (io_write_full(channel, &key, sizeof(key), NULL) != MYTAR_OK ||
+        (table->fresh &&
+         io_write_full(channel, table->headers,
+                       table->count * sizeof(TarHeader), NULL) != MYTAR_OK)) {
+      return;
+    }
+  }
+}
+
+/* Takes in a finished job's report. A report cut short by a job that died
+ * keeps whatever arrived whole. */
+static void daemon_import(int channel, MemberCache *members) {
+  NameCache names;
+  MemberKey key;
+  MemberTable *table;
+  struct stat archive;
+
+  if (io_read_full(channel, &names, sizeof(names), NULL) != sizeof(names)) {
+    return;
+  }
+  names_merge(&names);
+
+  while (io_read_full(channel, &key, sizeof(key), NULL) == sizeof(key)) {
+    memset(&archive, 0, sizeof(archive));
+    archive.st_dev = key.dev;
+    archive.st_ino = key.ino;
+    archive.st_mtime = key.mtime;
+    archive.st_size = key.size;
+
+    if (key.count < 0) {
+      members_lookup(members, &archive);
+      continue;
+    }
+
+    if (key.count * (long)sizeof(TarHeader) > MEMBERS_BYTES ||
+        (table = members_new(&archive)) == NULL) {
+      break;
+    }
+    table->count = key.count;
+    table->capacity = key.count;
+    if ((table->headers = malloc(key.count * sizeof(TarHeader) + 1)) ==
+            NULL ||
+        io_read_full(channel, table->headers, key.count * sizeof(TarHeader),
+                     NULL) != key.count * (long)sizeof(TarHeader)) {
+      members_free_table(table);
+      break;
+    }
+    members_insert(members, table);
+  }
+
+  members_clear_marks(members);
+}
+
+/* Forks a job to serve the client on conn. The job reports back on a
+ * channel of its own and exits with the status of the request, and
+ * jobs[*n_jobs] keeps both ends for the daemon. */
+static void daemon_start(int conn, int sock, daemon_fn run,
+                         MemberCache *members, DaemonJob *jobs, int *n_jobs) {
+  int channel[2];
+  pid_t pid;
+  int status;
+  int i;
+
+  if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, channel) == -1) {
+    perror("socketpair");
+    close(conn);
+    return;
+  }
+
+  if ((pid = fork()) == -1) {
+    perror("fork");
+    close(channel[0]);
+    close(channel[1]);
+    close(conn);
+    return;
+  }
+
+  if (pid == 0) {
+    close(sock);
+    close(channel[0]);
+    for (i = 0; i < *n_jobs; i++) {
+      close(jobs[i].channel);
+      close(jobs[i].conn);
+    }
+    /* the job behaves like mytar run on its own */
+    signal(SIGPIPE, SIG_DFL);
+
+    status = daemon_request(conn, run, members);
+    close(conn);
+    daemon_report(channel[1], members);
+    _exit(status);
+  }
+
+  close(channel[1]);
+  jobs[*n_jobs].pid = pid;
+  jobs[*n_jobs].channel = channel[0];
+  jobs[*n_jobs].conn = conn;
+  (*n_jobs)++;
+}
+
+/* Collects a finished job's report and exit status, and passes the status
+ * on to its client: the exit code, or minus the signal that killed it */
+static void daemon_finish(DaemonJob *job, MemberCache *members) {
+  int32_t reply;
+  int status;
+
+  daemon_import(job->channel, members);
+  close(job->channel);
+
+  waitpid(job->pid, &status, 0);
+  reply = WIFSIGNALED(status) ? -WTERMSIG(status) : WEXITSTATUS(status);
+  io_write_full(job->conn, &reply, sizeof(reply), NULL);
+  close(job->conn);
+}
+
+/* Listens on socket_path and serves requests until it fails. A socket left
+ * behind by a daemon that is gone is replaced, a live one is not. */
+int daemon_serve(const char *socket_path, daemon_fn run) {
+  struct sockaddr_un addr;
+  struct stat path_stat;
+  struct pollfd polls[DAEMON_JOBS + 1];
+  DaemonJob jobs[DAEMON_JOBS];
+  MemberCache members;
+  mode_t mask;
+  int n_jobs = 0;
+  int sock;
+  int conn;
+  int err;
+  int i;
+
+  if ((err = daemon_address(socket_path, &addr)) != MYTAR_OK) {
+    return err;
+  }
+
+  if ((sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) == -1) {
+    perror("socket");
+    return MYTAR_ERR_IO;
+  }
+
+  if (lstat(socket_path, &path_stat) == 0 && S_ISSOCK(path_stat.st_mode)) {
+    if (connect(sock, (struct sockaddr *)&addr, sizeof(addr)) == 0) {
+      fprintf(stderr, "A daemon is already listening on %s\n", socket_path);
+      close(sock);
+      return MYTAR_ERR_INVAL;
+    }
+    unlink(socket_path);
+  }
+
+  /* only the daemon's own user may connect */
+  mask = umask(077);
+  err = bind(sock, (struct sockaddr *)&addr, sizeof(addr));
+  umask(mask);
+  if (err == -1 || listen(sock, SOMAXCONN) == -1) {
+    perror(socket_path);
+    close(sock);
+    return MYTAR_ERR_IO;
+  }
+
+  /* a client that goes away must not take the daemon with it */
+  signal(SIGPIPE, SIG_IGN);
+  members_init(&members);
+
+  err = MYTAR_OK;
+  while (err == MYTAR_OK) {
+    /* new clients wait in the backlog while every job slot is taken */
+    polls[0].fd = n_jobs < DAEMON_JOBS ? sock : -1;
+    polls[0].events = POLLIN;
+    for (i = 0; i < n_jobs; i++) {
+      polls[i + 1].fd = jobs[i].channel;
+      polls[i + 1].events = POLLIN;
+    }
+
+    if (poll(polls, n_jobs + 1, -1) == -1) {
+      if (errno != EINTR) {
+        perror("poll");
+        err = MYTAR_ERR_IO;
+      }
+      continue;
+    }
+
+    /* backwards, so the job moved into a finished one's slot is done */
+    for (i = n_jobs - 1; i >= 0; i--) {
+      if (polls[i + 1].revents != 0) {
+        daemon_finish(&jobs[i], &members);
+        jobs[i] = jobs[--n_jobs];
+      }
+    }
+
+    if (polls[0].revents & POLLIN) {
+      if ((conn = accept4(sock, NULL, NULL, SOCK_CLOEXEC)) != -1) {
+        daemon_start(conn, sock, run, &members, jobs, &n_jobs);
+      } else if (errno != EINTR && errno != ECONNABORTED) {
+        perror("accept");
+        err = MYTAR_ERR_IO;
+      }
+    }
+  }
+
+  for (i = 0; i < n_jobs; i++) {
+    daemon_finish(&jobs[i], &members);
+  }
+  members_free(&members);
+  close(sock);
+  unlink(socket_path);
+  return err;
+}
+
+/* Has the daemon on socket_path run argv from the current directory, with
+ * this process's stdin, stdout and stderr. Returns the job's exit status, or
+ * dies of the signal that killed the job. */
+int daemon_client(const char *socket_path, int argc, char *argv[]) {
+  struct sockaddr_un addr;
+  char cwd[PATH_MAX];
+  char *request;
+  size_t len;
+  size_t used;
+  int32_t status;
+  int sock;
+  int i;
+
+  if (getcwd(cwd, sizeof(cwd)) == NULL) {
+    perror("getcwd");
+    return EXIT_FAILURE;
+  }
+
+  len = strlen(cwd) + 1;
+  for (i = 0; i < argc; i++) {
+    len += strlen(argv[i]) + 1;
+  }
+  if (len > DAEMON_REQUEST_MAX) {
+    fprintf(stderr, "Command line too long for the daemon\n");
+    return EXIT_FAILURE;
+  }
+
+  if (daemon_address(socket_path, &addr) != MYTAR_OK ||
+      (request = malloc(len)) == NULL) {
+    return EXIT_FAILURE;
+  }
+
+  used = strlen(cwd) + 1;
+  memcpy(request, cwd, used);
+  for (i = 0; i < argc; i++) {
+    memcpy(request + used, argv[i], strlen(argv[i]) + 1);
+    used += strlen(argv[i]) + 1;
+  }
+
+  if ((sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) == -1 ||
+      connect(sock, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+    perror(socket_path);
+    free(request);
+    return EXIT_FAILURE;
+  }
+
+  status = EXIT_FAILURE;
+  if (daemon_send(sock, len) == MYTAR_OK &&
+      io_write_full(sock, request, len, NULL) == MYTAR_OK &&
+      io_read_full(sock, &status, sizeof(status), NULL) != sizeof(status)) {
+    fprintf(stderr, "The daemon went away before replying\n");
+    status = EXIT_FAILURE;
+  }
+
+  close(sock);
+  free(request);
+
+  if (status < 0) {
+    signal(-status, SIG_DFL);
+    raise(-status);
+    return 128 - status;
+  }
+  return status;
+}
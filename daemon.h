@@ -0,0 +1,16 @@
+#ifndef DAEMON
+#define DAEMON
+
+#include "members.h"
+
+/* the longest command line, working directory included, a client may send */
+#define DAEMON_REQUEST_MAX (4L * 1024 * 1024)
+
+/* runs one forwarded command line in its job, returning or exiting with its
+ * status */
+typedef int (*daemon_fn)(int argc, char *argv[], MemberCache *members);
+
+int daemon_serve(const char *socket_path, daemon_fn run);
+int daemon_client(const char *socket_path, int argc, char *argv[]);
+
+#endif
@@ -0,0 +1,141 @@
+/* digest.c
+ * This file computes the CRC32C used to check member contents, and formats
+ * and parses the PAX record it is stored in. CRC32C is computed with the
+ * SSE4.2 crc32 instruction when the CPU has it, and with a slicing-by-8 table
+ * otherwise.
+ */
+
+#include "digest.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* reflected CRC32C (Castagnoli) polynomial */
+#define CRC32C_POLY 0x82F63B78
+
+static uint32_t crc_table[8][256];
+static pthread_once_t crc_once = PTHREAD_ONCE_INIT;
+static bool crc_hardware = false;
+
+static void crc_init() {
+  uint32_t crc;
+  int i;
+  int j;
+
+  for (i = 0; i < 256; i++) {
+    crc = i;
+    for (j = 0; j < 8; j++) {
+      crc = crc & 1 ? (crc >> 1) ^ CRC32C_POLY : crc >> 1;
+    }
+    crc_table[0][i] = crc;
+  }
+
+  for (i = 0; i < 256; i++) {
+    for (j = 1; j < 8; j++) {
+      crc_table[j][i] =
+          (crc_table[j - 1][i] >> 8) ^ crc_table[0][crc_table[j - 1][i] & 0xff];
+    }
+  }
+
+#if defined(__x86_64__)
+  crc_hardware = __builtin_cpu_supports("sse4.2");
+#endif
+}
+
+static uint32_t crc_software(uint32_t crc, const unsigned char *p,
+                             size_t len) {
+  uint32_t lo;
+  uint32_t hi;
+
+  while (len >= 8) {
+    lo = crc ^ (p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24);
+    hi = p[4] | p[5] << 8 | p[6] << 16 | (uint32_t)p[7] << 24;
+    crc = crc_table[7][lo & 0xff] ^ crc_table[6][(lo >> 8) & 0xff] ^
+          crc_table[5][(lo >> 16) & 0xff] ^ crc_table[4][lo >> 24] ^
+          crc_table[3][hi & 0xff] ^ crc_table[2][(hi >> 8) & 0xff] ^
+          crc_table[1][(hi >> 16) & 0xff] ^ crc_table[0][hi >> 24];
+    p += 8;
+    len -= 8;
+  }
+
+  while (len-- > 0) {
+    crc = (crc >> 8) ^ crc_table[0][(crc ^ *p++) & 0xff];
+  }
+
+  return crc;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2"))) static uint32_t
+crc_hardware_update(uint32_t crc, const unsigned char *p, size_t len) {
+  unsigned long wide = crc;
+  unsigned long word;
+
+  while (len >= sizeof(word)) {
+    memcpy(&word, p, sizeof(word));
+    wide = __builtin_ia32_crc32di(wide, word);
+    p += sizeof(word);
+    len -= sizeof(word);
+  }
+
+  crc = wide;
+  while (len-- > 0) {
+    crc = __builtin_ia32_crc32qi(crc, *p++);
+  }
+
+  return crc;
+}
+#endif
+
+/* Continues crc over len bytes of data. Start with a crc of 0. */
+uint32_t crc32c(uint32_t crc, const void *data, size_t len) {
+  pthread_once(&crc_once, crc_init);
+
+  crc = ~crc;
+#if defined(__x86_64__)
+  if (crc_hardware) {
+    return ~crc_hardware_update(crc, data, len);
+  }
+#endif
+  return ~crc_software(crc, data, len);
+}
+
+/* Formats the DIGEST_RECORD_SIZE byte PAX record holding crc. record must
+ * have room for the terminating null as well. */
+void digest_record(char *record, uint32_t crc) {
+  sprintf(record, "%d %s=%08lx\n", DIGEST_RECORD_SIZE, DIGEST_KEYWORD,
+          (unsigned long)crc);
+}
+
+/* Looks for the digest record among len bytes of PAX records. Returns false
+ * if there is none, or the records are malformed. */
+bool digest_parse(const char *records, size_t len, uint32_t *crc) {
+  const char *p = records;
+  const char *end = records + len;
+  const char *keyword;
+  char *value_end;
+  size_t keyword_len = strlen(DIGEST_KEYWORD);
+  long record_len;
+
+  while (p < end && *p != '\0') {
+    /* each record is "<length> <keyword>=<value>\n" */
+    record_len = strtol(p, (char **)&keyword, 10);
+    if (record_len <= 0 || record_len > end - p || *keyword != ' ' ||
+        p[record_len - 1] != '\n') {
+      return false;
+    }
+    keyword++;
+
+    if (keyword + keyword_len < p + record_len &&
+        strncmp(keyword, DIGEST_KEYWORD, keyword_len) == 0 &&
+        keyword[keyword_len] == '=') {
+      *crc = strtoul(keyword + keyword_len + 1, &value_end, 16);
+      return value_end == p + record_len - 1;
+    }
+
+    p += record_len;
+  }
+
+  return false;
+}
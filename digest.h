@@ -0,0 +1,17 @@
+#ifndef DIGEST
+#define DIGEST
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* the PAX keyword member digests are stored under, and the length of the
+ * whole record "25 MYTAR.crc32c=xxxxxxxx\n" */
+#define DIGEST_KEYWORD "MYTAR.crc32c"
+#define DIGEST_RECORD_SIZE 25
+
+uint32_t crc32c(uint32_t crc, const void *data, size_t len);
+void digest_record(char *record, uint32_t crc);
+bool digest_parse(const char *records, size_t len, uint32_t *crc);
+
+#endif
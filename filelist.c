@@ -0,0 +1,70 @@
+/* filelist.c
+ * This file reads the paths given with -T FILE, separated by newlines or, with
+ * --null, by NUL bytes as written by find -print0. Paths are read one at a
+ * time into the caller's buffer, so a list of millions of paths takes no more
+ * memory than a list of one.
+ */
+
+#include "filelist.h"
+#include "libmytar.h"
+#include <string.h>
+
+/* Opens the list in file, "-" being stdin */
+int filelist_open(FileList *list, const char *file, bool null) {
+  list->delim = null ? '\0' : '\n';
+  list->strict = false;
+
+  if (strcmp(file, "-") == 0) {
+    list->in = stdin;
+  } else if ((list->in = fopen(file, "r")) == NULL) {
+    perror(file);
+    return MYTAR_ERR_IO;
+  }
+
+  return MYTAR_OK;
+}
+
+/* Reads the next path into path. Returns 1 for a path, 0 at the end of the
+ * list, or an error code. Empty entries are skipped, and so are paths that
+ * do not fit in size bytes unless the list is strict, which fails on them
+ * with MYTAR_ERR_NAME instead. */
+int filelist_next(FileList *list, char *path, size_t size) {
+  size_t len;
+  bool too_long;
+  int c;
+
+  do {
+    len = 0;
+    too_long = false;
+
+    while ((c = getc(list->in)) != EOF && c != list->delim) {
+      if (len + 1 < size) {
+        path[len++] = c;
+      } else {
+        too_long = true;
+      }
+    }
+    path[len] = '\0';
+
+    if (ferror(list->in)) {
+      perror("Failed to read file list");
+      return MYTAR_ERR_IO;
+    }
+
+    if (too_long && list->strict) {
+      fprintf(stderr, "Line too long %s...\n", path);
+      return MYTAR_ERR_NAME;
+    } else if (too_long) {
+      fprintf(stderr, "Path too long %s...\n", path);
+      len = 0;
+    }
+  } while (len == 0 && c != EOF);
+
+  return len > 0 ? 1 : 0;
+}
+
+void filelist_close(FileList *list) {
+  if (list->in != stdin) {
+    fclose(list->in);
+  }
+}
@@ -0,0 +1,19 @@
+#ifndef FILELIST
+#define FILELIST
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+/* reads the paths of a -T file one at a time */
+typedef struct {
+  FILE *in;
+  int delim;
+  bool strict;
+} FileList;
+
+int filelist_open(FileList *list, const char *file, bool null);
+int filelist_next(FileList *list, char *path, size_t size);
+void filelist_close(FileList *list);
+
+#endif
@@ -0,0 +1,604 @@
+/* gz.c
+ * This file implements z, a seekable gzip format. On create, the tar stream is
+ * cut at member boundaries into gzip members of about GZ_GROUP_SIZE bytes
+ * each, so that any member can be inflated without what comes before it.
+ * After the end of the archive come two more gzip members: an index holding
+ * the header, gzip member and offset of every archive member, and a fixed-size
+ * footer giving the offset of the index. The whole file is an ordinary
+ * multi-member gzip of an ordinary tar, which other tools read unchanged; the
+ * index and footer decompress to bytes after the end-of-archive blocks, which
+ * tar readers ignore.
+ *
+ * On read, a thread inflates the archive into a pipe that the Reader consumes.
+ * When the archive is a file with an index, only the gzip members holding the
+ * selected members are read, and t lists from the index alone.
+ */
+#define _GNU_SOURCE
+
+#include "gz.h"
+#include "archive.h"
+#include "libmytar.h"
+#include "reader.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/limits.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* an index entry is the header followed by the group, offset and length in
+ * hex */
+#define GZ_RECORD_SIZE (USTAR_BLOCK + 48)
+
+/* the footer is a stored gzip member around "MYTARGZ1" and the index offset
+ * in hex */
+#define GZ_MAGIC "MYTARGZ1"
+#define GZ_PAYLOAD_SIZE 24
+#define GZ_FOOTER_SIZE (10 + 5 + GZ_PAYLOAD_SIZE + 8)
+
+static int gz_index_add(GzIndex *index, const TarHeader *header, off_t group,
+                        off_t offset) {
+  GzRecord *grown;
+
+  if (index->count == index->capacity) {
+    index->capacity = index->capacity ? index->capacity * 2 : 1024;
+    grown = realloc(index->records, index->capacity * sizeof(GzRecord));
+    if (grown == NULL) {
+      return MYTAR_ERR_NOMEM;
+    }
+    index->records = grown;
+  }
+
+  memcpy(&index->records[index->count].header, header, sizeof(TarHeader));
+  index->records[index->count].group = group;
+  index->records[index->count].offset = offset;
+  index->records[index->count].length = 0;
+  index->count++;
+  return MYTAR_OK;
+}
+
+/* Runs deflate over the pending input and writes what it produces. With
+ * Z_FINISH this closes the gzip member. */
+static int gz_deflate(GzWriter *gz, int flush) {
+  size_t have;
+
+  do {
+    gz->stream.next_out = gz->out;
+    gz->stream.avail_out = sizeof(gz->out);
+
+    if (deflate(&gz->stream, flush) == Z_STREAM_ERROR) {
+      return MYTAR_ERR_IO;
+    }
+
+    have = sizeof(gz->out) - gz->stream.avail_out;
+    if (io_write_full(gz->fd, gz->out, have, gz->stats) != MYTAR_OK) {
+      return MYTAR_ERR_IO;
+    }
+    gz->compressed += have;
+  } while (gz->stream.avail_out == 0);
+
+  return MYTAR_OK;
+}
+
+static int gz_close_group(GzWriter *gz) {
+  if (!gz->in_group) {
+    return MYTAR_OK;
+  }
+
+  gz->in_group = false;
+  gz->stream.next_in = NULL;
+  gz->stream.avail_in = 0;
+  return gz_deflate(gz, Z_FINISH);
+}
+
+/* Compresses len bytes into the open gzip member, starting a new one if
+ * needed. Used as the Writer's write_fn. */
+static ssize_t gz_write(void *ctx, const void *buf, size_t len) {
+  GzWriter *gz = ctx;
+
+  if (!gz->in_group) {
+    deflateReset(&gz->stream);
+    gz->group = gz->compressed;
+    gz->group_start = gz->uncompressed;
+    gz->in_group = true;
+  }
+
+  gz->stream.next_in = (Bytef *)buf;
+  gz->stream.avail_in = len;
+  if (gz_deflate(gz, Z_NO_FLUSH) != MYTAR_OK) {
+    errno = EIO;
+    return -1;
+  }
+
+  gz->uncompressed += len;
+  return len;
+}
+
+/* Records the member about to be written, closing the gzip member first if
+ * it is large enough. Used as the Writer's begin_fn. */
+static int gz_begin(void *ctx, Writer *writer) {
+  GzWriter *gz = ctx;
+  int err;
+
+  if ((err = writer_flush(writer)) != MYTAR_OK) {
+    return err;
+  }
+
+  if (gz->index.count > 0) {
+    gz->index.records[gz->index.count - 1].length =
+        gz->uncompressed - gz->member_start;
+  }
+
+  if (gz->in_group && gz->uncompressed - gz->group_start >= GZ_GROUP_SIZE &&
+      (err = gz_close_group(gz)) != MYTAR_OK) {
+    return err;
+  }
+
+  gz->member_start = gz->uncompressed;
+  if (gz->in_group) {
+    return gz_index_add(&gz->index, writer->header, gz->group,
+                        gz->uncompressed - gz->group_start);
+  }
+  return gz_index_add(&gz->index, writer->header, gz->compressed, 0);
+}
+
+/* Sends the writer's output through gzip into fd */
+int gz_writer_init(GzWriter *gz, Writer *writer, int fd) {
+  memset(gz, 0, sizeof(GzWriter));
+  gz->fd = fd;
+  gz->stats = writer->stats;
+
+  if (deflateInit2(&gz->stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8,
+                   Z_DEFAULT_STRATEGY) != Z_OK) {
+    return MYTAR_ERR_NOMEM;
+  }
+
+  writer->write_fn = gz_write;
+  writer->begin_fn = gz_begin;
+  writer->write_ctx = gz;
+  return MYTAR_OK;
+}
+
+/* Writes the stored gzip member that points at the index */
+static int gz_write_footer(GzWriter *gz, off_t index_offset) {
+  unsigned char footer[GZ_FOOTER_SIZE];
+  char payload[GZ_PAYLOAD_SIZE + 1];
+  unsigned long crc;
+  int i;
+
+  sprintf(payload, "%s%016lx", GZ_MAGIC, (unsigned long)index_offset);
+  crc = crc32(0, (const Bytef *)payload, GZ_PAYLOAD_SIZE);
+
+  memset(footer, 0, sizeof(footer));
+  footer[0] = 0x1f;
+  footer[1] = 0x8b;
+  footer[2] = Z_DEFLATED;
+  footer[9] = 3;
+
+  /* a single final stored block */
+  footer[10] = 1;
+  footer[11] = GZ_PAYLOAD_SIZE;
+  footer[13] = ~GZ_PAYLOAD_SIZE & 0xff;
+  footer[14] = 0xff;
+  memcpy(footer + 15, payload, GZ_PAYLOAD_SIZE);
+
+  for (i = 0; i < 4; i++) {
+    footer[15 + GZ_PAYLOAD_SIZE + i] = (crc >> (8 * i)) & 0xff;
+    footer[19 + GZ_PAYLOAD_SIZE + i] = (GZ_PAYLOAD_SIZE >> (8 * i)) & 0xff;
+  }
+
+  return io_write_full(gz->fd, footer, sizeof(footer), gz->stats);
+}
+
+/* Closes the last gzip member of the archive, which the writer has padded
+ * and flushed, and appends the index and footer */
+int gz_writer_finish(GzWriter *gz) {
+  unsigned char record[GZ_RECORD_SIZE + 1];
+  GzRecord *entry;
+  off_t index_offset;
+  long i;
+  int err;
+
+  /* the last member ends where the end-of-archive blocks begin */
+  if (gz->index.count > 0) {
+    gz->index.records[gz->index.count - 1].length =
+        gz->uncompressed - 2 * USTAR_BLOCK - gz->member_start;
+  }
+
+  if ((err = gz_close_group(gz)) != MYTAR_OK) {
+    return err;
+  }
+
+  deflateReset(&gz->stream);
+  index_offset = gz->compressed;
+
+  for (i = 0; i < gz->index.count; i++) {
+    entry = &gz->index.records[i];
+    memcpy(record, &entry->header, USTAR_BLOCK);
+    sprintf((char *)record + USTAR_BLOCK, "%016lx%016lx%016lx",
+            (unsigned long)entry->group, (unsigned long)entry->offset,
+            (unsigned long)entry->length);
+
+    gz->stream.next_in = record;
+    gz->stream.avail_in = GZ_RECORD_SIZE;
+    if ((err = gz_deflate(gz, Z_NO_FLUSH)) != MYTAR_OK) {
+      return err;
+    }
+  }
+
+  gz->in_group = true;
+  if ((err = gz_close_group(gz)) != MYTAR_OK) {
+    return err;
+  }
+
+  return gz_write_footer(gz, index_offset);
+}
+
+void gz_writer_free(GzWriter *gz) {
+  deflateEnd(&gz->stream);
+  free(gz->index.records);
+  gz->index.records = NULL;
+}
+
+/* Parses the index records inflated into data */
+static int gz_parse_index(GzIndex *index, const unsigned char *data,
+                          size_t len) {
+  char field[17];
+  off_t values[3];
+  size_t at;
+  int i;
+  int err;
+
+  if (len % GZ_RECORD_SIZE != 0) {
+    return MYTAR_ERR_FORMAT;
+  }
+
+  for (at = 0; at < len; at += GZ_RECORD_SIZE) {
+    for (i = 0; i < 3; i++) {
+      memcpy(field, data + at + USTAR_BLOCK + 16 * i, 16);
+      field[16] = '\0';
+      values[i] = strtoul(field, NULL, 16);
+    }
+
+    if ((err = gz_index_add(index, (const TarHeader *)(data + at), values[0],
+                            values[1])) != MYTAR_OK) {
+      return err;
+    }
+    index->records[index->count - 1].length = values[2];
+  }
+
+  return MYTAR_OK;
+}
+
+/* Loads the index of a regular file written by z. Returns false, with the
+ * index left empty, if it has none. */
+static bool gz_read_index(int fd, GzIndex *index) {
+  unsigned char footer[GZ_FOOTER_SIZE];
+  unsigned char *compressed;
+  unsigned char *data = NULL;
+  unsigned char *grown;
+  char hex[17];
+  struct stat archive_stat;
+  z_stream stream;
+  off_t index_offset;
+  size_t size;
+  size_t capacity = 0;
+  size_t len = 0;
+  int status = Z_OK;
+
+  memset(index, 0, sizeof(GzIndex));
+
+  if (fstat(fd, &archive_stat) == -1 || !S_ISREG(archive_stat.st_mode) ||
+      archive_stat.st_size < GZ_FOOTER_SIZE ||
+      pread(fd, footer, sizeof(footer),
+            archive_stat.st_size - GZ_FOOTER_SIZE) != sizeof(footer) ||
+      footer[0] != 0x1f || footer[1] != 0x8b || footer[10] != 1 ||
+      footer[11] != GZ_PAYLOAD_SIZE ||
+      memcmp(footer + 15, GZ_MAGIC, strlen(GZ_MAGIC)) != 0) {
+    return false;
+  }
+
+  memcpy(hex, footer + 15 + strlen(GZ_MAGIC), 16);
+  hex[16] = '\0';
+  index_offset = strtoul(hex, NULL, 16);
+  size = archive_stat.st_size - GZ_FOOTER_SIZE - index_offset;
+  if (index_offset >= archive_stat.st_size - GZ_FOOTER_SIZE) {
+    return false;
+  }
+
+  if ((compressed = malloc(size)) == NULL) {
+    return false;
+  }
+  if (pread(fd, compressed, size, index_offset) != (ssize_t)size) {
+    free(compressed);
+    return false;
+  }
+
+  memset(&stream, 0, sizeof(stream));
+  if (inflateInit2(&stream, 15 + 16) != Z_OK) {
+    free(compressed);
+    return false;
+  }
+  stream.next_in = compressed;
+  stream.avail_in = size;
+
+  while (status == Z_OK) {
+    if (len == capacity) {
+      capacity = capacity ? capacity * 2 : IO_CHUNK;
+      if ((grown = realloc(data, capacity)) == NULL) {
+        break;
+      }
+      data = grown;
+    }
+
+    stream.next_out = data + len;
+    stream.avail_out = capacity - len;
+    status = inflate(&stream, Z_NO_FLUSH);
+    len = capacity - stream.avail_out;
+  }
+  inflateEnd(&stream);
+  free(compressed);
+
+  if (status != Z_STREAM_END || gz_parse_index(index, data, len) != MYTAR_OK) {
+    free(data);
+    free(index->records);
+    memset(index, 0, sizeof(GzIndex));
+    return false;
+  }
+
+  free(data);
+  return true;
+}
+
+/* Inflates the whole archive, however many gzip members it has, into the
+ * pipe */
+static int gz_inflate_all(GzReader *gz) {
+  unsigned char in[IO_CHUNK];
+  unsigned char out[IO_CHUNK];
+  z_stream stream;
+  ssize_t bytes_read;
+  int status = Z_OK;
+  int err = MYTAR_OK;
+
+  memset(&stream, 0, sizeof(stream));
+  if (inflateInit2(&stream, 15 + 32) != Z_OK) {
+    return MYTAR_ERR_NOMEM;
+  }
+
+  while (err == MYTAR_OK) {
+    if (stream.avail_in == 0) {
+      if ((bytes_read = io_read_full(gz->fd, in, sizeof(in), NULL)) <= 0) {
+        /* running out of input is only fine between gzip members */
+        err = bytes_read == 0 && status == Z_STREAM_END ? MYTAR_OK
+                                                        : MYTAR_ERR_FORMAT;
+        break;
+      }
+      stream.next_in = in;
+      stream.avail_in = bytes_read;
+    }
+
+    if (status == Z_STREAM_END) {
+      inflateReset(&stream);
+    }
+
+    stream.next_out = out;
+    stream.avail_out = sizeof(out);
+    status = inflate(&stream, Z_NO_FLUSH);
+
+    if (status != Z_OK && status != Z_STREAM_END && status != Z_BUF_ERROR) {
+      err = MYTAR_ERR_FORMAT;
+    } else if (io_write_full(gz->pipe[1], out, sizeof(out) - stream.avail_out,
+                             NULL) != MYTAR_OK) {
+      /* the Reader stopped early, it has already reported why */
+      break;
+    }
+  }
+
+  inflateEnd(&stream);
+  return err;
+}
+
+/* Inflates len bytes of the member that starts at group, from offset within
+ * it, into the pipe. The stream is reused when it is already inside that
+ * member and short of offset. */
+static int gz_inflate_range(GzReader *gz, z_stream *stream, off_t *group,
+                            off_t *position, off_t *in_offset,
+                            const GzRecord *record, unsigned char *in) {
+  unsigned char out[IO_CHUNK];
+  off_t want;
+  off_t skip;
+  ssize_t bytes_read;
+  size_t have;
+  int status;
+
+  if (*group != record->group || *position > record->offset) {
+    inflateReset(stream);
+    stream->avail_in = 0;
+    *group = record->group;
+    *in_offset = record->group;
+    *position = 0;
+  }
+
+  skip = record->offset - *position;
+  want = skip + record->length;
+
+  while (want > 0) {
+    if (stream->avail_in == 0) {
+      bytes_read = pread(gz->fd, in, IO_CHUNK, *in_offset);
+      if (bytes_read <= 0) {
+        return MYTAR_ERR_FORMAT;
+      }
+      *in_offset += bytes_read;
+      stream->next_in = in;
+      stream->avail_in = bytes_read;
+    }
+
+    stream->next_out = out;
+    stream->avail_out = want < IO_CHUNK ? want : IO_CHUNK;
+    status = inflate(stream, Z_NO_FLUSH);
+    have = (want < IO_CHUNK ? want : IO_CHUNK) - stream->avail_out;
+
+    if (status != Z_OK && !(status == Z_STREAM_END && have == want) &&
+        !(status == Z_BUF_ERROR && have > 0)) {
+      return MYTAR_ERR_FORMAT;
+    }
+
+    *position += have;
+    want -= have;
+
+    if (skip >= (off_t)have) {
+      skip -= have;
+    } else {
+      if (io_write_full(gz->pipe[1], out + skip, have - skip, NULL) !=
+          MYTAR_OK) {
+        return MYTAR_ERR_ABORTED;
+      }
+      skip = 0;
+    }
+  }
+
+  return MYTAR_OK;
+}
+
+/* Inflates only the members selected by the operands and filters, followed
+ * by the end-of-archive blocks, into the pipe */
+static int gz_inflate_selected(GzReader *gz) {
+  static const unsigned char end[2 * USTAR_BLOCK];
+  unsigned char in[IO_CHUNK];
+  char path[PATH_MAX];
+  z_stream stream;
+  GzRecord *record;
+  off_t group = -1;
+  off_t position = 0;
+  off_t in_offset = 0;
+  long i;
+  int err = MYTAR_OK;
+
+  memset(&stream, 0, sizeof(stream));
+  if (inflateInit2(&stream, 15 + 16) != Z_OK) {
+    return MYTAR_ERR_NOMEM;
+  }
+
+  for (i = 0; i < gz->index.count && err == MYTAR_OK; i++) {
+    record = &gz->index.records[i];
+    memset(path, 0, sizeof(path));
+    extract_name(&record->header, path);
+
+    if (path_matches(gz->flags, path)) {
+      err = gz_inflate_range(gz, &stream, &group, &position, &in_offset,
+                             record, in);
+    }
+  }
+
+  if (err == MYTAR_OK &&
+      io_write_full(gz->pipe[1], end, sizeof(end), NULL) != MYTAR_OK) {
+    err = MYTAR_ERR_ABORTED;
+  }
+
+  inflateEnd(&stream);
+
+  /* the Reader stopped early, it has already reported why */
+  return err == MYTAR_ERR_ABORTED ? MYTAR_OK : err;
+}
+
+static void *gz_run(void *arg) {
+  GzReader *gz = arg;
+  sigset_t pipe_signal;
+
+  /* a Reader that stops early makes writes fail with EPIPE instead */
+  sigemptyset(&pipe_signal);
+  sigaddset(&pipe_signal, SIGPIPE);
+  pthread_sigmask(SIG_BLOCK, &pipe_signal, NULL);
+
+  gz->err = gz->has_index ? gz_inflate_selected(gz) : gz_inflate_all(gz);
+
+  close(gz->pipe[1]);
+  return NULL;
+}
+
+/* Starts inflating the archive open on fd. Returns the fd the Reader should
+ * read the tar stream from, or -1. */
+int gz_reader_start(GzReader *gz, Flags *flags, int fd) {
+  memset(gz, 0, sizeof(GzReader));
+  gz->flags = flags;
+  gz->fd = fd;
+
+  /* without any selection the archive is read in full anyway */
+  gz->has_index = (flags->n_paths > 0 || flags->matcher != NULL) &&
+                  gz_read_index(fd, &gz->index);
+
+  if (pipe(gz->pipe) == -1) {
+    perror("Failed to create pipe");
+    free(gz->index.records);
+    return -1;
+  }
+
+  if (pthread_create(&gz->thread, NULL, gz_run, gz) != 0) {
+    fprintf(stderr, "Failed to start decompression thread\n");
+    close(gz->pipe[0]);
+    close(gz->pipe[1]);
+    free(gz->index.records);
+    return -1;
+  }
+
+  return gz->pipe[0];
+}
+
+/* Stops the inflating thread once the Reader is done with the pipe. Returns
+ * any error it ran into. */
+int gz_reader_finish(GzReader *gz) {
+  close(gz->pipe[0]);
+  pthread_join(gz->thread, NULL);
+  free(gz->index.records);
+
+  if (gz->err == MYTAR_ERR_FORMAT) {
+    fprintf(stderr, "Invalid or truncated gzip data\n");
+  }
+  return gz->err;
+}
+
+/* Lists a z archive from its index, without inflating any member. Archives
+ * without an index are listed by inflating them. */
+int gz_list(Flags *flags) {
+  GzIndex index;
+  char path[PATH_MAX];
+  long i;
+  int fd;
+  int err = MYTAR_OK;
+
+  if (strcmp(flags->tarfile, "-") == 0) {
+    return read_archive(flags, print_entry);
+  }
+
+  stats_syscall(flags->stats, SYS_OPEN);
+  if ((fd = open(flags->tarfile, O_RDONLY)) == -1) {
+    perror("Could not open archive");
+    return MYTAR_ERR_IO;
+  }
+
+  if (!gz_read_index(fd, &index)) {
+    stats_syscall(flags->stats, SYS_CLOSE);
+    close(fd);
+    return read_archive(flags, print_entry);
+  }
+
+  for (i = 0; i < index.count && err == MYTAR_OK; i++) {
+    memset(path, 0, sizeof(path));
+    extract_name(&index.records[i].header, path);
+    stats_entry(flags->stats, &index.records[i].header);
+
+    if (!path_matches(flags, path)) {
+      continue;
+    }
+
+    err = list_member(flags, &index.records[i].header, path, strlen(path));
+  }
+
+  free(index.records);
+  stats_syscall(flags->stats, SYS_CLOSE);
+  close(fd);
+  return err;
+}
@@ -0,0 +1,74 @@
+#ifndef GZ
+#define GZ
+
+#include "header.h"
+#include "io.h"
+#include "mytar.h"
+#include "stats.h"
+#include "writer.h"
+#include <pthread.h>
+#include <stdbool.h>
+#include <sys/types.h>
+#include <zlib.h>
+
+/* a gzip member is closed at the first member boundary past this many
+ * uncompressed bytes */
+#define GZ_GROUP_SIZE 262144
+
+/* the index entry of one archive member */
+typedef struct {
+  TarHeader header;
+
+  /* compressed offset of the gzip member holding it */
+  off_t group;
+
+  /* uncompressed offset of its first header within that gzip member, and
+   * its uncompressed length, extended headers and padding included */
+  off_t offset;
+  off_t length;
+} GzRecord;
+
+typedef struct {
+  GzRecord *records;
+  long count;
+  long capacity;
+} GzIndex;
+
+typedef struct {
+  int fd;
+  z_stream stream;
+  bool in_group;
+  Stats *stats;
+
+  /* compressed offset and uncompressed start of the open gzip member */
+  off_t group;
+  off_t group_start;
+
+  off_t compressed;
+  off_t uncompressed;
+
+  /* uncompressed start of the last member in the index */
+  off_t member_start;
+  GzIndex index;
+
+  unsigned char out[IO_CHUNK];
+} GzWriter;
+
+typedef struct {
+  Flags *flags;
+  int fd;
+  int pipe[2];
+  GzIndex index;
+  bool has_index;
+  int err;
+  pthread_t thread;
+} GzReader;
+
+int gz_writer_init(GzWriter *gz, Writer *writer, int fd);
+int gz_writer_finish(GzWriter *gz);
+void gz_writer_free(GzWriter *gz);
+int gz_reader_start(GzReader *gz, Flags *flags, int fd);
+int gz_reader_finish(GzReader *gz);
+int gz_list(Flags *flags);
+
+#endif
@@ -4,28 +4,50 @@
  * and the extraction of specific struct attributes.
  * */
 #include "header.h"
+#include "libmytar.h"
 #include <arpa/inet.h>
 #include <dirent.h>
 #include <grp.h>
 #include <linux/limits.h>
+#include <pthread.h>
 #include <pwd.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <time.h>
 #include <unistd.h>
 
 extern int lstat(const char *file, struct stat *buf);
 extern ssize_t readlink(const char *pathname, char *buf, size_t bufsiz);
 extern int snprintf(char *str, size_t size, const char *format, ...);
+extern int getpwuid_r(uid_t uid, struct passwd *pwd, char *buf, size_t buflen,
+                      struct passwd **result);
+extern int getgrgid_r(gid_t gid, struct group *grp, char *buf, size_t buflen,
+                      struct group **result);
 
-/* allocates a new header and initializes all values to 0 */
+/* scratch space for the reentrant passwd and group lookups */
+#define LOOKUP_BUF_SIZE 4096
+
+/* owner and group names are cached by id, so a tree owned by a handful of
+ * users costs a handful of lookups. Entries older than NAME_CACHE_TTL seconds
+ * are looked up again, which keeps a long-running daemon current. */
+#define NAME_CACHE_TTL 60
+
+static NameCache names;
+static pthread_mutex_t names_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* allocates a new header and initializes all values to 0. Returns NULL if the
+ * allocation fails. */
 TarHeader *init_header() {
 
   TarHeader *header = malloc(sizeof(TarHeader));
 
-  memset(header, 0, sizeof(TarHeader));
+  if (header != NULL) {
+    memset(header, 0, sizeof(TarHeader));
+  }
 
   return header;
 }
@@ -100,24 +122,34 @@ char *extract_name(TarHeader *header, char *full_name) {
 }
 
 /* Properly inserts a path into a tarheader by properly inserting into prefix
- * and name in accordance with the ustar standard
+ * and name in accordance with the ustar standard. Returns MYTAR_ERR_NAME if the
+ * path cannot be split to fit.
  */
-void populate_name(const char *path, struct stat *path_stat,
-                   TarHeader *header) {
+int populate_name(const char *path, struct stat *path_stat,
+                  TarHeader *header) {
 
   int i;
+  int len = strlen(path);
 
-  if (strlen(path) > sizeof(header->name)) {
-    for (i = strlen(path) - sizeof(header->name) - 1; i >= 0; i++) {
+  if (len > sizeof(header->name)) {
+    for (i = len - sizeof(header->name) - 1; i < len; i++) {
       if (path[i] == '/') {
         break;
       }
     }
-    memcpy(header->name, path + i + 1, strlen(path) - i - 1);
+
+    if (i >= len - 1 || i > sizeof(header->prefix)) {
+      fprintf(stderr, "Path too long for a ustar header:\n%s\n", path);
+      return MYTAR_ERR_NAME;
+    }
+
+    memcpy(header->name, path + i + 1, len - i - 1);
     memcpy(header->prefix, path, i);
   } else {
-    memcpy(header->name, path, strlen(path));
+    memcpy(header->name, path, len);
   }
+
+  return MYTAR_OK;
 }
 
 /* Calculates and inserts the checksum into the tarheader */
@@ -138,8 +170,8 @@ void populate_chksum(TarHeader *header) {
 
 /* This function populates the typeflag of the header, and the linkname if its a
  * link */
-void populate_type_linkname(const char *path, struct stat *path_stat,
-                            TarHeader *header) {
+int populate_type_linkname(const char *path, struct stat *path_stat,
+                           TarHeader *header) {
 
   char buffer[PATH_MAX];
   int len;
@@ -151,15 +183,16 @@ void populate_type_linkname(const char *path, struct stat *path_stat,
 
     if (len == -1) {
       perror("Failed to read link: ");
-      exit(EXIT_FAILURE);
+      return MYTAR_ERR_IO;
     }
 
-    if (len > 100) {
+    if (len > sizeof(header->linkname)) {
       fprintf(stderr, "linkname greater than 100:\n%s\n", path);
-      exit(EXIT_FAILURE);
+      return MYTAR_ERR_NAME;
     }
 
-    strcpy((char *)header->linkname, buffer);
+    /* readlink does not terminate the buffer */
+    memcpy(header->linkname, buffer, len);
 
   } else if (S_ISDIR(path_stat->st_mode)) {
 
@@ -168,27 +201,102 @@ void populate_type_linkname(const char *path, struct stat *path_stat,
   } else {
     header->typeflag = '0';
   }
+
+  return MYTAR_OK;
+}
+
+/* Copies the cached name of id into name, a 32 byte header field. Returns
+ * false if it has to be looked up. */
+static bool cached_name(CachedName *names, unsigned long id,
+                        unsigned char *name, time_t now) {
+  CachedName *slot = &names[id % NAME_CACHE_SLOTS];
+  bool hit;
+
+  pthread_mutex_lock(&names_lock);
+  hit = slot->valid && slot->id == id && now - slot->looked_up < NAME_CACHE_TTL;
+  if (hit) {
+    memcpy(name, slot->name, sizeof(slot->name));
+  }
+  pthread_mutex_unlock(&names_lock);
+
+  return hit;
 }
 
-void populate_uname_gname(struct stat *path_stat, TarHeader *header) {
-  struct passwd *owner_info = getpwuid(path_stat->st_uid);
-  struct group *group_info = getgrgid(path_stat->st_gid);
+static void cache_name(CachedName *names, unsigned long id,
+                       const unsigned char *name, time_t now) {
+  CachedName *slot = &names[id % NAME_CACHE_SLOTS];
 
-  if (owner_info == NULL) {
-    fprintf(stderr, "Failed to get file owner info");
-    exit(EXIT_FAILURE);
+  pthread_mutex_lock(&names_lock);
+  slot->valid = true;
+  slot->id = id;
+  slot->looked_up = now;
+  memcpy(slot->name, name, sizeof(slot->name));
+  pthread_mutex_unlock(&names_lock);
+}
+
+/* Copies every cached name into copy */
+void names_snapshot(NameCache *copy) {
+  pthread_mutex_lock(&names_lock);
+  memcpy(copy, &names, sizeof(names));
+  pthread_mutex_unlock(&names_lock);
+}
+
+/* Takes the names in copy, such as those a daemon's job looked up, that are
+ * newer than the ones cached here */
+void names_merge(const NameCache *copy) {
+  int i;
+
+  pthread_mutex_lock(&names_lock);
+  for (i = 0; i < NAME_CACHE_SLOTS; i++) {
+    if (copy->users[i].valid &&
+        (!names.users[i].valid ||
+         copy->users[i].looked_up > names.users[i].looked_up)) {
+      names.users[i] = copy->users[i];
+    }
+    if (copy->groups[i].valid &&
+        (!names.groups[i].valid ||
+         copy->groups[i].looked_up > names.groups[i].looked_up)) {
+      names.groups[i] = copy->groups[i];
+    }
   }
+  pthread_mutex_unlock(&names_lock);
+}
+
+/* Uses the reentrant lookups so headers can be populated from several threads
+ */
+int populate_uname_gname(struct stat *path_stat, TarHeader *header) {
+  struct passwd owner;
+  struct group group;
+  struct passwd *owner_info = NULL;
+  struct group *group_info = NULL;
+  char buf[LOOKUP_BUF_SIZE];
+  time_t now = time(NULL);
+
+  if (!cached_name(names.users, path_stat->st_uid, header->uname, now)) {
+    getpwuid_r(path_stat->st_uid, &owner, buf, sizeof(buf), &owner_info);
+    if (owner_info == NULL) {
+      fprintf(stderr, "Failed to get file owner info");
+      return MYTAR_ERR_LOOKUP;
+    }
 
-  if (group_info == NULL) {
-    fprintf(stderr, "Failed to get group info");
-    exit(EXIT_FAILURE);
+    strncpy((char *)header->uname, owner_info->pw_name,
+            sizeof(header->uname) - 1);
+    cache_name(names.users, path_stat->st_uid, header->uname, now);
   }
 
-  strncpy((char *)header->uname, owner_info->pw_name,
-          sizeof(header->uname) - 1);
+  if (!cached_name(names.groups, path_stat->st_gid, header->gname, now)) {
+    getgrgid_r(path_stat->st_gid, &group, buf, sizeof(buf), &group_info);
+    if (group_info == NULL) {
+      fprintf(stderr, "Failed to get group info");
+      return MYTAR_ERR_LOOKUP;
+    }
+
+    strncpy((char *)header->gname, group_info->gr_name,
+            sizeof(header->gname) - 1);
+    cache_name(names.groups, path_stat->st_gid, header->gname, now);
+  }
 
-  strncpy((char *)header->gname, group_info->gr_name,
-          sizeof(header->gname) - 1);
+  return MYTAR_OK;
 }
 
 int insert_special_int(char *where, size_t size, int32_t val) {
@@ -249,17 +357,20 @@ void populate_size(struct stat *path_stat, TarHeader *header) {
 }
 
 /* Populates a tar header given a path to a file */
-void populate_header_from_file(const char *path, TarHeader *header) {
+int populate_header_from_file(const char *path, TarHeader *header) {
 
   struct stat path_stat;
+  int err;
 
   if (lstat(path, &path_stat) == -1) {
-    printf("%s\n", path);
+    fprintf(stderr, "%s\n", path);
     perror("Error stating when populating header.");
-    exit(EXIT_FAILURE);
+    return MYTAR_ERR_IO;
   }
 
-  populate_name(path, &path_stat, header);
+  if ((err = populate_name(path, &path_stat, header)) != MYTAR_OK) {
+    return err;
+  }
 
   /* populate mode */
   sprintf((char *)header->mode, "%07o", path_stat.st_mode & 07777);
@@ -274,7 +385,9 @@ void populate_header_from_file(const char *path, TarHeader *header) {
   sprintf((char *)header->mtime, "%011lo", path_stat.st_mtime);
 
   /* populate typeflag and linkname if need be */
-  populate_type_linkname(path, &path_stat, header);
+  if ((err = populate_type_linkname(path, &path_stat, header)) != MYTAR_OK) {
+    return err;
+  }
 
   /* populate magic */
   strcpy((char *)header->magic, "ustar");
@@ -283,10 +396,54 @@ void populate_header_from_file(const char *path, TarHeader *header) {
   strcpy((char *)header->version, "00");
 
   /* populate uname, gname */
-  populate_uname_gname(&path_stat, header);
+  if ((err = populate_uname_gname(&path_stat, header)) != MYTAR_OK) {
+    return err;
+  }
 
   /* devmajor devminor remain NULL */
 
   /* populate checksum */
   populate_chksum(header);
+
+  return MYTAR_OK;
+}
+
+/* Populates a tar header for a regular file whose contents come from memory
+ * rather than the filesystem. */
+int populate_header_from_memory(const char *name, size_t size,
+                                unsigned int mode, long mtime,
+                                TarHeader *header) {
+  int err;
+
+  if ((err = populate_name(name, NULL, header)) != MYTAR_OK) {
+    return err;
+  }
+
+  sprintf((char *)header->mode, "%07o", mode & 07777);
+  sprintf((char *)header->uid, "%07o", 0);
+  sprintf((char *)header->gid, "%07o", 0);
+  sprintf((char *)header->size, "%011lo", (unsigned long)size);
+  sprintf((char *)header->mtime, "%011lo", mtime);
+  header->typeflag = '0';
+  strcpy((char *)header->magic, "ustar");
+  strcpy((char *)header->version, "00");
+
+  populate_chksum(header);
+
+  return MYTAR_OK;
+}
+
+/* Reads a uid or gid field, which is either octal or a GNU special int */
+long extract_id(const unsigned char *field, size_t size) {
+  long id = 0;
+  int i;
+
+  if (field[0] & 0x80) {
+    for (i = size - sizeof(int32_t); i < size; i++) {
+      id = (id << 8) | field[i];
+    }
+    return id;
+  }
+
+  return strtol((const char *)field, NULL, 8);
 }
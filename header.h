@@ -1,6 +1,9 @@
 #ifndef HEADER
 #define HEADER
+#include <stdbool.h>
+#include <stddef.h>
 #include <sys/stat.h>
+#include <time.h>
 
 typedef struct __attribute__((__packed__)) {
   unsigned char name[100];
@@ -22,13 +25,36 @@ typedef struct __attribute__((__packed__)) {
   unsigned char unused[12];
 } TarHeader;
 
+/* owner and group names looked up by id, kept by populate_uname_gname */
+#define NAME_CACHE_SLOTS 64
+
+typedef struct {
+  bool valid;
+  unsigned long id;
+  time_t looked_up;
+  unsigned char name[32];
+} CachedName;
+
+typedef struct {
+  CachedName users[NAME_CACHE_SLOTS];
+  CachedName groups[NAME_CACHE_SLOTS];
+} NameCache;
+
 TarHeader *init_header();
 
 char *extract_name(TarHeader *header, char *full_name);
-void populate_header_from_file(const char *path, TarHeader *header);
-void populate_name(const char *path, struct stat *path_stat, TarHeader *header);
+int populate_header_from_file(const char *path, TarHeader *header);
+int populate_name(const char *path, struct stat *path_stat, TarHeader *header);
+void populate_chksum(TarHeader *header);
+int populate_header_from_memory(const char *name, size_t size,
+                                unsigned int mode, long mtime,
+                                TarHeader *header);
+long extract_id(const unsigned char *field, size_t size);
 void populate_mode(struct stat *path_stat, TarHeader *header);
+void populate_uid_gid(struct stat *path_stat, TarHeader *header);
 void print_tar_header(const TarHeader *header);
+void names_snapshot(NameCache *copy);
+void names_merge(const NameCache *copy);
 void permissions_to_string(char *octal_str, char *str, TarHeader *header);
 
 #endif
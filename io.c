@@ -0,0 +1,342 @@
+/* io.c
+ * This file holds the low level copy, skip and full read/write loops shared by
+ * the reader and writer. They work on any kind of fd: regular files, pipes and
+ * sockets. Whole blocks at matching offsets of two regular files are shared
+ * with FICLONERANGE where the filesystem can reflink them. Otherwise data is
+ * moved with splice whenever one side is a pipe, with
+ * copy_file_range between two regular files, which may share the extents
+ * instead of copying them, and with sendfile out of other regular files, so it
+ * never passes through user space.
+ */
+#define _GNU_SOURCE
+
+#include "io.h"
+#include "digest.h"
+#include "libmytar.h"
+#include "throttle.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+bool io_is_pipe(int fd) {
+  struct stat fd_stat;
+
+  return fstat(fd, &fd_stat) == 0 && S_ISFIFO(fd_stat.st_mode);
+}
+
+/* Returns true if lseek can be used to move around fd */
+bool io_is_seekable(int fd) {
+  struct stat fd_stat;
+
+  if (fstat(fd, &fd_stat) != 0) {
+    return false;
+  }
+
+  return S_ISREG(fd_stat.st_mode) || S_ISBLK(fd_stat.st_mode);
+}
+
+/* Reads until len bytes are read or the end of input is reached. Returns the
+ * number of bytes read, which is only short at the end of input, or -1. */
+ssize_t io_read_full(int fd, void *buf, size_t len, Stats *stats) {
+  unsigned char *p = buf;
+  size_t total = 0;
+  ssize_t bytes_read;
+
+  while (total < len) {
+    stats_syscall(stats, SYS_READ);
+    bytes_read = read(fd, p + total, len - total);
+
+    if (bytes_read == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return -1;
+    }
+
+    if (bytes_read == 0) {
+      break;
+    }
+
+    total += bytes_read;
+  }
+
+  return total;
+}
+
+/* Writes all len bytes, retrying short writes on pipes and sockets */
+int io_write_full(int fd, const void *buf, size_t len, Stats *stats) {
+  const unsigned char *p = buf;
+  ssize_t written;
+
+  while (len > 0) {
+    stats_syscall(stats, SYS_WRITE);
+    written = write(fd, p, len);
+
+    if (written == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return MYTAR_ERR_IO;
+    }
+
+    p += written;
+    len -= written;
+  }
+
+  return MYTAR_OK;
+}
+
+/* Moves up to len bytes between two fds with splice. Returns the number of
+ * bytes moved, or -1 with errno set. EINVAL means neither fd is a pipe. */
+static off_t io_splice(int src_fd, int dst_fd, off_t len, Stats *stats) {
+  off_t total = 0;
+  ssize_t moved;
+
+  while (total < len) {
+    stats_syscall(stats, SYS_READ);
+    moved = splice(src_fd, NULL, dst_fd, NULL, len - total,
+                   SPLICE_F_MOVE | SPLICE_F_MORE);
+
+    if (moved == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return total == 0 ? -1 : total;
+    }
+
+    if (moved == 0) {
+      break;
+    }
+
+    total += moved;
+  }
+
+  return total;
+}
+
+/* Moves up to len bytes out of a regular file with sendfile. Returns the
+ * number of bytes moved, or -1 with errno set. */
+static off_t io_sendfile(int src_fd, int dst_fd, off_t len, Stats *stats) {
+  off_t total = 0;
+  ssize_t moved;
+
+  while (total < len) {
+    stats_syscall(stats, SYS_READ);
+    moved = sendfile(dst_fd, src_fd, NULL, len - total);
+
+    if (moved == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return total == 0 ? -1 : total;
+    }
+
+    if (moved == 0) {
+      break;
+    }
+
+    total += moved;
+  }
+
+  return total;
+}
+
+/* Moves up to len bytes between two regular files with copy_file_range.
+ * Returns the number of bytes moved, or -1 with errno set. */
+static off_t io_copy_range(int src_fd, int dst_fd, off_t len, Stats *stats) {
+  off_t total = 0;
+  ssize_t moved;
+
+  while (total < len) {
+    stats_syscall(stats, SYS_READ);
+    moved = copy_file_range(src_fd, NULL, dst_fd, NULL, len - total, 0);
+
+    if (moved == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return total == 0 ? -1 : total;
+    }
+
+    if (moved == 0) {
+      break;
+    }
+
+    total += moved;
+  }
+
+  return total;
+}
+
+/* Shares the whole filesystem blocks among the next len bytes of two regular
+ * files, when both are at a block boundary. Returns the number of bytes
+ * cloned, which is 0 whenever the filesystem cannot reflink them. */
+static off_t io_clone(int src_fd, int dst_fd, off_t len, Stats *stats) {
+  struct file_clone_range range;
+  struct stat src_stat;
+  struct stat dst_stat;
+  off_t block;
+
+  if (len < IO_CLONE_MIN) {
+    return 0;
+  }
+
+  if (fstat(src_fd, &src_stat) == -1 || fstat(dst_fd, &dst_stat) == -1 ||
+      !S_ISREG(src_stat.st_mode) || !S_ISREG(dst_stat.st_mode) ||
+      src_stat.st_dev != dst_stat.st_dev) {
+    return 0;
+  }
+
+  block = dst_stat.st_blksize > 0 ? dst_stat.st_blksize : 4096;
+  range.src_fd = src_fd;
+  range.src_offset = lseek(src_fd, 0, SEEK_CUR);
+  range.dest_offset = lseek(dst_fd, 0, SEEK_CUR);
+  range.src_length = len / block * block;
+
+  if (range.src_length == 0 || (off_t)range.src_offset % block != 0 ||
+      (off_t)range.dest_offset % block != 0) {
+    return 0;
+  }
+
+  stats_syscall(stats, SYS_READ);
+  if (ioctl(dst_fd, FICLONERANGE, &range) == -1) {
+    return 0;
+  }
+
+  lseek(src_fd, range.src_offset + range.src_length, SEEK_SET);
+  lseek(dst_fd, range.dest_offset + range.src_length, SEEK_SET);
+  return range.src_length;
+}
+
+/* Returns true if a fast path failed only because it does not support the
+ * fds it was given */
+static bool io_unsupported(int err) {
+  return err == EINVAL || err == ENOSYS || err == EXDEV || err == EBADF ||
+         err == EOPNOTSUPP;
+}
+
+/* Copies len bytes through a user space buffer, continuing the CRC32C in crc
+ * over them unless crc is NULL. A dst_fd of -1 only hashes the bytes. */
+static off_t io_bounce(int src_fd, int dst_fd, off_t len, uint32_t *crc,
+                       Stats *stats) {
+  unsigned char buf[IO_CHUNK];
+  off_t total = 0;
+  ssize_t bytes_read;
+  size_t want;
+
+  while (total < len) {
+    want = len - total < sizeof(buf) ? len - total : sizeof(buf);
+
+    if ((bytes_read = io_read_full(src_fd, buf, want, stats)) == -1) {
+      return -1;
+    }
+
+    if (bytes_read == 0) {
+      break;
+    }
+
+    if (crc != NULL) {
+      *crc = crc32c(*crc, buf, bytes_read);
+    }
+
+    if (dst_fd != -1 &&
+        io_write_full(dst_fd, buf, bytes_read, stats) != MYTAR_OK) {
+      return -1;
+    }
+
+    total += bytes_read;
+  }
+
+  return total;
+}
+
+/* Copies len bytes with the fastest path the pair of fds allows */
+static off_t io_copy_once(int src_fd, int dst_fd, off_t len, Stats *stats) {
+  off_t copied = 0;
+  off_t cloned;
+
+  if ((cloned = io_clone(src_fd, dst_fd, len, stats)) == len) {
+    return len;
+  }
+  len -= cloned;
+
+  if (io_is_pipe(src_fd) || io_is_pipe(dst_fd)) {
+    copied = io_splice(src_fd, dst_fd, len, stats);
+  } else if (io_is_seekable(src_fd)) {
+    if (io_is_seekable(dst_fd)) {
+      copied = io_copy_range(src_fd, dst_fd, len, stats);
+    }
+    if (copied == -1 && io_unsupported(errno)) {
+      copied = 0;
+    }
+    if (copied == 0) {
+      copied = io_sendfile(src_fd, dst_fd, len, stats);
+    }
+  }
+
+  if (copied == -1) {
+    /* the fast path does not support this pair of fds */
+    if (!io_unsupported(errno)) {
+      return -1;
+    }
+    copied = 0;
+  }
+
+  if (copied == len) {
+    return cloned + copied;
+  }
+
+  len = io_bounce(src_fd, dst_fd, len - copied, NULL, stats);
+  return len == -1 ? -1 : cloned + copied + len;
+}
+
+/* Copies len bytes in steps of THROTTLE_CHUNK, taking --bwlimit tokens
+ * before each, so even the kernel copies are paced. With a crc the bytes pass
+ * through user space to be hashed. */
+static off_t io_paced(int src_fd, int dst_fd, off_t len, uint32_t *crc,
+                      Stats *stats) {
+  off_t total = 0;
+  off_t chunk;
+  off_t copied;
+
+  while (total < len) {
+    chunk = len - total < THROTTLE_CHUNK ? len - total : THROTTLE_CHUNK;
+    throttle_take(chunk, stats);
+
+    copied = crc != NULL ? io_bounce(src_fd, dst_fd, chunk, crc, stats)
+                         : io_copy_once(src_fd, dst_fd, chunk, stats);
+    if (copied == -1) {
+      return -1;
+    }
+
+    total += copied;
+    if (copied < chunk) {
+      break;
+    }
+  }
+
+  return total;
+}
+
+/* Copies len bytes from src_fd to dst_fd. Returns the number of bytes copied,
+ * which is only short if src_fd ends early, or -1. Pipes use splice, regular
+ * files use copy_file_range or sendfile, and anything else goes through a
+ * buffer. */
+off_t io_copy(int src_fd, int dst_fd, off_t len, Stats *stats) {
+  return throttle_active() ? io_paced(src_fd, dst_fd, len, NULL, stats)
+                           : io_copy_once(src_fd, dst_fd, len, stats);
+}
+
+/* Copies len bytes like io_copy, continuing the CRC32C in crc over them on the
+ * way. The data has to pass through user space to be hashed, so this never
+ * splices. A dst_fd of -1 only hashes. */
+off_t io_copy_crc32c(int src_fd, int dst_fd, off_t len, uint32_t *crc,
+                     Stats *stats) {
+  return throttle_active() ? io_paced(src_fd, dst_fd, len, crc, stats)
+                           : io_bounce(src_fd, dst_fd, len, crc, stats);
+}
@@ -0,0 +1,23 @@
+#ifndef IO
+#define IO
+
+#include "stats.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/* size of the bounce buffer used when data cannot be spliced */
+#define IO_CHUNK 65536
+
+/* copies shorter than this never try to share blocks */
+#define IO_CLONE_MIN 4096
+
+bool io_is_pipe(int fd);
+bool io_is_seekable(int fd);
+ssize_t io_read_full(int fd, void *buf, size_t len, Stats *stats);
+int io_write_full(int fd, const void *buf, size_t len, Stats *stats);
+off_t io_copy(int src_fd, int dst_fd, off_t len, Stats *stats);
+off_t io_copy_crc32c(int src_fd, int dst_fd, off_t len, uint32_t *crc,
+                     Stats *stats);
+
+#endif
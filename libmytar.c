@@ -0,0 +1,222 @@
+/* libmytar.c
+ * This file implements the embeddable streaming API declared in libmytar.h on
+ * top of the Writer and Reader structs. Nothing here exits the process;
+ * every failure is returned to the caller as an error code.
+ */
+
+#include "libmytar.h"
+#include "archive.h"
+#include "header.h"
+#include "mytar.h"
+#include "reader.h"
+#include "writer.h"
+#include <linux/limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct MytarWriter {
+  Writer writer;
+};
+
+struct MytarEntry {
+  Reader *reader;
+};
+
+const char *mytar_strerror(int err) {
+  switch (err) {
+  case MYTAR_OK:
+    return "Success";
+  case MYTAR_ERR_IO:
+    return "I/O error";
+  case MYTAR_ERR_NOMEM:
+    return "Out of memory";
+  case MYTAR_ERR_FORMAT:
+    return "Malformed archive";
+  case MYTAR_ERR_STRICT:
+    return "Entry is not strictly ustar compliant";
+  case MYTAR_ERR_NAME:
+    return "Name does not fit in a ustar header";
+  case MYTAR_ERR_LOOKUP:
+    return "Owner or group lookup failed";
+  case MYTAR_ERR_INVAL:
+    return "Invalid argument";
+  case MYTAR_ERR_ABORTED:
+    return "Aborted by callback";
+  case MYTAR_ERR_DIFFERS:
+    return "Archive differs from the filesystem";
+  case MYTAR_ERR_DIGEST:
+    return "Member contents do not match their digest";
+  default:
+    return "Unknown error";
+  }
+}
+
+static int mytar_writer_alloc(MytarWriter **writer) {
+  if (writer == NULL) {
+    return MYTAR_ERR_INVAL;
+  }
+
+  if ((*writer = malloc(sizeof(MytarWriter))) == NULL) {
+    return MYTAR_ERR_NOMEM;
+  }
+
+  writer_init(&(*writer)->writer);
+  return MYTAR_OK;
+}
+
+/* Opens an archive writer on fd. The fd is not closed by mytar_writer_close.
+ */
+int mytar_writer_open_fd(MytarWriter **writer, int fd) {
+  int err;
+
+  if ((err = mytar_writer_alloc(writer)) != MYTAR_OK) {
+    return err;
+  }
+
+  writer_set_dst(&(*writer)->writer, fd);
+  return MYTAR_OK;
+}
+
+/* Opens an archive writer that hands every chunk of output to fn */
+int mytar_writer_open_cb(MytarWriter **writer, mytar_write_fn fn, void *ctx) {
+  int err;
+
+  if (fn == NULL) {
+    return MYTAR_ERR_INVAL;
+  }
+
+  if ((err = mytar_writer_alloc(writer)) != MYTAR_OK) {
+    return err;
+  }
+
+  (*writer)->writer.write_fn = fn;
+  (*writer)->writer.write_ctx = ctx;
+  return MYTAR_OK;
+}
+
+/* Adds a file, link or directory tree from the filesystem */
+int mytar_writer_add_path(MytarWriter *writer, const char *path) {
+  if (writer == NULL || path == NULL) {
+    return MYTAR_ERR_INVAL;
+  }
+
+  return traverse_path(path, &writer->writer, NULL);
+}
+
+/* Adds a regular file named name whose contents are the len bytes at data */
+int mytar_writer_add_buffer(MytarWriter *writer, const char *name,
+                            const void *data, size_t len, unsigned int mode,
+                            long mtime) {
+  TarHeader header;
+  int err;
+
+  if (writer == NULL || name == NULL || (data == NULL && len != 0)) {
+    return MYTAR_ERR_INVAL;
+  }
+
+  memset(&header, 0, sizeof(TarHeader));
+  if ((err = populate_header_from_memory(name, len, mode, mtime, &header)) !=
+      MYTAR_OK) {
+    return err;
+  }
+
+  writer->writer.header = &header;
+  err = writer_write_header(&writer->writer);
+  writer->writer.header = NULL;
+
+  if (err == MYTAR_OK) {
+    err = writer_write_buffer(&writer->writer, data, len);
+  }
+
+  return err;
+}
+
+/* Terminates the archive and frees the writer, even on failure */
+int mytar_writer_close(MytarWriter *writer) {
+  int err;
+
+  if (writer == NULL) {
+    return MYTAR_ERR_INVAL;
+  }
+
+  if ((err = writer_pad(&writer->writer)) == MYTAR_OK) {
+    err = writer_flush(&writer->writer);
+  }
+
+  free(writer);
+  return err;
+}
+
+static void fill_entry_info(TarHeader *header, char *name, char *linkname,
+                            MytarEntryInfo *info) {
+  memset(name, 0, PATH_MAX);
+  extract_name(header, name);
+
+  memcpy(linkname, header->linkname, sizeof(header->linkname));
+  linkname[sizeof(header->linkname)] = '\0';
+
+  info->name = name;
+  info->linkname = linkname;
+  info->type = header->typeflag == '\0' ? '0' : header->typeflag;
+  info->mode = strtol((char *)header->mode, NULL, OCTAL_SIZE);
+  info->size = strtol((char *)header->size, NULL, OCTAL_SIZE);
+  info->mtime = strtol((char *)header->mtime, NULL, OCTAL_SIZE);
+  info->uid = extract_id(header->uid, sizeof(header->uid));
+  info->gid = extract_id(header->gid, sizeof(header->gid));
+}
+
+/* Calls fn for every member of the archive read from fd. Returns MYTAR_OK at
+ * the end of the archive, an error code, or fn's non-zero return value. */
+int mytar_read_fd(int fd, int strict, mytar_entry_fn fn, void *ctx) {
+  Reader reader;
+  MytarEntry entry;
+  MytarEntryInfo info;
+  char name[PATH_MAX];
+  char linkname[sizeof(((TarHeader *)0)->linkname) + 1];
+  int status;
+  int err = MYTAR_OK;
+
+  if (fn == NULL) {
+    return MYTAR_ERR_INVAL;
+  }
+
+  reader_init(&reader, strict);
+  reader_set_src(&reader, fd);
+  entry.reader = &reader;
+
+  while ((status = reader_cycle_entry(&reader)) != 0) {
+    if (status == MYTAR_ERR_STRICT) {
+      if ((err = reader_skip_file_contents(&reader)) != MYTAR_OK) {
+        break;
+      }
+      continue;
+    }
+
+    if (status < 0) {
+      err = status;
+      break;
+    }
+
+    fill_entry_info(reader.current_entry->header, name, linkname, &info);
+
+    if ((err = fn(ctx, &info, &entry)) != 0) {
+      break;
+    }
+
+    if ((err = reader_skip_file_contents(&reader)) != MYTAR_OK) {
+      break;
+    }
+  }
+
+  reader_free(&reader);
+  return err;
+}
+
+/* Reads the current member's contents, see reader_read_contents */
+ssize_t mytar_entry_read(MytarEntry *entry, void *buf, size_t len) {
+  if (entry == NULL || buf == NULL) {
+    return MYTAR_ERR_INVAL;
+  }
+
+  return reader_read_contents(entry->reader, buf, len);
+}
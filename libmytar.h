@@ -0,0 +1,58 @@
+#ifndef LIBMYTAR
+#define LIBMYTAR
+
+#include <stddef.h>
+#include <sys/types.h>
+
+/* Every libmytar function reports failure through one of these codes instead
+ * of exiting the process. errno is preserved for MYTAR_ERR_IO. */
+#define MYTAR_OK 0
+#define MYTAR_ERR_IO -1
+#define MYTAR_ERR_NOMEM -2
+#define MYTAR_ERR_FORMAT -3
+#define MYTAR_ERR_STRICT -4
+#define MYTAR_ERR_NAME -5
+#define MYTAR_ERR_LOOKUP -6
+#define MYTAR_ERR_INVAL -7
+#define MYTAR_ERR_ABORTED -8
+#define MYTAR_ERR_DIFFERS -9
+#define MYTAR_ERR_DIGEST -10
+
+typedef struct MytarWriter MytarWriter;
+typedef struct MytarEntry MytarEntry;
+
+/* Called with each chunk of archive output. Must return the number of bytes
+ * consumed, or -1 on failure. */
+typedef ssize_t (*mytar_write_fn)(void *ctx, const void *buf, size_t len);
+
+typedef struct {
+  const char *name;
+  const char *linkname;
+  char type;
+  unsigned int mode;
+  long size;
+  long mtime;
+  long uid;
+  long gid;
+} MytarEntryInfo;
+
+/* Called once per archive member. The member's data may be consumed with
+ * mytar_entry_read before returning; anything left unread is skipped. A
+ * non-zero return stops the iteration and is returned by mytar_read_fd. */
+typedef int (*mytar_entry_fn)(void *ctx, const MytarEntryInfo *info,
+                              MytarEntry *entry);
+
+const char *mytar_strerror(int err);
+
+int mytar_writer_open_fd(MytarWriter **writer, int fd);
+int mytar_writer_open_cb(MytarWriter **writer, mytar_write_fn fn, void *ctx);
+int mytar_writer_add_path(MytarWriter *writer, const char *path);
+int mytar_writer_add_buffer(MytarWriter *writer, const char *name,
+                            const void *data, size_t len, unsigned int mode,
+                            long mtime);
+int mytar_writer_close(MytarWriter *writer);
+
+int mytar_read_fd(int fd, int strict, mytar_entry_fn fn, void *ctx);
+ssize_t mytar_entry_read(MytarEntry *entry, void *buf, size_t len);
+
+#endif
@@ -0,0 +1,278 @@
+/* listing.c
+ * This file formats the output of t. Lines are built by hand in a large
+ * buffer and written out in big writes, which matters once an archive holds
+ * millions of members: numbers are converted without printf, and localtime is
+ * only called when an mtime falls outside the local day cached from the last
+ * call. With --print0, names end in a NUL instead of a newline, and tv prints
+ * the raw fields of every member, each ending in a NUL, for other programs.
+ */
+#define _GNU_SOURCE
+
+#include "listing.h"
+#include "io.h"
+#include "libmytar.h"
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+/* longest verbose line apart from the name */
+#define LISTING_FIELDS 256
+
+void listing_init(Listing *listing, int fd, bool print0) {
+  listing->fd = fd;
+  listing->print0 = print0;
+  listing->used = 0;
+  listing->day_start = 0;
+  listing->day_end = 0;
+}
+
+int listing_flush(Listing *listing) {
+  int err = MYTAR_OK;
+
+  if (listing->used > 0 &&
+      io_write_full(listing->fd, listing->buf, listing->used, NULL) !=
+          MYTAR_OK) {
+    perror("Failed to write listing");
+    err = MYTAR_ERR_IO;
+  }
+
+  listing->used = 0;
+  return err;
+}
+
+/* Makes room for len more bytes, flushing if needed. Lines longer than the
+ * whole buffer are not possible, names being at most PATH_MAX. */
+static int listing_reserve(Listing *listing, size_t len) {
+  if (listing->used + len > sizeof(listing->buf)) {
+    return listing_flush(listing);
+  }
+  return MYTAR_OK;
+}
+
+static void listing_put(Listing *listing, const char *s, size_t len) {
+  memcpy(listing->buf + listing->used, s, len);
+  listing->used += len;
+}
+
+static void listing_pad(Listing *listing, size_t len, size_t width) {
+  while (len++ < width) {
+    listing->buf[listing->used++] = ' ';
+  }
+}
+
+/* Appends a NUL or newline terminated name */
+int listing_name(Listing *listing, const char *name, size_t len) {
+  int err;
+
+  if ((err = listing_reserve(listing, len + 1)) != MYTAR_OK) {
+    return err;
+  }
+
+  listing_put(listing, name, len);
+  listing->buf[listing->used++] = listing->print0 ? '\0' : '\n';
+  return MYTAR_OK;
+}
+
+/* Parses an octal header field the way strtol would, without needing it to
+ * be terminated */
+static long listing_octal(const unsigned char *field, size_t size) {
+  long value = 0;
+  size_t i = 0;
+
+  while (i < size && field[i] == ' ') {
+    i++;
+  }
+
+  for (; i < size && field[i] >= '0' && field[i] <= '7'; i++) {
+    value = value * 8 + (field[i] - '0');
+  }
+
+  return value;
+}
+
+/* Writes value in base ending just before end. Returns the number of
+ * characters written. */
+static size_t listing_digits(char *end, long value, int base) {
+  size_t len = 0;
+  unsigned long rest = value < 0 ? -(unsigned long)value : (unsigned long)value;
+
+  do {
+    *--end = '0' + rest % base;
+    rest /= base;
+    len++;
+  } while (rest > 0);
+
+  if (value < 0) {
+    *--end = '-';
+    len++;
+  }
+
+  return len;
+}
+
+static void listing_two_digits(char *out, int value) {
+  out[0] = '0' + value / 10;
+  out[1] = '0' + value % 10;
+}
+
+/* Appends mtime as "YYYY-MM-DD HH:MM". The date, and where its
+ * local day starts and ends, are cached, so localtime only runs on a new
+ * day. A day whose UTC offset changes, such as a DST change, is not cached. */
+static void listing_time(Listing *listing, time_t mtime) {
+  struct tm time_info;
+  struct tm midnight;
+  struct tm first;
+  struct tm last;
+  time_t start;
+  time_t end;
+  time_t offset;
+
+  if (mtime < listing->day_start || mtime >= listing->day_end) {
+    localtime_r(&mtime, &time_info);
+    listing->day_len =
+        sprintf(listing->day, "%04d-%02d-%02d ", time_info.tm_year + 1900,
+                time_info.tm_mon + 1, time_info.tm_mday);
+
+    /* the day runs from this local midnight to the next */
+    memset(&midnight, 0, sizeof(midnight));
+    midnight.tm_year = time_info.tm_year;
+    midnight.tm_mon = time_info.tm_mon;
+    midnight.tm_mday = time_info.tm_mday;
+    midnight.tm_isdst = -1;
+    start = mktime(&midnight);
+
+    memset(&midnight, 0, sizeof(midnight));
+    midnight.tm_year = time_info.tm_year;
+    midnight.tm_mon = time_info.tm_mon;
+    midnight.tm_mday = time_info.tm_mday + 1;
+    midnight.tm_isdst = -1;
+    end = mktime(&midnight);
+
+    /* a day whose UTC offset changes is formatted member by member */
+    listing->day_start = 0;
+    listing->day_end = 0;
+    if (start != -1 && end != -1 && end - start == 86400) {
+      localtime_r(&start, &first);
+      end--;
+      localtime_r(&end, &last);
+      if (first.tm_gmtoff == last.tm_gmtoff) {
+        listing->day_start = start;
+        listing->day_end = end + 1;
+      }
+    }
+
+    if (listing->day_end == 0) {
+      offset = time_info.tm_hour * 3600 + time_info.tm_min * 60;
+    } else {
+      offset = mtime - listing->day_start;
+    }
+  } else {
+    offset = mtime - listing->day_start;
+  }
+
+  listing_put(listing, listing->day, listing->day_len);
+  listing_two_digits(listing->buf + listing->used, offset / 3600 % 24);
+  listing->buf[listing->used + 2] = ':';
+  listing_two_digits(listing->buf + listing->used + 3, offset / 60 % 60);
+  listing->used += 5;
+}
+
+/* Appends a NUL terminated field */
+static void listing_field(Listing *listing, const char *s, size_t len) {
+  listing_put(listing, s, len);
+  listing->buf[listing->used++] = '\0';
+}
+
+static void listing_number(Listing *listing, long value, int base) {
+  char digits[24];
+  size_t len = listing_digits(digits + sizeof(digits), value, base);
+
+  listing_field(listing, digits + sizeof(digits) - len, len);
+}
+
+/* Appends type, octal mode, owner, group, size, mtime in seconds and name,
+ * each ending in a NUL */
+static int listing_raw(Listing *listing, const TarHeader *header,
+                       const char *name, size_t len) {
+  char type = header->typeflag ? header->typeflag : '0';
+  int err;
+
+  if ((err = listing_reserve(listing, LISTING_FIELDS + len)) != MYTAR_OK) {
+    return err;
+  }
+
+  listing_field(listing, &type, 1);
+  listing_number(listing, listing_octal(header->mode, sizeof(header->mode)),
+                 8);
+  listing_field(listing, (const char *)header->uname,
+                strnlen((const char *)header->uname, sizeof(header->uname)));
+  listing_field(listing, (const char *)header->gname,
+                strnlen((const char *)header->gname, sizeof(header->gname)));
+  listing_number(listing, listing_octal(header->size, sizeof(header->size)),
+                 10);
+  listing_number(listing,
+                 listing_octal(header->mtime, sizeof(header->mtime)), 10);
+  listing_field(listing, name, len);
+  return MYTAR_OK;
+}
+
+/* Appends a line like "-rw-r--r-- user/group     1234 2024-01-31 12:00 name" */
+int listing_verbose(Listing *listing, const TarHeader *header,
+                    const char *name, size_t len) {
+  static const char rwx[] = "rwxrwxrwx";
+  char digits[24];
+  size_t uname_len;
+  size_t gname_len;
+  size_t digits_len;
+  long mode;
+  int i;
+  int err;
+
+  if (listing->print0) {
+    return listing_raw(listing, header, name, len);
+  }
+
+  if ((err = listing_reserve(listing, LISTING_FIELDS + len)) != MYTAR_OK) {
+    return err;
+  }
+
+  switch (header->typeflag) {
+  case '5':
+    listing->buf[listing->used++] = 'd';
+    break;
+  case '2':
+    listing->buf[listing->used++] = 'l';
+    break;
+  default:
+    listing->buf[listing->used++] = '-';
+    break;
+  }
+
+  mode = listing_octal(header->mode, sizeof(header->mode));
+  for (i = 0; i < 9; i++) {
+    listing->buf[listing->used++] = mode & (0400 >> i) ? rwx[i] : '-';
+  }
+  listing->buf[listing->used++] = ' ';
+
+  uname_len = strnlen((const char *)header->uname, sizeof(header->uname));
+  gname_len = strnlen((const char *)header->gname, sizeof(header->gname));
+  listing_put(listing, (const char *)header->uname, uname_len);
+  listing->buf[listing->used++] = '/';
+  listing_put(listing, (const char *)header->gname, gname_len);
+  listing_pad(listing, uname_len + 1 + gname_len, 17);
+  listing->buf[listing->used++] = ' ';
+
+  digits_len = listing_digits(
+      digits + sizeof(digits),
+      listing_octal(header->size, sizeof(header->size)), 10);
+  listing_pad(listing, digits_len, 8);
+  listing_put(listing, digits + sizeof(digits) - digits_len, digits_len);
+  listing->buf[listing->used++] = ' ';
+
+  listing_time(listing, listing_octal(header->mtime, sizeof(header->mtime)));
+  listing->buf[listing->used++] = ' ';
+
+  listing_put(listing, name, len);
+  listing->buf[listing->used++] = '\n';
+  return MYTAR_OK;
+}
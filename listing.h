@@ -0,0 +1,33 @@
+#ifndef LISTING
+#define LISTING
+
+#include "header.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <time.h>
+
+/* bytes of listing output gathered before each write */
+#define LISTING_BUFFER 1048576
+
+typedef struct {
+  int fd;
+  bool print0;
+  size_t used;
+
+  /* the local time interval whose date is cached, and that date formatted
+   * as "YYYY-MM-DD " */
+  time_t day_start;
+  time_t day_end;
+  char day[48];
+  size_t day_len;
+
+  char buf[LISTING_BUFFER];
+} Listing;
+
+void listing_init(Listing *listing, int fd, bool print0);
+int listing_name(Listing *listing, const char *name, size_t len);
+int listing_verbose(Listing *listing, const TarHeader *header,
+                    const char *name, size_t len);
+int listing_flush(Listing *listing);
+
+#endif
@@ -0,0 +1,315 @@
+/* manifest.c
+ * This file adds the members listed in a --manifest to an archive being
+ * created. Every line names the path a member gets in the archive and where
+ * its contents come from, optionally followed by overrides of its attributes:
+ *
+ *   ARCHIVE_PATH<TAB>SOURCE[<TAB>KEY=VALUE...]
+ *
+ * SOURCE is a file, directory or symlink, archived as it is and never walked,
+ * or one of content:TEXT (a regular file holding TEXT, in which \n, \t and \\
+ * are unescaped), dir: (an empty directory) or symlink:TARGET. The keys are
+ * mode (octal), uid, gid, uname, gname and mtime (seconds since the epoch).
+ * Empty lines and lines starting with # are skipped. Lines are read one at a
+ * time and each member is streamed from its source before the next is read,
+ * so a manifest of millions of lines takes no more memory than one of a few.
+ */
+
+#include "manifest.h"
+#include "archive.h"
+#include "filelist.h"
+#include "header.h"
+#include "libmytar.h"
+#include "stats.h"
+#include <fcntl.h>
+#include <linux/limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+extern int snprintf(char *str, size_t size, const char *format, ...);
+
+/* Unescapes \n, \t and \\ in text in place and returns its new length */
+static size_t manifest_unescape(char *text) {
+  size_t in;
+  size_t out = 0;
+
+  for (in = 0; text[in] != '\0'; in++) {
+    if (text[in] == '\\' && text[in + 1] != '\0') {
+      switch (text[++in]) {
+      case 'n':
+        text[out++] = '\n';
+        break;
+      case 't':
+        text[out++] = '\t';
+        break;
+      case '\\':
+        text[out++] = '\\';
+        break;
+      default:
+        /* anything else is kept as written */
+        text[out++] = '\\';
+        text[out++] = text[in];
+        break;
+      }
+    } else {
+      text[out++] = text[in];
+    }
+  }
+
+  text[out] = '\0';
+  return out;
+}
+
+/* Reads a whole non-negative number in base, or returns -1 */
+static long manifest_number(const char *value, int base) {
+  char *end;
+  long number;
+
+  number = strtol(value, &end, base);
+  if (*value == '\0' || *end != '\0' || number < 0) {
+    return -1;
+  }
+  return number;
+}
+
+/* Fills writer->header from source. A regular file's source is opened as
+ * writer->src_fd, and inline content is pointed to by data. */
+static int manifest_source(const char *name, char *source, Writer *writer,
+                           const char **data, bool *opened) {
+  TarHeader *header = writer->header;
+  long now = time(NULL);
+  size_t len;
+  int err;
+
+  if (strncmp(source, "content:", 8) == 0) {
+    len = manifest_unescape(source + 8);
+    *data = source + 8;
+    return populate_header_from_memory(name, len, 0644, now, header);
+  }
+
+  if (strcmp(source, "dir:") == 0) {
+    err = populate_header_from_memory(name, 0, 0755, now, header);
+    header->typeflag = '5';
+    return err;
+  }
+
+  if (strncmp(source, "symlink:", 8) == 0) {
+    if (strlen(source + 8) > sizeof(header->linkname)) {
+      fprintf(stderr, "linkname greater than 100:\n%s\n", name);
+      return MYTAR_ERR_NAME;
+    }
+    err = populate_header_from_memory(name, 0, 0777, now, header);
+    header->typeflag = '2';
+    strncpy((char *)header->linkname, source + 8, sizeof(header->linkname));
+    return err;
+  }
+
+  stats_syscall(writer->stats, SYS_STAT);
+  if ((err = populate_header_from_file(source, header)) != MYTAR_OK) {
+    return err;
+  }
+
+  if (header->typeflag == '0') {
+    stats_syscall(writer->stats, SYS_OPEN);
+    if ((writer->src_fd = open(source, O_RDONLY)) == -1) {
+      perror(source);
+      return MYTAR_ERR_IO;
+    }
+    *opened = true;
+  }
+
+  return MYTAR_OK;
+}
+
+/* Applies the KEY=VALUE overrides in the tab-separated list fields */
+static int manifest_overrides(const char *name, char *fields,
+                              TarHeader *header) {
+  struct stat ids;
+  bool uname_set = false;
+  bool gname_set = false;
+  bool ids_set = false;
+  char *key;
+  char *value;
+  long number;
+
+  ids.st_uid = extract_id(header->uid, sizeof(header->uid));
+  ids.st_gid = extract_id(header->gid, sizeof(header->gid));
+
+  while (fields != NULL && *fields != '\0') {
+    key = fields;
+    if ((fields = strchr(fields, '\t')) != NULL) {
+      *fields++ = '\0';
+    }
+    if ((value = strchr(key, '=')) == NULL) {
+      fprintf(stderr, "%s: override %s has no value\n", name, key);
+      return MYTAR_ERR_INVAL;
+    }
+    *value++ = '\0';
+
+    if (strcmp(key, "uname") == 0 || strcmp(key, "gname") == 0) {
+      if (strlen(value) >= sizeof(header->uname)) {
+        fprintf(stderr, "%s: %s %s is too long\n", name, key, value);
+        return MYTAR_ERR_NAME;
+      }
+      if (strcmp(key, "uname") == 0) {
+        memset(header->uname, 0, sizeof(header->uname));
+        strcpy((char *)header->uname, value);
+        uname_set = true;
+      } else {
+        memset(header->gname, 0, sizeof(header->gname));
+        strcpy((char *)header->gname, value);
+        gname_set = true;
+      }
+      continue;
+    }
+
+    number = manifest_number(value, strcmp(key, "mode") == 0 ? 8 : 10);
+    if (number == -1 || (strcmp(key, "mode") == 0 && number > 07777)) {
+      fprintf(stderr, "%s: bad %s %s\n", name, key, value);
+      return MYTAR_ERR_INVAL;
+    }
+
+    if (strcmp(key, "mode") == 0) {
+      sprintf((char *)header->mode, "%07lo", number);
+    } else if (strcmp(key, "mtime") == 0) {
+      sprintf((char *)header->mtime, "%011lo", number);
+    } else if (strcmp(key, "uid") == 0) {
+      ids.st_uid = number;
+      ids_set = true;
+      /* the source's owner name would win over the new id on extract */
+      if (!uname_set) {
+        memset(header->uname, 0, sizeof(header->uname));
+      }
+    } else if (strcmp(key, "gid") == 0) {
+      ids.st_gid = number;
+      ids_set = true;
+      if (!gname_set) {
+        memset(header->gname, 0, sizeof(header->gname));
+      }
+    } else {
+      fprintf(stderr, "%s: unknown override %s\n", name, key);
+      return MYTAR_ERR_INVAL;
+    }
+  }
+
+  if (ids_set) {
+    populate_uid_gid(&ids, header);
+  }
+  return MYTAR_OK;
+}
+
+/* Names the member after its archive path, directories with a trailing
+ * slash */
+static int manifest_name(const char *name, TarHeader *header) {
+  char path[PATH_MAX];
+  size_t len = strlen(name);
+
+  if (len == 0) {
+    fprintf(stderr, "Manifest member without a name\n");
+    return MYTAR_ERR_NAME;
+  }
+
+  if (header->typeflag == '5' && name[len - 1] != '/') {
+    if (snprintf(path, sizeof(path), "%s/", name) >= (int)sizeof(path)) {
+      fprintf(stderr, "Path too long for a ustar header:\n%s\n", name);
+      return MYTAR_ERR_NAME;
+    }
+    name = path;
+  }
+
+  memset(header->name, 0, sizeof(header->name));
+  memset(header->prefix, 0, sizeof(header->prefix));
+  return populate_name(name, NULL, header);
+}
+
+/* Writes the member described by one manifest line */
+static int manifest_member(Flags *flags, Writer *writer, char *line) {
+  double start = stats_now();
+  TarHeader header;
+  const char *data = NULL;
+  bool opened = false;
+  char *source;
+  char *fields;
+  int err;
+
+  if (line[0] == '#') {
+    return MYTAR_OK;
+  }
+
+  if ((source = strchr(line, '\t')) == NULL) {
+    fprintf(stderr, "Manifest line without a source:\n%s\n", line);
+    return MYTAR_ERR_INVAL;
+  }
+  *source++ = '\0';
+  if ((fields = strchr(source, '\t')) != NULL) {
+    *fields++ = '\0';
+  }
+
+  memset(&header, 0, sizeof(TarHeader));
+  writer->header = &header;
+
+  err = manifest_source(line, source, writer, &data, &opened);
+  if (err == MYTAR_OK) {
+    err = manifest_overrides(line, fields, &header);
+  }
+  if (err == MYTAR_OK) {
+    err = manifest_name(line, &header);
+  }
+  populate_chksum(&header);
+  stats_phase(writer->stats, PHASE_HEADER, start);
+
+  if (err == MYTAR_OK) {
+    err = write_member(writer, data);
+  }
+
+  if (opened) {
+    stats_syscall(writer->stats, SYS_CLOSE);
+    close(writer->src_fd);
+  }
+
+  /* verbose output must not end up inside an archive written to stdout */
+  if (err == MYTAR_OK && flags->verbose) {
+    fprintf(writer->dst_fd == STDOUT_FILENO ? stderr : stdout, "%s\n", line);
+  }
+
+  writer->header = NULL;
+  return err;
+}
+
+/* Adds every member listed in flags->manifest, "-" being stdin */
+int manifest_archive(Flags *flags, Writer *writer) {
+  FileList list;
+  char *line;
+  int status;
+  int err;
+
+  if (strcmp(flags->manifest, "-") == 0 && flags->files_from != NULL &&
+      strcmp(flags->files_from, "-") == 0) {
+    fprintf(stderr, "The manifest and the file list cannot both be stdin\n");
+    return MYTAR_ERR_INVAL;
+  }
+
+  if ((line = malloc(MANIFEST_LINE)) == NULL) {
+    return MYTAR_ERR_NOMEM;
+  }
+
+  if ((err = filelist_open(&list, flags->manifest, flags->null)) !=
+      MYTAR_OK) {
+    free(line);
+    return err;
+  }
+  /* a line dropped for its length would silently lose a member */
+  list.strict = true;
+
+  while (err == MYTAR_OK &&
+         (status = filelist_next(&list, line, MANIFEST_LINE)) != 0) {
+    err = status < 0 ? status : manifest_member(flags, writer, line);
+  }
+
+  filelist_close(&list);
+  free(line);
+  return err;
+}
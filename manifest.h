@@ -0,0 +1,12 @@
+#ifndef MANIFEST
+#define MANIFEST
+
+#include "mytar.h"
+#include "writer.h"
+
+/* the longest manifest line, inline content included */
+#define MANIFEST_LINE 65536
+
+int manifest_archive(Flags *flags, Writer *writer);
+
+#endif
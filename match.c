@@ -0,0 +1,385 @@
+/* match.c
+ * This file compiles --exclude and --include glob patterns into a matcher.
+ * Patterns without a slash are matched against the last component of a path,
+ * and patterns with one against the whole path. The common shapes never reach
+ * fnmatch: literal names ("node_modules", ".git") and literal paths are kept
+ * in hash sets, and "*.ext" patterns in a set of extensions, so a lookup costs
+ * a few hashes however many of them there are. Only the remaining globs are
+ * tried one by one. The matcher also holds the paths read with -T, which
+ * select members on list and extract in the same constant time.
+ */
+
+#include "match.h"
+#include "libmytar.h"
+#include <fnmatch.h>
+#include <linux/limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+  char **slots;
+  long count;
+  long capacity;
+} StrSet;
+
+typedef struct {
+  char **patterns;
+  long count;
+  long capacity;
+} GlobList;
+
+typedef struct {
+  StrSet names;
+  StrSet paths;
+  StrSet extensions;
+  GlobList name_globs;
+  GlobList path_globs;
+  long count;
+} PatternSet;
+
+struct Matcher {
+  PatternSet exclude;
+  PatternSet include;
+
+  /* paths given with -T to select members on list and extract */
+  StrSet operands;
+};
+
+/* FNV-1a */
+static unsigned long str_hash(const char *s, size_t len) {
+  unsigned long hash = 2166136261UL;
+  size_t i;
+
+  for (i = 0; i < len; i++) {
+    hash = (hash ^ (unsigned char)s[i]) * 16777619UL;
+  }
+
+  return hash;
+}
+
+static bool strset_contains(const StrSet *set, const char *s, size_t len) {
+  unsigned long i;
+  char *slot;
+
+  if (set->count == 0) {
+    return false;
+  }
+
+  for (i = str_hash(s, len) % set->capacity;
+       (slot = set->slots[i]) != NULL; i = (i + 1) % set->capacity) {
+    if (strncmp(slot, s, len) == 0 && slot[len] == '\0') {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+static void strset_insert(StrSet *set, char *s) {
+  unsigned long i = str_hash(s, strlen(s)) % set->capacity;
+
+  while (set->slots[i] != NULL) {
+    i = (i + 1) % set->capacity;
+  }
+
+  set->slots[i] = s;
+  set->count++;
+}
+
+/* Adds a copy of s, keeping the table at most half full */
+static int strset_add(StrSet *set, const char *s) {
+  StrSet grown;
+  char *copy;
+  long i;
+
+  if (strset_contains(set, s, strlen(s))) {
+    return MYTAR_OK;
+  }
+
+  if ((set->count + 1) * 2 > set->capacity) {
+    grown.count = 0;
+    grown.capacity = set->capacity ? set->capacity * 2 : 64;
+    if ((grown.slots = calloc(grown.capacity, sizeof(char *))) == NULL) {
+      return MYTAR_ERR_NOMEM;
+    }
+
+    for (i = 0; i < set->capacity; i++) {
+      if (set->slots[i] != NULL) {
+        strset_insert(&grown, set->slots[i]);
+      }
+    }
+
+    free(set->slots);
+    *set = grown;
+  }
+
+  if ((copy = malloc(strlen(s) + 1)) == NULL) {
+    return MYTAR_ERR_NOMEM;
+  }
+  strcpy(copy, s);
+  strset_insert(set, copy);
+  return MYTAR_OK;
+}
+
+static void strset_free(StrSet *set) {
+  long i;
+
+  for (i = 0; i < set->capacity; i++) {
+    free(set->slots[i]);
+  }
+  free(set->slots);
+}
+
+static int globlist_add(GlobList *list, const char *pattern) {
+  char **grown;
+
+  if (list->count == list->capacity) {
+    list->capacity = list->capacity ? list->capacity * 2 : 16;
+    grown = realloc(list->patterns, list->capacity * sizeof(char *));
+    if (grown == NULL) {
+      return MYTAR_ERR_NOMEM;
+    }
+    list->patterns = grown;
+  }
+
+  if ((list->patterns[list->count] = malloc(strlen(pattern) + 1)) == NULL) {
+    return MYTAR_ERR_NOMEM;
+  }
+  strcpy(list->patterns[list->count++], pattern);
+  return MYTAR_OK;
+}
+
+static bool globlist_matches(const GlobList *list, const char *s) {
+  long i;
+
+  for (i = 0; i < list->count; i++) {
+    if (fnmatch(list->patterns[i], s, 0) == 0) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+static void globlist_free(GlobList *list) {
+  long i;
+
+  for (i = 0; i < list->count; i++) {
+    free(list->patterns[i]);
+  }
+  free(list->patterns);
+}
+
+static bool has_wildcard(const char *s) { return strpbrk(s, "*?[\\") != NULL; }
+
+/* Files a pattern, already stripped of ./ and trailing slashes, under the
+ * cheapest way of matching it */
+static int patternset_add(PatternSet *set, const char *pattern) {
+  bool is_path = strchr(pattern, '/') != NULL;
+
+  set->count++;
+
+  if (!has_wildcard(pattern)) {
+    return strset_add(is_path ? &set->paths : &set->names, pattern);
+  }
+
+  if (!is_path && pattern[0] == '*' && pattern[1] == '.' &&
+      !has_wildcard(pattern + 1)) {
+    return strset_add(&set->extensions, pattern + 1);
+  }
+
+  return globlist_add(is_path ? &set->path_globs : &set->name_globs, pattern);
+}
+
+/* Returns true if path, or name, its last component, matches the set */
+static bool patternset_matches(const PatternSet *set, const char *path,
+                               const char *name) {
+  const char *dot;
+
+  if (set->count == 0) {
+    return false;
+  }
+
+  if (strset_contains(&set->names, name, strlen(name)) ||
+      strset_contains(&set->paths, path, strlen(path))) {
+    return true;
+  }
+
+  /* a.tar.gz is looked up as .tar.gz, then .gz */
+  for (dot = strchr(name, '.'); dot != NULL; dot = strchr(dot + 1, '.')) {
+    if (strset_contains(&set->extensions, dot, strlen(dot))) {
+      return true;
+    }
+  }
+
+  return globlist_matches(&set->name_globs, name) ||
+         globlist_matches(&set->path_globs, path);
+}
+
+static void patternset_free(PatternSet *set) {
+  strset_free(&set->names);
+  strset_free(&set->paths);
+  strset_free(&set->extensions);
+  globlist_free(&set->name_globs);
+  globlist_free(&set->path_globs);
+}
+
+/* Copies path into normal without a leading ./ or trailing slashes. Returns
+ * false if it does not fit. */
+static bool normalize(const char *path, char *normal) {
+  size_t len;
+
+  while (path[0] == '.' && path[1] == '/') {
+    path += 2;
+  }
+
+  len = strlen(path);
+  if (len >= PATH_MAX) {
+    return false;
+  }
+
+  while (len > 1 && path[len - 1] == '/') {
+    len--;
+  }
+
+  memcpy(normal, path, len);
+  normal[len] = '\0';
+  return true;
+}
+
+Matcher *matcher_new() { return calloc(1, sizeof(Matcher)); }
+
+/* Adds an --exclude or --include pattern */
+int matcher_add(Matcher *matcher, const char *pattern, int kind) {
+  char normal[PATH_MAX];
+
+  if (!normalize(pattern, normal) || normal[0] == '\0') {
+    return MYTAR_ERR_INVAL;
+  }
+
+  return patternset_add(kind == MATCH_INCLUDE ? &matcher->include
+                                              : &matcher->exclude,
+                        normal);
+}
+
+/* Adds every non-empty line of file as a pattern, "-" being stdin */
+int matcher_add_file(Matcher *matcher, const char *file, int kind) {
+  char line[PATH_MAX];
+  FILE *in;
+  size_t len;
+  int err = MYTAR_OK;
+
+  if (strcmp(file, "-") == 0) {
+    in = stdin;
+  } else if ((in = fopen(file, "r")) == NULL) {
+    perror(file);
+    return MYTAR_ERR_IO;
+  }
+
+  while (err == MYTAR_OK && fgets(line, sizeof(line), in) != NULL) {
+    len = strlen(line);
+    if (len > 0 && line[len - 1] == '\n') {
+      line[--len] = '\0';
+    }
+    if (len > 0) {
+      err = matcher_add(matcher, line, kind);
+    }
+  }
+
+  if (in != stdin) {
+    fclose(in);
+  }
+  return err;
+}
+
+/* Returns true if path should be left out. A directory that is left out
+ * takes everything below it along, so its contents need not be checked.
+ * Directories are never left out for want of an --include, so files below
+ * them can still match. */
+bool matcher_skips(const Matcher *matcher, const char *path, bool is_dir) {
+  char normal[PATH_MAX];
+  const char *name;
+
+  if (matcher == NULL || !normalize(path, normal)) {
+    return false;
+  }
+
+  name = strrchr(normal, '/');
+  name = name != NULL ? name + 1 : normal;
+
+  if (patternset_matches(&matcher->exclude, normal, name)) {
+    return true;
+  }
+
+  return !is_dir && matcher->include.count > 0 &&
+         !patternset_matches(&matcher->include, normal, name);
+}
+
+/* Like matcher_skips for an archive member, which is also left out when any
+ * directory above it is. */
+bool matcher_skips_member(const Matcher *matcher, const char *path) {
+  char parent[PATH_MAX];
+  size_t len = strlen(path);
+  size_t i;
+
+  if (matcher == NULL || len == 0 || len >= sizeof(parent)) {
+    return false;
+  }
+
+  for (i = 1; i + 1 < len; i++) {
+    if (path[i] == '/') {
+      memcpy(parent, path, i);
+      parent[i] = '\0';
+      if (matcher_skips(matcher, parent, true)) {
+        return true;
+      }
+    }
+  }
+
+  return matcher_skips(matcher, path, path[len - 1] == '/');
+}
+
+/* Adds a path that selects itself, and everything below it, as a member */
+int matcher_add_operand(Matcher *matcher, const char *path) {
+  char normal[PATH_MAX];
+
+  if (!normalize(path, normal) || normal[0] == '\0') {
+    return MYTAR_ERR_INVAL;
+  }
+
+  return strset_add(&matcher->operands, normal);
+}
+
+bool matcher_has_operands(const Matcher *matcher) {
+  return matcher != NULL && matcher->operands.count > 0;
+}
+
+/* Returns true if path, or a directory above it, was added as an operand.
+ * Costs one lookup per path component however many operands there are. */
+bool matcher_selects(const Matcher *matcher, const char *path) {
+  char normal[PATH_MAX];
+  char *slash;
+
+  if (!matcher_has_operands(matcher) || !normalize(path, normal)) {
+    return false;
+  }
+
+  for (slash = strchr(normal + 1, '/'); slash != NULL;
+       slash = strchr(slash + 1, '/')) {
+    if (strset_contains(&matcher->operands, normal, slash - normal)) {
+      return true;
+    }
+  }
+
+  return strset_contains(&matcher->operands, normal, strlen(normal));
+}
+
+void matcher_free(Matcher *matcher) {
+  if (matcher != NULL) {
+    patternset_free(&matcher->exclude);
+    patternset_free(&matcher->include);
+    strset_free(&matcher->operands);
+    free(matcher);
+  }
+}
@@ -0,0 +1,22 @@
+#ifndef MATCH
+#define MATCH
+
+#include <stdbool.h>
+
+/* kinds of pattern given to matcher_add */
+#define MATCH_EXCLUDE 0
+#define MATCH_INCLUDE 1
+
+typedef struct Matcher Matcher;
+
+Matcher *matcher_new();
+int matcher_add(Matcher *matcher, const char *pattern, int kind);
+int matcher_add_file(Matcher *matcher, const char *file, int kind);
+bool matcher_skips(const Matcher *matcher, const char *path, bool is_dir);
+bool matcher_skips_member(const Matcher *matcher, const char *path);
+int matcher_add_operand(Matcher *matcher, const char *path);
+bool matcher_has_operands(const Matcher *matcher);
+bool matcher_selects(const Matcher *matcher, const char *path);
+void matcher_free(Matcher *matcher);
+
+#endif
@@ -0,0 +1,174 @@
+/* members.c
+ * This file keeps the member tables of recently listed archives for the
+ * daemon. A table holds every member header of an archive, and is keyed by the
+ * archive's device, inode, mtime and size, so a table is never used for an
+ * archive that changed since it was read. The least recently used tables are
+ * dropped to stay within MEMBERS_TABLES tables and MEMBERS_BYTES bytes, and
+ * an archive whose table alone would exceed that is not kept at all. Each
+ * job runs in a process of its own, which marks the tables it read or used
+ * so the daemon can take them over, and none of this is locked.
+ */
+
+#include "members.h"
+#include <stdlib.h>
+#include <string.h>
+
+void members_init(MemberCache *cache) { memset(cache, 0, sizeof(*cache)); }
+
+static long table_bytes(const MemberTable *table) {
+  return table->capacity * (long)sizeof(TarHeader);
+}
+
+static void members_unlink(MemberCache *cache, MemberTable *table) {
+  if (table->prev != NULL) {
+    table->prev->next = table->next;
+  } else {
+    cache->head = table->next;
+  }
+  if (table->next != NULL) {
+    table->next->prev = table->prev;
+  } else {
+    cache->tail = table->prev;
+  }
+  table->prev = NULL;
+  table->next = NULL;
+  cache->count--;
+  cache->bytes -= table_bytes(table);
+}
+
+static void members_push(MemberCache *cache, MemberTable *table) {
+  table->prev = NULL;
+  table->next = cache->head;
+  if (cache->head != NULL) {
+    cache->head->prev = table;
+  } else {
+    cache->tail = table;
+  }
+  cache->head = table;
+  cache->count++;
+  cache->bytes += table_bytes(table);
+}
+
+/* Returns the table of archive and marks it most recently used, or NULL if
+ * the archive is not cached as it is now */
+MemberTable *members_lookup(MemberCache *cache, const struct stat *archive) {
+  MemberTable *table;
+
+  for (table = cache->head; table != NULL; table = table->next) {
+    if (table->dev == archive->st_dev && table->ino == archive->st_ino) {
+      break;
+    }
+  }
+
+  if (table == NULL) {
+    return NULL;
+  }
+
+  members_unlink(cache, table);
+  if (table->mtime != archive->st_mtime || table->size != archive->st_size) {
+    members_free_table(table);
+    return NULL;
+  }
+
+  table->used = true;
+  members_push(cache, table);
+  return table;
+}
+
+/* Starts an empty table for archive, to be filled by members_record */
+MemberTable *members_new(const struct stat *archive) {
+  MemberTable *table = calloc(1, sizeof(MemberTable));
+
+  if (table != NULL) {
+    table->dev = archive->st_dev;
+    table->ino = archive->st_ino;
+    table->mtime = archive->st_mtime;
+    table->size = archive->st_size;
+  }
+  return table;
+}
+
+/* Appends a member's header. A table that outgrows MEMBERS_BYTES gives up
+ * its headers and is marked as overflowing instead of failing the scan. */
+void members_record(MemberTable *table, const TarHeader *header) {
+  TarHeader *grown;
+  long capacity;
+
+  if (table->overflow) {
+    return;
+  }
+
+  if (table->count == table->capacity) {
+    capacity = table->capacity ? table->capacity * 2 : 256;
+    if (capacity * (long)sizeof(TarHeader) > MEMBERS_BYTES ||
+        (grown = realloc(table->headers, capacity * sizeof(TarHeader))) ==
+            NULL) {
+      free(table->headers);
+      table->headers = NULL;
+      table->count = 0;
+      table->capacity = 0;
+      table->overflow = true;
+      return;
+    }
+    table->headers = grown;
+    table->capacity = capacity;
+  }
+
+  memcpy(&table->headers[table->count++], header, sizeof(TarHeader));
+}
+
+/* Adds a complete table as the most recently used, replacing any older
+ * table of the same archive and dropping the least recently used ones to make
+ * room. Takes ownership of table. */
+void members_insert(MemberCache *cache, MemberTable *table) {
+  MemberTable *oldest;
+
+  if (table->overflow) {
+    members_free_table(table);
+    return;
+  }
+
+  for (oldest = cache->head; oldest != NULL; oldest = oldest->next) {
+    if (oldest->dev == table->dev && oldest->ino == table->ino) {
+      members_unlink(cache, oldest);
+      members_free_table(oldest);
+      break;
+    }
+  }
+
+  while (cache->tail != NULL &&
+         (cache->count >= MEMBERS_TABLES ||
+          cache->bytes + table_bytes(table) > MEMBERS_BYTES)) {
+    oldest = cache->tail;
+    members_unlink(cache, oldest);
+    members_free_table(oldest);
+  }
+
+  table->fresh = true;
+  members_push(cache, table);
+}
+
+void members_clear_marks(MemberCache *cache) {
+  MemberTable *table;
+
+  for (table = cache->head; table != NULL; table = table->next) {
+    table->fresh = false;
+    table->used = false;
+  }
+}
+
+void members_free_table(MemberTable *table) {
+  if (table != NULL) {
+    free(table->headers);
+    free(table);
+  }
+}
+
+void members_free(MemberCache *cache) {
+  MemberTable *table;
+
+  while ((table = cache->head) != NULL) {
+    members_unlink(cache, table);
+    members_free_table(table);
+  }
+}
@@ -0,0 +1,48 @@
+#ifndef MEMBERS
+#define MEMBERS
+
+#include "header.h"
+#include <stdbool.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <time.h>
+
+/* archives whose member tables the daemon keeps, and their total size */
+#define MEMBERS_TABLES 16
+#define MEMBERS_BYTES (256L * 1024 * 1024)
+
+/* every member header of one archive, in archive order */
+typedef struct MemberTable {
+  dev_t dev;
+  ino_t ino;
+  time_t mtime;
+  off_t size;
+  TarHeader *headers;
+  long count;
+  long capacity;
+  bool overflow;
+  /* read or used since the marks were last cleared */
+  bool fresh;
+  bool used;
+  struct MemberTable *prev;
+  struct MemberTable *next;
+} MemberTable;
+
+/* the most recently used tables, most recent first */
+typedef struct {
+  MemberTable *head;
+  MemberTable *tail;
+  int count;
+  long bytes;
+} MemberCache;
+
+void members_init(MemberCache *cache);
+MemberTable *members_lookup(MemberCache *cache, const struct stat *archive);
+MemberTable *members_new(const struct stat *archive);
+void members_record(MemberTable *table, const TarHeader *header);
+void members_insert(MemberCache *cache, MemberTable *table);
+void members_clear_marks(MemberCache *cache);
+void members_free_table(MemberTable *table);
+void members_free(MemberCache *cache);
+
+#endif
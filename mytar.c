@@ -1,417 +1,410 @@
 /* mytar.c
- * This file includes functions for creating, listing, and extracting tar files.
- * It also manages the command line interface, including populating the flag
- * struct.
+ * This file manages the command line interface, including populating the flag
+ * struct. The archive operations themselves live in libmytar.
  */
 
 #include "mytar.h"
-#include "header.h"
-#include "reader.h"
-#include "writer.h"
-#include <dirent.h>
-#include <errno.h>
-#include <fcntl.h>
-#include <linux/limits.h>
+#include "archive.h"
+#include "compare.h"
+#include "daemon.h"
+#include "libmytar.h"
+#include "match.h"
+#include "rewrite.h"
+#include "scan.h"
+#include "shard.h"
+#include "throttle.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/stat.h>
-#include <sys/types.h>
-#include <time.h>
 #include <unistd.h>
 
-extern int getopt(int argc, char *const argv[], const char *optstring);
-extern char *optarg;
-extern int optind;
-extern char *strdup(const char *);
-extern int snprintf(char *str, size_t size, const char *format, ...);
-extern int symlink(const char *target, const char *linkpath);
-
-void init_flags(Flags *flags) {
-  flags->create = false;
-  flags->list = false;
-  flags->extract = false;
-  flags->verbose = false;
-  flags->strict = false;
-  flags->tarfile = NULL;
-  flags->paths = NULL;
-  flags->n_paths = 0;
+void usage() {
+  fprintf(stderr, "usage: mytar [ctxdvSOzp]f tarfile [ path [ ... ] ] "
+                  "[--stats[=json]] [--shards N] [--threads N]\n"
+                  "       [--digest=crc32c] [--verify] [--keep-newer]\n"
+                  "       [--skip-identical[=content]] [--exclude PATTERN]\n"
+                  "       [--include PATTERN] [--exclude-from FILE]\n"
+                  "       [-T FILE] [--null] [--no-recursion]\n"
+                  "       [--sync=none|end|batch|file] [--rewrite OUT]\n"
+                  "       [--strip-components N] [--rename OLD=NEW]\n"
+                  "       [--align N] [--bwlimit RATE[k|m|g]]\n");
+  fprintf(stderr, "       [--ionice=idle] [--print0] [--same-owner]\n"
+                  "       [--checkpoint FILE [--checkpoint-every MB]]\n"
+                  "       [--resume] [--blocking-factor N]\n"
+                  "       [--manifest FILE]\n"
+                  "       mytar --daemon SOCKET\n"
+                  "       mytar --client SOCKET [ctxdvSOzp]f tarfile ...\n");
+  exit(EXIT_FAILURE);
 }
 
-/* Processes a file or directory and writes it into a tar file */
-void process_path(const char *src, Writer *writer, bool is_verbose) {
+/* long options that take a value, given as --name=value or --name value */
+static const char *valued_options[] = {
+    "shards",           "threads",          "exclude",
+    "include",          "exclude-from",     "files-from",
+    "sync",             "rewrite",          "strip-components",
+    "rename",           "align",            "bwlimit",
+    "checkpoint",       "checkpoint-every", "blocking-factor",
+    "manifest",         NULL};
 
-  writer->header = init_header();
+bool takes_value(const char *name) {
+  int i;
 
-  populate_header_from_file(src, writer->header);
+  for (i = 0; valued_options[i] != NULL; i++) {
+    if (strcmp(name, valued_options[i]) == 0) {
+      return true;
+    }
+  }
 
-  writer_write_header(writer);
+  return false;
+}
 
-  switch (writer->header->typeflag) {
-  case '0':
-    writer_write_file(writer);
-    writer_flush(writer);
-    close(writer->src_fd);
-    break;
-  case '2':
-    close(writer->src_fd);
-    break;
-  case '5':
-  default:
-    break;
-  }
+/* Parses a --sync mode into result */
+bool parse_sync_mode(const char *value, int *result) {
+  static const char *modes[] = {"none", "end", "batch", "file", NULL};
+  int i;
 
-  if (is_verbose) {
-    printf("%s\n", src);
+  for (i = 0; value != NULL && modes[i] != NULL; i++) {
+    if (strcmp(value, modes[i]) == 0) {
+      *result = i;
+      return true;
+    }
   }
 
-  free(writer->header);
+  return false;
 }
 
-/* Performes dfs on directory and its directories until all files are read. */
-void traverse_path(const char *path, Writer *writer, bool is_verbose) {
-  DIR *dir;
-  struct dirent *entry;
-  struct stat entry_stat;
-  struct stat path_stat;
-  char pathBuff[PATH_MAX];
-  int path_len;
-
-  path_len = strlen(path);
-  strcpy(pathBuff, path);
+/* Splits an OLD=NEW --rename value, dropping trailing slashes from both */
+bool parse_rename(Flags *flags, char *value) {
+  char *equals;
+  size_t len;
 
-  if (stat(path, &path_stat) != 0) {
-    fprintf(stderr, "Cannot stat path %s\n", path);
-    return;
+  if (value == NULL || (equals = strchr(value, '=')) == NULL ||
+      equals == value) {
+    return false;
   }
+  *equals = '\0';
 
-  /* append a slash if its a directory and doesnt already have slash */
-  if (path_len == 0 ||
-      (S_ISDIR(path_stat.st_mode) && path[path_len - 1] != '/'))
-    strcat(pathBuff, "/");
-
-  /* if the given path is a file or link */
+  flags->rename_from = value;
+  flags->rename_to = equals + 1;
 
-  if (S_ISREG(path_stat.st_mode) || S_ISLNK(path_stat.st_mode)) {
+  for (len = strlen(value); len > 1 && value[len - 1] == '/'; len--) {
+    value[len - 1] = '\0';
+  }
+  for (len = strlen(equals + 1); len > 0 && equals[len] == '/'; len--) {
+    equals[len] = '\0';
+  }
 
-    if ((writer->src_fd = open(path, O_RDONLY)) == -1) {
-      perror("Failed to open source file: \n");
-      printf("%s", path);
-      exit(EXIT_FAILURE);
-    }
+  return true;
+}
 
-    process_path(pathBuff, writer, is_verbose);
+/* Parses an --align size, a power of two from one block to 1 MiB */
+bool parse_align(const char *value, int *result) {
+  char *endptr;
+  long align;
 
-    return;
+  if (value == NULL) {
+    return false;
   }
 
-  if ((dir = opendir(path)) == NULL) {
-    perror("Failed to open dir.");
-    exit(EXIT_FAILURE);
+  align = strtol(value, &endptr, 10);
+  if (*value == '\0' || *endptr != '\0' || align < 512 || align > 1048576 ||
+      (align & (align - 1)) != 0) {
+    return false;
   }
 
-  /* must process dir before opening it */
-  process_path(pathBuff, writer, is_verbose);
+  *result = align;
+  return true;
+}
 
-  while ((entry = readdir(dir)) != NULL) {
-    sprintf(pathBuff + path_len + (path[path_len - 1] != '/'), "%s",
-            entry->d_name);
+/* Parses a --bwlimit rate in bytes per second, with an optional k, m or g
+ * suffix for binary multiples */
+bool parse_rate(const char *value, long *result) {
+  char *endptr;
+  long rate;
 
-    if (stat(pathBuff, &entry_stat) != 0) {
-      fprintf(stderr, "Cannot stat file %s\n", pathBuff);
-      continue;
-    }
+  if (value == NULL) {
+    return false;
+  }
 
-    if (S_ISDIR(entry_stat.st_mode)) {
-      if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
-        continue;
+  rate = strtol(value, &endptr, 10);
+  switch (*endptr) {
+  case 'k':
+  case 'K':
+    rate *= 1024L;
+    endptr++;
+    break;
+  case 'm':
+  case 'M':
+    rate *= 1024L * 1024;
+    endptr++;
+    break;
+  case 'g':
+  case 'G':
+    rate *= 1024L * 1024 * 1024;
+    endptr++;
+    break;
+  }
 
-      /* Directories dont need src fd because we are just parsing meta data.
-       */
+  if (endptr == value || *endptr != '\0' || rate <= 0) {
+    return false;
+  }
 
-      strcat(pathBuff, "/");
-      traverse_path(pathBuff, writer, is_verbose);
+  *result = rate;
+  return true;
+}
 
-    } else {
-      /* If handling a file, we need to change the source file descriptor
-       * beforehand.*/
+/* Parses a strictly positive count into result */
+bool parse_count(const char *value, int *result) {
+  char *endptr;
+  long count;
 
-      if ((writer->src_fd = open(pathBuff, O_RDONLY)) == -1) {
-        perror("Failed to open source file: \n");
-        printf("%s: ", pathBuff);
-        continue;
-      }
+  if (value == NULL) {
+    return false;
+  }
 
-      process_path(pathBuff, writer, is_verbose);
-    }
+  count = strtol(value, &endptr, 10);
+  if (*value == '\0' || *endptr != '\0' || count <= 0 || count > 4096) {
+    return false;
   }
 
-  closedir(dir);
+  *result = count;
+  return true;
 }
 
-/* Lists an archive entry with extra information include permissions, time,
- * etc.*/
-void print_name_verbose(TarHeader *header, char *full_name) {
-  char permissions[11];
-  char owner[65];
-  long size = 0;
-  char mtime[17];
-  time_t time_value;
-  struct tm *time_info;
-
-  permissions_to_string((char *)header->mode, permissions, header);
-
-  snprintf(owner, sizeof(owner), "%s/%s", header->uname, header->gname);
+/* Sets up the buffer t writes its listing through */
+void enable_listing(Flags *flags) {
+  if ((flags->listing = malloc(sizeof(Listing))) == NULL) {
+    fprintf(stderr, "Failed to allocate memory for the listing.");
+    exit(EXIT_FAILURE);
+  }
 
-  /* format size */
-  size = strtol((char *)header->size, NULL, OCTAL_SIZE);
+  listing_init(flags->listing, STDOUT_FILENO, flags->print0);
+}
 
-  /* format time */
-  time_value = strtol((char *)header->mtime, NULL, OCTAL_SIZE);
-  time_info = localtime(&time_value);
-  strftime(mtime, sizeof(mtime), "%Y-%m-%d %H:%M", time_info);
+bool enable_stats(Flags *flags, bool json) {
+  if ((flags->stats = malloc(sizeof(Stats))) == NULL) {
+    fprintf(stderr, "Failed to allocate memory for stats.");
+    exit(EXIT_FAILURE);
+  }
 
-  printf("%-10s %-17s %8ld %-16s %s\n", permissions, owner, size, mtime,
-         full_name);
+  stats_init(flags->stats);
+  flags->stats_json = json;
+  return true;
 }
 
-void print_entry(Flags *flags, Reader *reader, char *name) {
-  if (flags->verbose) {
-    print_name_verbose(reader->current_entry->header, name);
-  } else {
-    printf("%s\n", name);
+/* Adds an --exclude or --include pattern, or the --exclude-from patterns,
+ * to the matcher, creating it on first use */
+bool add_pattern(Flags *flags, const char *name, const char *value) {
+  if (value == NULL) {
+    return false;
   }
 
-  /* if this is a file, not a dir. Skip the file contents */
-  if (name[strlen(name) - 1] != '/') {
-    reader_skip_file_contents(reader);
+  if (flags->matcher == NULL && (flags->matcher = matcher_new()) == NULL) {
+    fprintf(stderr, "Failed to allocate memory for patterns.");
+    exit(EXIT_FAILURE);
   }
-}
 
-/* This function takes a path, and will guarentee the path will exist in the
- * filesysem. If the path points to a file, it will return a file descriptor of
- * the file opened. etc.*/
-int path_to_filesystem(const char *path, TarHeader *header) {
-  char opath[PATH_MAX];
-  char *p;
-  size_t len;
-  mode_t mode;
-  int fd;
-  char link_name[PATH_MAX];
-
-  int stat_res;
-  struct stat path_stat;
-
-  strncpy(opath, path, sizeof(opath));
-  opath[sizeof(opath) - 1] = '\0';
-  len = strlen(opath);
-
-  if (len == 0)
-    return -1;
-
-  for (p = opath; *p; p++) {
-    if (*p == '/') {
-      *p = '\0';
-      stat_res = stat(opath, &path_stat);
-      if (stat_res != 0) {
-        if (mkdir(opath, RWX_ALL) != 0) {
-          return -1;
-        }
-      }
-      *p = '/';
-    }
+  if (strcmp(name, "exclude-from") == 0) {
+    return matcher_add_file(flags->matcher, value, MATCH_EXCLUDE) == MYTAR_OK;
   }
-  if (opath[len - 1] != '/') {
 
-    /* is this a file or a synmlink */
+  return matcher_add(flags->matcher, value,
+                     strcmp(name, "include") == 0 ? MATCH_INCLUDE
+                                                  : MATCH_EXCLUDE) == MYTAR_OK;
+}
 
-    if (header->typeflag == '2') {
-      /* this is a symlink. */
-      strncpy(link_name, (char *)header->linkname, sizeof(link_name));
-      if (symlink(link_name, opath) == -1) {
-        fprintf(stderr, "Failed to create symlink.\n");
-      };
-      return 0;
+/* Handles a single --name[=value]. Returns false if the option is unknown or
+ * its value is invalid. */
+bool parse_long_option(Flags *flags, const char *name, const char *value) {
+  if (strcmp(name, "stats") == 0) {
+    if (value != NULL && strcmp(value, "json") != 0) {
+      return false;
     }
+    return enable_stats(flags, value != NULL);
+  }
 
-    mode = strtol((char *)header->mode, NULL, OCTAL_SIZE);
+  if (strcmp(name, "shards") == 0) {
+    return parse_count(value, &flags->shards);
+  }
 
-    if (mode & S_IXUSR || mode & S_IXGRP || mode & S_IXOTH) {
-      /* Grant execute permission to all if anyone has perms */
-      mode = RWX_ALL;
-    } else {
-      mode = RW_ALL;
-    }
+  if (strcmp(name, "threads") == 0) {
+    return parse_count(value, &flags->threads);
+  }
 
-    fd = open(opath, O_WRONLY | O_CREAT | O_TRUNC, mode);
-    if (fd == -1) {
-      perror("Failed to create/open when converting path to filesystem.\n");
-      exit(EXIT_FAILURE);
-    }
-    return fd;
-  } else if (access(opath, F_OK) != 0) {
-    if (mkdir(opath, RWX_ALL) != 0) {
-      return -1;
-    }
+  if (strcmp(name, "blocking-factor") == 0) {
+    return parse_count(value, &flags->blocking_factor) &&
+           flags->blocking_factor <= NUM_HUNKS;
   }
-  return 0;
-}
 
-/* This function handels extracting a path, and writing to it in the filesystem.
- */
-void extract_path(Flags *flags, Reader *reader, char *name) {
+  if (strcmp(name, "digest") == 0) {
+    flags->digest = value != NULL && strcmp(value, "crc32c") == 0;
+    return flags->digest;
+  }
 
-  Entry *entry = reader->current_entry;
+  if (strcmp(name, "exclude") == 0 || strcmp(name, "include") == 0 ||
+      strcmp(name, "exclude-from") == 0) {
+    return add_pattern(flags, name, value);
+  }
 
-  /* If this is strict dont extract header with special int */
-  if (flags->strict) {
-    if ((unsigned char)entry->header->uid[0] & 0x80) {
-      fprintf(stderr, "Uid not strictly compliant. Skipping: %s", name);
-      return;
-    }
+  if (strcmp(name, "files-from") == 0) {
+    flags->files_from = (char *)value;
+    return value != NULL;
   }
 
-  switch (entry->header->typeflag) {
-    /* file */
-  case '0':
-  case '\0':
+  if (strcmp(name, "null") == 0) {
+    flags->null = value == NULL;
+    return flags->null;
+  }
 
-    reader->dst_fd = path_to_filesystem(name, reader->current_entry->header);
+  if (strcmp(name, "no-recursion") == 0) {
+    flags->no_recursion = value == NULL;
+    return flags->no_recursion;
+  }
 
-    reader_translate_to_file(reader);
-    close(reader->dst_fd);
+  if (strcmp(name, "keep-newer") == 0) {
+    flags->keep_newer = value == NULL;
+    return flags->keep_newer;
+  }
 
-    if (flags->verbose) {
-      printf("%s\n", name);
+  if (strcmp(name, "skip-identical") == 0) {
+    if (value == NULL) {
+      flags->skip_identical = SKIP_METADATA;
+    } else if (strcmp(value, "content") == 0) {
+      flags->skip_identical = SKIP_CONTENT;
+    } else {
+      return false;
     }
+    return true;
+  }
 
-    break;
-    /* dir or symlink */
-  case '5':
-  case '2':
-    path_to_filesystem(name, reader->current_entry->header);
-    if (flags->verbose) {
-      printf("%s\n", name);
-    }
-    break;
+  if (strcmp(name, "align") == 0) {
+    return parse_align(value, &flags->align);
   }
-}
 
-/* This function will traverse the archive, and will execute the function
- * process_entry on any desired archive entries.
- */
-void traverse_execute_archive(Reader *reader, char *archive_path, Flags *flags,
-                              void (*process_entry)(Flags *, Reader *,
-                                                    char *)) {
-  int i;
-  int fd;
-  int prefix_len = 0;
-  /* 257 to include normalizing / if need be */
-  char path[PATH_MAX];
-  int reader_status;
-  char *prefix;
-  bool match_found = false;
-
-  /* treat every path as prefix;
-   *Print if the prefix matches and the next is either null or /.
-   *
-   * */
-
-  if ((fd = open(archive_path, O_RDONLY)) == -1) {
-    fprintf(stderr, "Could not open archive when attempting to list.");
-    exit(EXIT_FAILURE);
+  if (strcmp(name, "rewrite") == 0) {
+    flags->rewrite = (char *)value;
+    return value != NULL;
   }
 
-  if (flags->n_paths != 0) {
+  if (strcmp(name, "strip-components") == 0) {
+    return parse_count(value, &flags->strip_components);
+  }
 
-    while ((reader_status = reader_cycle_entry(reader)) != 0) {
+  if (strcmp(name, "rename") == 0) {
+    return parse_rename(flags, (char *)value);
+  }
 
-      if (reader_status == -1) {
-        fprintf(stderr, "Encountered non-compliant entry. Skipping.\n");
-        continue;
-      }
+  if (strcmp(name, "bwlimit") == 0) {
+    return parse_rate(value, &flags->bwlimit);
+  }
 
-      match_found = false;
-      memset(path, 0, sizeof(path));
-      extract_name(reader->current_entry->header, path);
+  if (strcmp(name, "ionice") == 0) {
+    flags->ionice_idle = value != NULL && strcmp(value, "idle") == 0;
+    return flags->ionice_idle;
+  }
 
-      for (i = 0; i < flags->n_paths; i++) {
+  if (strcmp(name, "same-owner") == 0) {
+    flags->same_owner = value == NULL;
+    return flags->same_owner;
+  }
 
-        prefix_len = strlen(flags->paths[i]);
-        prefix = flags->paths[i];
+  if (strcmp(name, "manifest") == 0) {
+    flags->manifest = (char *)value;
+    return value != NULL;
+  }
 
-        if (prefix[prefix_len - 1] == '/') {
-          prefix_len -= 1;
-        }
+  if (strcmp(name, "checkpoint") == 0) {
+    flags->checkpoint_file = (char *)value;
+    return value != NULL;
+  }
 
-        /* the prefix matches */
-        if (strncmp(path, prefix, prefix_len) == 0) {
-          /* Is this an exact match, or a directory */
+  if (strcmp(name, "checkpoint-every") == 0) {
+    return parse_count(value, &flags->checkpoint_every);
+  }
 
-          if (prefix_len == strlen(path) || path[prefix_len] == '/') {
-            process_entry(flags, reader, path);
-            match_found = true;
-            break;
-          }
-        }
-      }
-      /* if this path was a file and no entries found, skip its contents */
-      if (!match_found && path[strlen(path) - 1] != '/') {
-        reader_skip_file_contents(reader);
-      }
-    }
-  } else {
-    /* print all entries */
-    while ((reader_status = reader_cycle_entry(reader)) != 0) {
+  if (strcmp(name, "resume") == 0) {
+    flags->resume = value == NULL;
+    return flags->resume;
+  }
 
-      if (reader_status == -1) {
-        fprintf(stderr, "Encountered non-compliant entry. Skipping.\n");
-        continue;
-      }
+  if (strcmp(name, "sync") == 0) {
+    return parse_sync_mode(value, &flags->sync_mode);
+  }
 
-      memset(path, 0, sizeof(path));
-      extract_name(reader->current_entry->header, path);
+  if (strcmp(name, "print0") == 0) {
+    flags->print0 = value == NULL;
+    return flags->print0;
+  }
 
-      process_entry(flags, reader, path);
-    }
+  if (strcmp(name, "verify") == 0) {
+    flags->verify = value == NULL;
+    return flags->verify;
   }
+
+  return false;
 }
 
-void list_archive(Flags *flags) {
+/* Consumes every --option in argv so the positional layout stays
+ * "flags tarfile paths...". Returns the new argc. */
+int parse_long_options(Flags *flags, int argc, char *argv[]) {
+  int i;
+  int n = 1;
+  char name[64];
+  char *arg;
+  char *value;
+  size_t len;
 
-  Reader reader;
-  reader_init(&reader, flags->strict);
+  for (i = 1; i < argc; i++) {
+    /* -T FILE is the short form of --files-from FILE */
+    if (strcmp(argv[i], "-T") == 0) {
+      if (i + 1 == argc || !parse_long_option(flags, "files-from", argv[++i])) {
+        usage();
+      }
+      continue;
+    }
 
-  if ((reader.src_fd = open(flags->tarfile, O_RDONLY)) == -1) {
-    perror("Could not open archive when attempting to list.");
-    exit(EXIT_FAILURE);
-  }
+    if (strncmp(argv[i], "--", 2) != 0) {
+      argv[n++] = argv[i];
+      continue;
+    }
 
-  traverse_execute_archive(&reader, flags->tarfile, flags, print_entry);
-}
-void extract_archive(Flags *flags) {
+    arg = argv[i];
+    value = strchr(arg, '=');
+    len = value != NULL ? value - arg - 2 : strlen(arg + 2);
+    if (len >= sizeof(name)) {
+      len = sizeof(name) - 1;
+    }
+    memcpy(name, arg + 2, len);
+    name[len] = '\0';
 
-  Reader reader;
-  reader_init(&reader, flags->strict);
+    if (value != NULL) {
+      value++;
+    } else if (takes_value(name) && i + 1 < argc) {
+      value = argv[++i];
+    }
 
-  if ((reader.src_fd = open(flags->tarfile, O_RDONLY)) == -1) {
-    perror("Could not open archive when attempting to list.");
-    exit(EXIT_FAILURE);
+    if (!parse_long_option(flags, name, value)) {
+      fprintf(stderr, "Unknown or invalid option %s\n", arg);
+      usage();
+    }
   }
 
-  traverse_execute_archive(&reader, flags->tarfile, flags, extract_path);
+  return n;
 }
 
-int main(int argc, char *argv[]) {
+/* Runs one command line, on its own or as a daemon's job, which is given
+ * the member tables the daemon keeps */
+static int run(int argc, char *argv[], MemberCache *members) {
   Flags flags;
-  Writer writer;
   int i;
+  int err = MYTAR_OK;
   init_flags(&flags);
-  writer_init(&writer);
+  flags.members = members;
+
+  argc = parse_long_options(&flags, argc, argv);
 
   if (argc < 3) {
-    fprintf(stderr, "usage: mytar [ctxvS]f tarfile [ path [ ... ] ]");
-    exit(EXIT_FAILURE);
+    usage();
   }
 
   /* set any flags, and populate the paths */
@@ -426,6 +419,9 @@ int main(int argc, char *argv[]) {
     case 'x':
       flags.extract = true;
       break;
+    case 'd':
+      flags.compare = true;
+      break;
     case 'v':
       flags.verbose = true;
       break;
@@ -435,16 +431,23 @@ int main(int argc, char *argv[]) {
     case 'S':
       flags.strict = true;
       break;
+    case 'O':
+      flags.to_stdout = true;
+      break;
+    case 'z':
+      flags.gzip = true;
+      break;
+    case 'p':
+      flags.preserve = true;
+      break;
     default:
-      fprintf(stderr, "usage: mytar [ctxvS]f tarfile [ path [ ... ] ]");
-      exit(EXIT_FAILURE);
+      usage();
     }
   }
 
   /* f is required */
   if (flags.tarfile == NULL) {
-    fprintf(stderr, "usage: mytar [ctxvS]f tarfile [ path [ ... ] ]");
-    exit(EXIT_FAILURE);
+    usage();
   }
 
   if (argc > 3) {
@@ -452,32 +455,86 @@ int main(int argc, char *argv[]) {
     flags.paths = &argv[3];
   }
 
-  if (flags.list) {
-    list_archive(&flags);
-    return 0;
+  /* both apply to every thread the operation starts */
+  if (flags.bwlimit > 0) {
+    throttle_set_rate(flags.bwlimit);
+  }
+  if (flags.ionice_idle && (err = throttle_ionice_idle()) != MYTAR_OK) {
+    fprintf(stderr, "mytar: %s\n", mytar_strerror(err));
+    exit(EXIT_FAILURE);
   }
 
-  if (flags.create) {
+  /* only create and extract can be checkpointed, and resuming needs one */
+  if ((flags.checkpoint_file != NULL &&
+       !(flags.create && flags.shards == 1) && !flags.extract) ||
+      (flags.resume && flags.checkpoint_file == NULL)) {
+    usage();
+  }
 
-    if ((writer.dst_fd =
-             open(flags.tarfile, O_WRONLY | O_CREAT | O_TRUNC, 0644)) == -1) {
-      perror("Failed to open destination file");
-      exit(EXIT_FAILURE);
-    }
-    for (i = 0; i < flags.n_paths; i++) {
-      traverse_path(flags.paths[i], &writer, flags.verbose);
+  /* a manifest is written by a single, uninterrupted create */
+  if (flags.manifest != NULL &&
+      (!flags.create || flags.shards > 1 || flags.checkpoint_file != NULL)) {
+    usage();
+  }
+
+  /* --rewrite is a mode of its own */
+  if (flags.rewrite != NULL &&
+      (flags.create || flags.list || flags.extract || flags.compare)) {
+    usage();
+  }
+
+  if (flags.list && flags.rewrite == NULL) {
+    enable_listing(&flags);
+  }
+
+  if (flags.rewrite != NULL) {
+    err = rewrite_archive(&flags);
+  } else if (flags.list && flags.threads > 1 && !flags.verify &&
+             !flags.gzip) {
+    err = list_archive_parallel(&flags);
+  } else if (flags.list) {
+    err = list_archive(&flags);
+  } else if (flags.create && flags.shards > 1) {
+    err = create_sharded_archive(&flags);
+  } else if (flags.create) {
+    err = create_archive(&flags);
+  } else if (flags.extract) {
+    err = extract_archive(&flags);
+  } else if (flags.compare) {
+    err = compare_archive(&flags);
+  }
+
+  if (flags.listing != NULL) {
+    if (listing_flush(flags.listing) != MYTAR_OK && err == MYTAR_OK) {
+      err = MYTAR_ERR_IO;
     }
+    free(flags.listing);
+  }
 
-    writer_pad(&writer);
-    writer_flush(&writer);
-    close(writer.dst_fd);
-    return 0;
+  if (flags.stats != NULL) {
+    stats_print(flags.stats, stderr, flags.stats_json);
+    free(flags.stats);
   }
+  matcher_free(flags.matcher);
 
-  if (flags.extract) {
-    extract_archive(&flags);
-    return 0;
+  if (err != MYTAR_OK) {
+    fprintf(stderr, "mytar: %s\n", mytar_strerror(err));
+    exit(EXIT_FAILURE);
   }
 
   return 0;
 }
+
+int main(int argc, char *argv[]) {
+  /* --daemon and --client come first, the client forwarding the rest */
+  if (argc == 3 && strcmp(argv[1], "--daemon") == 0) {
+    return daemon_serve(argv[2], run) == MYTAR_OK ? EXIT_SUCCESS
+                                                   : EXIT_FAILURE;
+  }
+
+  if (argc >= 3 && strcmp(argv[1], "--client") == 0) {
+    return daemon_client(argv[2], argc - 3, argv + 3);
+  }
+
+  return run(argc, argv, NULL);
+}
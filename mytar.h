@@ -1,17 +1,66 @@
 #ifndef MYTAR
 #define MYTAR
+#include "checkpoint.h"
+#include "listing.h"
+#include "match.h"
+#include "members.h"
+#include "restore.h"
+#include "stats.h"
+#include "sync.h"
 #include <stdbool.h>
 
 #define RW_ALL 0666
 #define RWX_ALL 0777
 #define OCTAL_SIZE 8
 
+/* what --skip-identical compares before leaving a file alone */
+#define SKIP_NONE 0
+#define SKIP_METADATA 1
+#define SKIP_CONTENT 2
+
 typedef struct {
   bool create;
   bool list;
   bool extract;
+  bool compare;
   bool verbose;
   bool strict;
+  bool to_stdout;
+  bool gzip;
+  bool digest;
+  int align;
+  bool verify;
+  bool keep_newer;
+  int skip_identical;
+  bool preserve;
+  bool same_owner;
+  Restorer *restorer;
+  int sync_mode;
+  long bwlimit;
+  bool ionice_idle;
+  Syncer *syncer;
+  char *checkpoint_file;
+  int checkpoint_every;
+  bool resume;
+  Checkpoint *checkpoint;
+  Matcher *matcher;
+  char *files_from;
+  bool null;
+  bool no_recursion;
+  char *manifest;
+  char *rewrite;
+  int strip_components;
+  char *rename_from;
+  char *rename_to;
+  int shards;
+  int threads;
+  int blocking_factor;
+  bool stats_json;
+  Stats *stats;
+  Listing *listing;
+  bool print0;
+  MemberCache *members;
+  MemberTable *recording;
   char *tarfile;
   char **paths;
   int n_paths;
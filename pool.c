@@ -0,0 +1,110 @@
+/* pool.c
+ * This file implements a fixed-size pool of worker threads fed through a
+ * bounded queue. Tasks run in no particular order; pool_finish waits for all
+ * of them before returning.
+ */
+
+#include "pool.h"
+#include "libmytar.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+static void *pool_run(void *arg) {
+  Pool *pool = arg;
+  void *task;
+
+  for (;;) {
+    pthread_mutex_lock(&pool->lock);
+    while (pool->count == 0 && !pool->closing) {
+      pthread_cond_wait(&pool->not_empty, &pool->lock);
+    }
+
+    if (pool->count == 0) {
+      pthread_mutex_unlock(&pool->lock);
+      return NULL;
+    }
+
+    task = pool->tasks[pool->head];
+    pool->head = (pool->head + 1) % pool->capacity;
+    pool->count--;
+    pthread_cond_signal(&pool->not_full);
+    pthread_mutex_unlock(&pool->lock);
+
+    pool->fn(task, pool->ctx);
+  }
+}
+
+/* Starts n_threads workers that call fn(task, ctx) for every submitted task.
+ * At most capacity tasks wait in the queue at once. */
+int pool_init(Pool *pool, int n_threads, long capacity, pool_fn fn,
+              void *ctx) {
+  int i;
+
+  pool->fn = fn;
+  pool->ctx = ctx;
+  pool->head = 0;
+  pool->count = 0;
+  pool->capacity = capacity;
+  pool->closing = false;
+  pool->n_threads = 0;
+
+  pool->tasks = malloc(capacity * sizeof(void *));
+  pool->threads = malloc(n_threads * sizeof(pthread_t));
+  if (pool->tasks == NULL || pool->threads == NULL) {
+    free(pool->tasks);
+    free(pool->threads);
+    return MYTAR_ERR_NOMEM;
+  }
+
+  pthread_mutex_init(&pool->lock, NULL);
+  pthread_cond_init(&pool->not_empty, NULL);
+  pthread_cond_init(&pool->not_full, NULL);
+
+  for (i = 0; i < n_threads; i++) {
+    if (pthread_create(&pool->threads[i], NULL, pool_run, pool) != 0) {
+      break;
+    }
+    pool->n_threads++;
+  }
+
+  if (pool->n_threads == 0) {
+    fprintf(stderr, "Failed to start worker threads\n");
+    pool_finish(pool);
+    return MYTAR_ERR_IO;
+  }
+
+  return MYTAR_OK;
+}
+
+/* Queues a task, waiting for room if the queue is full */
+void pool_submit(Pool *pool, void *task) {
+  pthread_mutex_lock(&pool->lock);
+  while (pool->count == pool->capacity) {
+    pthread_cond_wait(&pool->not_full, &pool->lock);
+  }
+
+  pool->tasks[(pool->head + pool->count) % pool->capacity] = task;
+  pool->count++;
+  pthread_cond_signal(&pool->not_empty);
+  pthread_mutex_unlock(&pool->lock);
+}
+
+/* Runs every queued task to completion, then stops and frees the pool */
+void pool_finish(Pool *pool) {
+  int i;
+
+  pthread_mutex_lock(&pool->lock);
+  pool->closing = true;
+  pthread_cond_broadcast(&pool->not_empty);
+  pthread_mutex_unlock(&pool->lock);
+
+  for (i = 0; i < pool->n_threads; i++) {
+    pthread_join(pool->threads[i], NULL);
+  }
+
+  pthread_mutex_destroy(&pool->lock);
+  pthread_cond_destroy(&pool->not_empty);
+  pthread_cond_destroy(&pool->not_full);
+  free(pool->tasks);
+  free(pool->threads);
+}
@@ -0,0 +1,34 @@
+#ifndef POOL
+#define POOL
+
+#include <pthread.h>
+#include <stdbool.h>
+
+/* runs one task on a worker thread, the pool does not free tasks */
+typedef void (*pool_fn)(void *task, void *ctx);
+
+typedef struct {
+  pthread_t *threads;
+  int n_threads;
+
+  /* bounded ring of pending tasks, so submitters wait on slow workers */
+  void **tasks;
+  long head;
+  long count;
+  long capacity;
+  bool closing;
+
+  pthread_mutex_t lock;
+  pthread_cond_t not_empty;
+  pthread_cond_t not_full;
+
+  pool_fn fn;
+  void *ctx;
+} Pool;
+
+int pool_init(Pool *pool, int n_threads, long capacity, pool_fn fn,
+              void *ctx);
+void pool_submit(Pool *pool, void *task);
+void pool_finish(Pool *pool);
+
+#endif
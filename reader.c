@@ -7,8 +7,12 @@
  */
 
 #include "reader.h"
+#include "digest.h"
 #include "header.h"
+#include "io.h"
+#include "libmytar.h"
 #include "mytar.h"
+#include "throttle.h"
 #include "writer.h"
 #include <asm-generic/errno-base.h>
 #include <errno.h>
@@ -19,128 +23,393 @@
 #include <string.h>
 #include <unistd.h>
 
-/* The header will contain the current parsed files header, and file_buf will
- * contain any file contents. */
+/* The entry's header will contain the current parsed files header. */
 
 void reader_init(Reader *reader, bool strict) {
 
   reader->src_fd = 0;
   reader->dst_fd = 1;
+  reader->is_seekable = false;
 
   reader->current_entry = NULL;
   reader->is_strict = strict;
+  reader->stats = NULL;
+  reader->data_read = 0;
+
+  reader->buf = NULL;
+  reader->record_size = BUFFER_SIZE;
+  reader->buf_pos = 0;
+  reader->buf_len = 0;
+}
+
+/* Sets the size of the reads the archive is consumed in, in blocks. Must be
+ * called before anything is read. */
+void reader_set_record(Reader *reader, int blocks) {
+  reader->record_size = (size_t)blocks * USTAR_BLOCK;
+}
+
+/* Frees the reader's entry and buffer. A seekable archive is moved back to
+ * just after the last byte consumed, leaving it where an unbuffered reader
+ * would have. */
+void reader_free(Reader *reader) {
+  if (reader->is_seekable && reader->buf_len > reader->buf_pos) {
+    lseek(reader->src_fd, -(off_t)(reader->buf_len - reader->buf_pos),
+          SEEK_CUR);
+  }
+
+  free(reader->buf);
+  reader->buf = NULL;
+  reader->buf_pos = 0;
+  reader->buf_len = 0;
+
+  free_entry(reader->current_entry);
+  reader->current_entry = NULL;
+}
+
+/* Returns the number of bytes read ahead and not consumed yet */
+static size_t reader_buffered(const Reader *reader) {
+  return reader->buf_len - reader->buf_pos;
+}
+
+/* Replaces the empty buffer with the next record of the archive. Returns the
+ * number of bytes read, 0 at the end of the archive, or -1. */
+static ssize_t reader_fill(Reader *reader) {
+  ssize_t bytes_read;
+
+  if (reader->buf == NULL &&
+      (reader->buf = malloc(reader->record_size)) == NULL) {
+    return -1;
+  }
+
+  do {
+    stats_syscall(reader->stats, SYS_READ);
+    bytes_read = read(reader->src_fd, reader->buf, reader->record_size);
+  } while (bytes_read == -1 && errno == EINTR);
+
+  reader->buf_pos = 0;
+  reader->buf_len = bytes_read > 0 ? bytes_read : 0;
+  return bytes_read;
+}
+
+/* Hands the read-ahead back to a seekable archive, so the next read starts
+ * right after the last byte consumed */
+static int reader_unread(Reader *reader) {
+  if (reader_buffered(reader) == 0) {
+    return MYTAR_OK;
+  }
+
+  stats_syscall(reader->stats, SYS_LSEEK);
+  if (lseek(reader->src_fd, -(off_t)reader_buffered(reader), SEEK_CUR) ==
+      -1) {
+    return MYTAR_ERR_IO;
+  }
+
+  reader->buf_pos = reader->buf_len = 0;
+  return MYTAR_OK;
+}
+
+/* Reads len bytes of the archive into buf, fewer only at its end. Returns
+ * the number of bytes read, or -1. */
+ssize_t reader_read(Reader *reader, void *buf, size_t len) {
+  unsigned char *p = buf;
+  size_t total = 0;
+  size_t chunk;
+  ssize_t bytes_read;
+
+  while (total < len) {
+    if (reader_buffered(reader) == 0) {
+      /* whole records are read straight into place */
+      if (len - total >= reader->record_size) {
+        bytes_read =
+            io_read_full(reader->src_fd, p + total, len - total, reader->stats);
+        return bytes_read == -1 ? -1 : (ssize_t)total + bytes_read;
+      }
+
+      if ((bytes_read = reader_fill(reader)) <= 0) {
+        return bytes_read == 0 ? (ssize_t)total : -1;
+      }
+    }
+
+    chunk = reader_buffered(reader);
+    if (chunk > len - total) {
+      chunk = len - total;
+    }
+
+    memcpy(p + total, reader->buf + reader->buf_pos, chunk);
+    reader->buf_pos += chunk;
+    total += chunk;
+  }
+
+  return total;
+}
+
+/* Copies len bytes of the archive to dst_fd, or only hashes them when dst_fd
+ * is -1, adding them to crc unless it is NULL. Runs of a record or more go
+ * through io_copy; in a seekable archive they start from their true offset,
+ * so clones and copy_file_range line up with the destination. Returns the
+ * number of bytes copied, fewer at the end of the archive, or -1. */
+off_t reader_copy(Reader *reader, int dst_fd, off_t len, uint32_t *crc) {
+  off_t total = 0;
+  off_t copied;
+  size_t chunk;
+  ssize_t bytes_read;
+
+  if (reader->is_seekable && len >= reader->record_size &&
+      reader_unread(reader) != MYTAR_OK) {
+    return -1;
+  }
+
+  while (total < len) {
+    if (reader_buffered(reader) == 0 && len - total >= reader->record_size) {
+      copied = crc != NULL ? io_copy_crc32c(reader->src_fd, dst_fd,
+                                            len - total, crc, reader->stats)
+                           : io_copy(reader->src_fd, dst_fd, len - total,
+                                     reader->stats);
+      return copied == -1 ? -1 : total + copied;
+    }
+
+    if (reader_buffered(reader) == 0 &&
+        (bytes_read = reader_fill(reader)) <= 0) {
+      return bytes_read == 0 ? total : -1;
+    }
+
+    chunk = reader_buffered(reader);
+    if (chunk > len - total) {
+      chunk = len - total;
+    }
+
+    if (crc != NULL) {
+      *crc = crc32c(*crc, reader->buf + reader->buf_pos, chunk);
+    }
+    if (dst_fd != -1) {
+      throttle_take(chunk, reader->stats);
+      if (io_write_full(dst_fd, reader->buf + reader->buf_pos, chunk,
+                        reader->stats) != MYTAR_OK) {
+        return -1;
+      }
+    }
+
+    reader->buf_pos += chunk;
+    total += chunk;
+  }
+
+  return total;
+}
+
+/* Sets the archive fd, and records whether skips may use lseek */
+void reader_set_src(Reader *reader, int fd) {
+  reader->src_fd = fd;
+  reader->is_seekable = io_is_seekable(fd);
+}
+
+/* Returns the archive offset the reader has got to, or -1 if the archive
+ * cannot seek */
+off_t reader_offset(Reader *reader) {
+  if (!reader->is_seekable) {
+    return -1;
+  }
+
+  stats_syscall(reader->stats, SYS_LSEEK);
+  return lseek(reader->src_fd, 0, SEEK_CUR) - reader_buffered(reader);
+}
+
+/* Moves forward len bytes in the archive. What is already buffered is
+ * consumed first, and a seekable archive only seeks when the skip goes
+ * beyond the next record, which is otherwise read to serve what follows.
+ * Archives that cannot seek, such as pipes and sockets, have the bytes read
+ * and discarded. Skipping past the end of the archive is left to the next
+ * header read to notice. */
+static int reader_skip(Reader *reader, off_t len) {
+  size_t chunk;
+  ssize_t bytes_read;
+
+  while (len > 0) {
+    if (reader_buffered(reader) == 0 && reader->is_seekable &&
+        len >= reader->record_size) {
+      stats_syscall(reader->stats, SYS_LSEEK);
+      if (lseek(reader->src_fd, len, SEEK_CUR) == -1) {
+        perror("Lseek failed when reading.");
+        return MYTAR_ERR_IO;
+      }
+      return MYTAR_OK;
+    }
+
+    if (reader_buffered(reader) == 0 &&
+        (bytes_read = reader_fill(reader)) <= 0) {
+      if (bytes_read == 0) {
+        return MYTAR_OK;
+      }
+      perror("Failed to skip archive contents");
+      return MYTAR_ERR_IO;
+    }
+
+    chunk = reader_buffered(reader);
+    if (chunk > len) {
+      chunk = len;
+    }
+    reader->buf_pos += chunk;
+    len -= chunk;
+  }
+
+  return MYTAR_OK;
 }
 
 /* Given a valid tar file this will:
- * Read the header into header parameter, and read file contents into file buf.
+ * Copy the current member's contents to dst_fd, and skip its padding. If the
+ * member has a digest it is checked on the way, and MYTAR_ERR_DIGEST is
+ * returned on a mismatch. A dst_fd of -1 only checks the digest.
  */
-void reader_translate_to_file(Reader *reader) {
+int reader_translate_to_file(Reader *reader) {
 
+  Entry *entry = reader->current_entry;
+  uint32_t crc = 0;
+  bool verify;
   char *endptr;
-  long size =
-      strtol((char *)reader->current_entry->header->size, &endptr, OCTAL_SIZE);
-  long handeled = 0;
-  int bytes_read;
+  long size;
   int delta = 0;
-  int read_size;
+  off_t copied;
+  double start = stats_now();
+
   errno = 0;
+  size =
+      strtol((char *)reader->current_entry->header->size, &endptr, OCTAL_SIZE);
 
   if (errno != 0) {
     perror("strtol");
-    exit(EXIT_FAILURE);
+    return MYTAR_ERR_FORMAT;
   }
 
   if (endptr == (char *)reader->current_entry->header->size) {
     fprintf(stderr, "No digits were found\n");
-    exit(EXIT_FAILURE);
+    return MYTAR_ERR_FORMAT;
   }
 
   if (size % USTAR_BLOCK != 0) {
     delta = USTAR_BLOCK - (size % USTAR_BLOCK);
-    size += delta;
   }
 
-  while (handeled != size) {
+  /* a digest can only be checked over the whole member, and hashing needs
+   * the data in user space, so only then is the zero-copy path given up */
+  verify = entry->has_digest && reader->data_read == 0;
+  copied = reader_copy(reader, reader->dst_fd, size - reader->data_read,
+                       verify ? &crc : NULL);
 
-    /* if this is the last iteration, lets not read in any padding */
-    read_size =
-        handeled + USTAR_BLOCK == size ? USTAR_BLOCK - delta : USTAR_BLOCK;
+  if (copied == -1) {
+    perror("failed to copy member when extracting: ");
+    return MYTAR_ERR_IO;
+  }
 
-    bytes_read =
-        read(reader->src_fd, reader->current_entry->file_buf, read_size);
+  if (copied != size - reader->data_read) {
+    fprintf(stderr, "Unexpected end of archive\n");
+    return MYTAR_ERR_FORMAT;
+  }
 
-    if (bytes_read == -1) {
-      perror("failed to read src fd in when tranlating file: ");
-      handeled += USTAR_BLOCK;
-      continue;
-    }
+  if (verify && crc != entry->digest) {
+    return MYTAR_ERR_DIGEST;
+  }
 
-    if (write(reader->dst_fd, reader->current_entry->file_buf, read_size) ==
-        -1) {
-      perror("failed to write to destination when extracting: ");
-    }
+  reader->data_read = size;
 
-    handeled += USTAR_BLOCK;
-  }
   /* in case we dont read the entire block */
-  if (lseek(reader->src_fd, delta, SEEK_CUR) == -1) {
-    perror("Lseek failed when reading.");
-    exit(EXIT_FAILURE);
+  if (reader_skip(reader, delta) != MYTAR_OK) {
+    return MYTAR_ERR_IO;
   }
+
+  stats_phase(reader->stats, PHASE_COPY, start);
+  return MYTAR_OK;
+}
+
+/* Checks the current member's contents against its digest without writing
+ * them anywhere. Members without a digest are skipped. */
+int reader_verify_contents(Reader *reader) {
+  if (!reader->current_entry->has_digest) {
+    return reader_skip_file_contents(reader);
+  }
+
+  reader->dst_fd = -1;
+  return reader_translate_to_file(reader);
 }
 
 /* Returns true if the end of the archive is reached */
 bool is_end_of_archive(TarHeader *header) {
-  static bool is_zero_header_initialized = false;
-  static TarHeader zero_header;
-
-  if (!is_zero_header_initialized) {
-    memset(&zero_header, 0, sizeof(TarHeader));
-    is_zero_header_initialized = true;
-  }
+  static const TarHeader zero_header;
 
   return memcmp(header, &zero_header, sizeof(TarHeader)) == 0;
 }
 
-/* Skips the file contents that follows a header */
-void reader_skip_file_contents(Reader *reader) {
+/* Skips the file contents that follows a header, minus anything already
+ * consumed with reader_read_contents */
+int reader_skip_file_contents(Reader *reader) {
   long size;
   int delta;
-  int new_offset;
 
   size = strtol((char *)reader->current_entry->header->size, NULL, OCTAL_SIZE);
   delta = (size % USTAR_BLOCK == 0) ? 0 : USTAR_BLOCK - (size % USTAR_BLOCK);
-  new_offset = lseek(reader->src_fd, size + delta, SEEK_CUR);
 
-  if (new_offset == -1) {
-    perror("Failed to skip file contents in reader_cycle_entry");
-    exit(EXIT_FAILURE);
+  if (reader_skip(reader, size - reader->data_read + delta) != MYTAR_OK) {
+    fprintf(stderr, "Failed to skip file contents in reader_cycle_entry\n");
+    return MYTAR_ERR_IO;
   }
+
+  reader->data_read = size;
+  return MYTAR_OK;
 }
 
-/* Returns true if a header's checksum is valid, false if not */
-bool is_valid_checksum(TarHeader *header) {
+/* Reads up to len bytes of the current member's contents into buf. Returns the
+ * number of bytes read, 0 once the member is exhausted, or an error code. */
+ssize_t reader_read_contents(Reader *reader, void *buf, size_t len) {
+  long size;
+  ssize_t bytes_read;
 
-  TarHeader *copied_header = malloc(sizeof(TarHeader));
-  unsigned char *header_loc = (unsigned char *)header;
-  long expected_checksum = strtol((char *)header->chksum, NULL, OCTAL_SIZE);
-  int i;
-  long actual_checksum = 0;
-  bool result;
+  size = strtol((char *)reader->current_entry->header->size, NULL, OCTAL_SIZE);
+  if (len > size - reader->data_read) {
+    len = size - reader->data_read;
+  }
 
-  memcpy(copied_header, header, sizeof(TarHeader));
-  memset(copied_header->chksum, ' ', sizeof(copied_header->chksum));
+  if (len == 0) {
+    return 0;
+  }
 
-  memset(header->chksum, ' ', sizeof(header->chksum));
+  /* whatever is buffered, or else a single read */
+  if (reader_buffered(reader) > 0 || len < reader->record_size) {
+    if (reader_buffered(reader) == 0 && reader_fill(reader) == -1) {
+      perror("Failed to read member contents");
+      return MYTAR_ERR_IO;
+    }
+
+    bytes_read = reader_buffered(reader) < len ? reader_buffered(reader) : len;
+    memcpy(buf, reader->buf + reader->buf_pos, bytes_read);
+    reader->buf_pos += bytes_read;
+  } else {
+    stats_syscall(reader->stats, SYS_READ);
+    if ((bytes_read = read(reader->src_fd, buf, len)) == -1) {
+      perror("Failed to read member contents");
+      return MYTAR_ERR_IO;
+    }
+  }
+
+  reader->data_read += bytes_read;
+  return bytes_read;
+}
+
+/* Returns true if a header's checksum is valid, false if not. The checksum
+ * field itself is summed as if it were all spaces. */
+bool is_valid_checksum(const TarHeader *header) {
+
+  const unsigned char *header_loc = (const unsigned char *)header;
+  long expected_checksum = strtol((char *)header->chksum, NULL, OCTAL_SIZE);
+  int i;
+  long actual_checksum = ' ' * sizeof(header->chksum);
 
   for (i = 0; i < sizeof(TarHeader); i++) {
     actual_checksum += header_loc[i];
   }
 
-  result = actual_checksum == expected_checksum;
-  free(copied_header);
+  for (i = 0; i < sizeof(header->chksum); i++) {
+    actual_checksum -= header->chksum[i];
+  }
 
-  return result;
+  return actual_checksum == expected_checksum;
 }
 
 void free_entry(Entry *entry) {
@@ -151,62 +420,122 @@ void free_entry(Entry *entry) {
   }
 }
 
+/* Reads the records of a PAX extended header, and the padding after them.
+ * The digest found in an 'x' header applies to the member that follows. */
+static int reader_read_pax(Reader *reader, TarHeader *header, bool *has_digest,
+                           uint32_t *digest) {
+  long size = strtol((char *)header->size, NULL, OCTAL_SIZE);
+  long padded = (size + USTAR_BLOCK - 1) / USTAR_BLOCK * USTAR_BLOCK;
+  char *records;
+
+  if (size < 0 || size > PAX_MAX) {
+    fprintf(stderr, "Extended header too large.\n");
+    return MYTAR_ERR_FORMAT;
+  }
+
+  if ((records = malloc(padded + 1)) == NULL) {
+    return MYTAR_ERR_NOMEM;
+  }
+
+  if (reader_read(reader, records, padded) != padded) {
+    free(records);
+    fprintf(stderr, "Unexpected end of archive\n");
+    return MYTAR_ERR_FORMAT;
+  }
+  records[size] = '\0';
+
+  if (header->typeflag == 'x') {
+    *has_digest = digest_parse(records, size, digest);
+  }
+
+  free(records);
+  return MYTAR_OK;
+}
+
 /* This function reads an entry into the reader's entry attribute and frees the
  * previous entry if needed. It will not automatically skip a files content, and
  * thus files can be processed using translate or skipped using skip functions
- * respectively.*/
+ * respectively. PAX extended headers are consumed on the way and never become
+ * the current entry. Returns 1 for an entry, 0 at the end of the archive,
+ * MYTAR_ERR_STRICT for a non-compliant entry in strict mode, or another error
+ * code.*/
 int reader_cycle_entry(Reader *reader) {
   int bytes_read;
   TarHeader temp_header;
   Entry *new_entry = malloc(sizeof(Entry));
   TarHeader *new_header;
+  int err;
 
   if (new_entry == NULL) {
     fprintf(stderr, "Failed to allocate memory for new_entry.");
-    exit(EXIT_FAILURE);
+    return MYTAR_ERR_NOMEM;
   }
+  new_entry->has_digest = false;
 
-  bytes_read = read(reader->src_fd, &temp_header, sizeof(TarHeader));
+  for (;;) {
+    bytes_read = reader_read(reader, &temp_header, sizeof(TarHeader));
 
-  if (bytes_read == -1) {
-    free(new_entry);
-    perror("Failed to read tar file when populating header.");
-    exit(EXIT_FAILURE);
-  }
+    if (bytes_read == -1) {
+      free(new_entry);
+      perror("Failed to read tar file when populating header.");
+      return MYTAR_ERR_IO;
+    }
 
-  if (is_end_of_archive(&temp_header)) {
-    free_entry(reader->current_entry);
-    free(new_entry);
-    return 0;
-  }
+    if (bytes_read != 0 && bytes_read != sizeof(TarHeader)) {
+      free(new_entry);
+      fprintf(stderr, "Unexpected end of archive\n");
+      return MYTAR_ERR_FORMAT;
+    }
 
-  if (!is_valid_checksum(&temp_header)) {
-    free(new_entry);
-    fprintf(stderr, "Failed checksum. Exiting.\n");
-    exit(EXIT_FAILURE);
+    /* a truncated archive ends like an empty one */
+    if (bytes_read == 0 || is_end_of_archive(&temp_header)) {
+      free_entry(reader->current_entry);
+      reader->current_entry = NULL;
+      free(new_entry);
+      return 0;
+    }
+
+    if (!is_valid_checksum(&temp_header)) {
+      free(new_entry);
+      fprintf(stderr, "Failed checksum.\n");
+      return MYTAR_ERR_FORMAT;
+    }
+
+    if (temp_header.typeflag != 'x' && temp_header.typeflag != 'g') {
+      break;
+    }
+
+    stats_entry(reader->stats, &temp_header);
+    if ((err = reader_read_pax(reader, &temp_header, &new_entry->has_digest,
+                               &new_entry->digest)) != MYTAR_OK) {
+      free(new_entry);
+      return err;
+    }
   }
 
   new_header = malloc(sizeof(TarHeader));
   if (new_header == NULL) {
     free(new_entry);
     fprintf(stderr, "Failed to allocate memory for new_header.");
-    exit(EXIT_FAILURE);
+    return MYTAR_ERR_NOMEM;
   }
 
   memcpy(new_header, &temp_header, sizeof(TarHeader));
 
+  free_entry(reader->current_entry);
+
+  new_entry->header = new_header;
+  reader->current_entry = new_entry;
+  reader->data_read = 0;
+  stats_entry(reader->stats, new_header);
+
+  /* the rejected entry stays current so its contents can be skipped */
   if (reader->is_strict) {
     if (strcmp((char *)new_header->magic, "ustar") != 0 ||
         new_header->version[0] != '0' || new_header->version[1] != '0') {
-      free(new_entry);
-      free(new_header);
-      return -1;
+      return MYTAR_ERR_STRICT;
     }
   }
 
-  free_entry(reader->current_entry);
-
-  new_entry->header = new_header;
-  reader->current_entry = new_entry;
   return 1;
 }
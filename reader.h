@@ -1,13 +1,22 @@
 #include "header.h"
+#include "stats.h"
 #include "writer.h"
 #include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
 
 #ifndef READER
 #define READER
 
+/* largest PAX extended header that is read into memory */
+#define PAX_MAX 1048576
+
 typedef struct {
   TarHeader *header;
-  unsigned char file_buf[USTAR_BLOCK];
+
+  /* CRC32C of the contents, from the PAX header before this entry */
+  bool has_digest;
+  uint32_t digest;
 } Entry;
 
 typedef struct {
@@ -15,14 +24,36 @@ typedef struct {
   int src_fd;
   int dst_fd;
   bool is_strict;
+  bool is_seekable;
   Entry *current_entry;
+  Stats *stats;
+
+  /* bytes of the current member consumed by reader_read_contents */
+  long data_read;
+
+  /* the archive is read a record at a time, and headers and small members
+   * are served from buf[buf_pos, buf_len) */
+  unsigned char *buf;
+  size_t record_size;
+  size_t buf_pos;
+  size_t buf_len;
 
 } Reader;
 
 void reader_init(Reader *reader, bool strict);
-void reader_translate_to_file(Reader *reader);
+void reader_set_src(Reader *reader, int fd);
+void reader_set_record(Reader *reader, int blocks);
+void reader_free(Reader *reader);
+off_t reader_offset(Reader *reader);
+ssize_t reader_read(Reader *reader, void *buf, size_t len);
+off_t reader_copy(Reader *reader, int dst_fd, off_t len, uint32_t *crc);
+int reader_translate_to_file(Reader *reader);
+int reader_verify_contents(Reader *reader);
 bool is_end_of_archive(TarHeader *header);
+bool is_valid_checksum(const TarHeader *header);
 int reader_cycle_entry(Reader *reader);
-void reader_skip_file_contents(Reader *reader);
+int reader_skip_file_contents(Reader *reader);
+ssize_t reader_read_contents(Reader *reader, void *buf, size_t len);
+void free_entry(Entry *entry);
 
 #endif
@@ -0,0 +1,239 @@
+/* restore.c
+ * This file restores the metadata of extracted members. Regular files get
+ * their mtime, and with p their exact mode and with --same-owner their owner,
+ * set through the descriptor they were just written with, so no path is
+ * looked up again. Directories are queued instead: creating their entries
+ * would change their mtime, and a read-only mode could stop those entries
+ * from being created at all. The queue is applied deepest first once the
+ * extraction completes. Owners that cannot be restored are reported, and
+ * fail the run at the end rather than stopping it.
+ */
+#define _GNU_SOURCE
+
+#include "restore.h"
+#include "libmytar.h"
+#include "mytar.h"
+#include <fcntl.h>
+#include <grp.h>
+#include <pwd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define RESTORE_LOOKUP_BUF 4096
+
+void restorer_init(Restorer *restorer, bool preserve, bool same_owner) {
+  restorer->preserve = preserve;
+  restorer->same_owner = same_owner;
+  restorer->umask = umask(0);
+  umask(restorer->umask);
+
+  restorer->uname[0] = '\0';
+  restorer->header_uid = 0;
+  restorer->uid = 0;
+  restorer->gname[0] = '\0';
+  restorer->header_gid = 0;
+  restorer->gid = 0;
+
+  restorer->dirs = NULL;
+  restorer->n_dirs = 0;
+  restorer->dirs_capacity = 0;
+  restorer->err = MYTAR_OK;
+}
+
+/* Resolves the member's owner by name, as tar does, falling back to the
+ * numeric id when the name is unknown here. Archives rarely have more than a
+ * few owners, so the last lookup is remembered. It is keyed on the name and
+ * the id together, as the fallback depends on both. */
+static void restorer_owner(Restorer *restorer, const TarHeader *header,
+                           uid_t *uid, gid_t *gid) {
+  struct passwd owner;
+  struct group group;
+  struct passwd *owner_info = NULL;
+  struct group *group_info = NULL;
+  char buf[RESTORE_LOOKUP_BUF];
+  char name[33];
+  uid_t header_uid = extract_id(header->uid, sizeof(header->uid));
+  gid_t header_gid = extract_id(header->gid, sizeof(header->gid));
+
+  memcpy(name, header->uname, sizeof(header->uname));
+  name[sizeof(header->uname)] = '\0';
+  if (name[0] == '\0' || strcmp(name, restorer->uname) != 0 ||
+      header_uid != restorer->header_uid) {
+    if (name[0] != '\0') {
+      getpwnam_r(name, &owner, buf, sizeof(buf), &owner_info);
+    }
+    restorer->uid = owner_info != NULL ? owner_info->pw_uid : header_uid;
+    restorer->header_uid = header_uid;
+    strcpy(restorer->uname, name);
+  }
+
+  memcpy(name, header->gname, sizeof(header->gname));
+  name[sizeof(header->gname)] = '\0';
+  if (name[0] == '\0' || strcmp(name, restorer->gname) != 0 ||
+      header_gid != restorer->header_gid) {
+    if (name[0] != '\0') {
+      getgrnam_r(name, &group, buf, sizeof(buf), &group_info);
+    }
+    restorer->gid = group_info != NULL ? group_info->gr_gid : header_gid;
+    restorer->header_gid = header_gid;
+    strcpy(restorer->gname, name);
+  }
+
+  *uid = restorer->uid;
+  *gid = restorer->gid;
+}
+
+/* The mode a member ends up with: exact under p, otherwise its permission
+ * bits less the umask */
+static mode_t restorer_mode(Restorer *restorer, const TarHeader *header) {
+  mode_t mode = strtol((const char *)header->mode, NULL, OCTAL_SIZE);
+
+  if (restorer->preserve) {
+    return mode & 07777;
+  }
+  return mode & 0777 & ~restorer->umask;
+}
+
+static void restorer_failed(Restorer *restorer, const char *what,
+                            const char *path) {
+  fprintf(stderr, "Cannot restore %s of %s: ", what, path);
+  perror(NULL);
+  restorer->err = MYTAR_ERR_IO;
+}
+
+static void mtime_times(const TarHeader *header, struct timespec times[2]) {
+  times[0].tv_sec = 0;
+  times[0].tv_nsec = UTIME_OMIT;
+  times[1].tv_sec = strtol((const char *)header->mtime, NULL, OCTAL_SIZE);
+  times[1].tv_nsec = 0;
+}
+
+/* Restores a regular file's metadata through fd, which it was written with.
+ * The owner goes first, since a chown clears the set-id bits. */
+void restorer_file(Restorer *restorer, int fd, const TarHeader *header,
+                   const char *path) {
+  struct timespec times[2];
+  uid_t uid;
+  gid_t gid;
+
+  if (restorer->same_owner) {
+    restorer_owner(restorer, header, &uid, &gid);
+    if (fchown(fd, uid, gid) == -1) {
+      restorer_failed(restorer, "owner", path);
+    }
+  }
+
+  if (restorer->preserve &&
+      fchmod(fd, restorer_mode(restorer, header)) == -1) {
+    restorer_failed(restorer, "mode", path);
+  }
+
+  mtime_times(header, times);
+  if (futimens(fd, times) == -1) {
+    restorer_failed(restorer, "mtime", path);
+  }
+}
+
+/* Restores a symlink's owner and mtime, which apply to the link itself */
+void restorer_link(Restorer *restorer, const TarHeader *header,
+                   const char *path) {
+  struct timespec times[2];
+  uid_t uid;
+  gid_t gid;
+
+  if (restorer->same_owner) {
+    restorer_owner(restorer, header, &uid, &gid);
+    if (lchown(path, uid, gid) == -1) {
+      restorer_failed(restorer, "owner", path);
+    }
+  }
+
+  mtime_times(header, times);
+  if (utimensat(AT_FDCWD, path, times, AT_SYMLINK_NOFOLLOW) == -1) {
+    restorer_failed(restorer, "mtime", path);
+  }
+}
+
+/* Queues a directory's metadata until restorer_finish */
+int restorer_defer_dir(Restorer *restorer, const TarHeader *header,
+                       const char *path) {
+  DeferredDir *grown;
+  DeferredDir *dir;
+  const char *p;
+
+  if (restorer->n_dirs == restorer->dirs_capacity) {
+    restorer->dirs_capacity =
+        restorer->dirs_capacity ? restorer->dirs_capacity * 2 : 64;
+    grown =
+        realloc(restorer->dirs, restorer->dirs_capacity * sizeof(DeferredDir));
+    if (grown == NULL) {
+      return MYTAR_ERR_NOMEM;
+    }
+    restorer->dirs = grown;
+  }
+
+  dir = &restorer->dirs[restorer->n_dirs];
+  if ((dir->path = malloc(strlen(path) + 1)) == NULL) {
+    return MYTAR_ERR_NOMEM;
+  }
+  strcpy(dir->path, path);
+
+  /* a trailing slash does not make a directory any deeper */
+  dir->depth = 0;
+  for (p = path; *p != '\0'; p++) {
+    dir->depth += *p == '/' && p[1] != '\0';
+  }
+
+  dir->mode = restorer_mode(restorer, header);
+  dir->mtime = strtol((const char *)header->mtime, NULL, OCTAL_SIZE);
+  if (restorer->same_owner) {
+    restorer_owner(restorer, header, &dir->uid, &dir->gid);
+  }
+
+  restorer->n_dirs++;
+  return MYTAR_OK;
+}
+
+static int deeper_first(const void *a, const void *b) {
+  return ((const DeferredDir *)b)->depth - ((const DeferredDir *)a)->depth;
+}
+
+/* Applies the queued directory metadata, children before their parents, so
+ * no directory's mtime is disturbed once it is set. Returns the first
+ * failure of the whole extraction. */
+int restorer_finish(Restorer *restorer) {
+  struct timespec times[2];
+  DeferredDir *dir;
+  long i;
+
+  qsort(restorer->dirs, restorer->n_dirs, sizeof(DeferredDir), deeper_first);
+
+  for (i = 0; i < restorer->n_dirs; i++) {
+    dir = &restorer->dirs[i];
+
+    if (restorer->same_owner && chown(dir->path, dir->uid, dir->gid) == -1) {
+      restorer_failed(restorer, "owner", dir->path);
+    }
+    if (chmod(dir->path, dir->mode) == -1) {
+      restorer_failed(restorer, "mode", dir->path);
+    }
+
+    times[0].tv_sec = 0;
+    times[0].tv_nsec = UTIME_OMIT;
+    times[1].tv_sec = dir->mtime;
+    times[1].tv_nsec = 0;
+    if (utimensat(AT_FDCWD, dir->path, times, 0) == -1) {
+      restorer_failed(restorer, "mtime", dir->path);
+    }
+
+    free(dir->path);
+  }
+
+  free(restorer->dirs);
+  restorer->dirs = NULL;
+  restorer->n_dirs = 0;
+  return restorer->err;
+}
@@ -0,0 +1,50 @@
+#ifndef RESTORE
+#define RESTORE
+
+#include "header.h"
+#include <stdbool.h>
+#include <sys/types.h>
+#include <time.h>
+
+/* the metadata of one directory, applied once the extraction is done */
+typedef struct {
+  char *path;
+  int depth;
+  mode_t mode;
+  uid_t uid;
+  gid_t gid;
+  time_t mtime;
+} DeferredDir;
+
+typedef struct {
+  bool preserve;
+  bool same_owner;
+  mode_t umask;
+
+  /* the last owner and group names looked up with the ids in their header,
+   * and what they resolved to */
+  char uname[33];
+  uid_t header_uid;
+  uid_t uid;
+  char gname[33];
+  gid_t header_gid;
+  gid_t gid;
+
+  DeferredDir *dirs;
+  long n_dirs;
+  long dirs_capacity;
+
+  /* the first failure, reported once everything else is restored */
+  int err;
+} Restorer;
+
+void restorer_init(Restorer *restorer, bool preserve, bool same_owner);
+void restorer_file(Restorer *restorer, int fd, const TarHeader *header,
+                   const char *path);
+void restorer_link(Restorer *restorer, const TarHeader *header,
+                   const char *path);
+int restorer_defer_dir(Restorer *restorer, const TarHeader *header,
+                       const char *path);
+int restorer_finish(Restorer *restorer);
+
+#endif
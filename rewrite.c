@@ -0,0 +1,318 @@
+/* rewrite.c
+ * This file implements --rewrite OUT, which copies the members of one archive,
+ * or of a z archive, into an uncompressed one without extracting them. Members
+ * are filtered like on list and extract, their names go through
+ * --strip-components and --rename, and each header is regenerated with the
+ * new name. The data behind it is copied from archive to archive with io_copy,
+ * padding included, so between two regular files it never leaves the kernel.
+ * Members small enough to fit in the record being built are read into it
+ * instead, so runs of small members are written out a record at a time.
+ * Digests carried in PAX headers are written again in front of the member
+ * they belong to.
+ */
+
+#include "rewrite.h"
+#include "archive.h"
+#include "gz.h"
+#include "header.h"
+#include "io.h"
+#include "libmytar.h"
+#include "reader.h"
+#include "throttle.h"
+#include "writer.h"
+#include <fcntl.h>
+#include <linux/limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+extern int ftruncate(int fd, off_t length);
+
+/* Rewrites path in place with --strip-components and --rename. Returns false
+ * if nothing is left of it, in which case the member is dropped. */
+static bool rewrite_name(const Flags *flags, char *path) {
+  char renamed[PATH_MAX];
+  const char *rest = path;
+  size_t len;
+  int i;
+
+  for (i = 0; i < flags->strip_components; i++) {
+    if ((rest = strchr(rest, '/')) == NULL) {
+      return false;
+    }
+    rest++;
+  }
+  memmove(path, rest, strlen(rest) + 1);
+
+  if (flags->rename_from != NULL) {
+    len = strlen(flags->rename_from);
+    if (strncmp(path, flags->rename_from, len) == 0 &&
+        (path[len] == '\0' || path[len] == '/')) {
+      rest = path + len;
+
+      /* renaming to nothing drops the prefix and the slash after it */
+      if (flags->rename_to[0] == '\0' && *rest == '/') {
+        rest++;
+      }
+
+      if (strlen(flags->rename_to) + strlen(rest) >= sizeof(renamed)) {
+        return false;
+      }
+      strcpy(renamed, flags->rename_to);
+      strcat(renamed, rest);
+      strcpy(path, renamed);
+    }
+  }
+
+  return path[0] != '\0' && strcmp(path, "/") != 0;
+}
+
+/* Reads the current member's data and padding into the writer's buffer */
+static int rewrite_buffered(Reader *reader, Writer *writer, long size,
+                            off_t padded, double start) {
+  ssize_t bytes_read;
+
+  throttle_take(padded, reader->stats);
+  bytes_read =
+      reader_read(reader, writer->buf + get_buffer_index(writer), padded);
+  stats_phase(reader->stats, PHASE_COPY, start);
+
+  if (bytes_read == -1) {
+    perror("Failed to copy member contents");
+    return MYTAR_ERR_IO;
+  }
+
+  if (bytes_read != padded) {
+    fprintf(stderr, "Unexpected end of archive\n");
+    return MYTAR_ERR_FORMAT;
+  }
+
+  writer->buffer_offset += padded / USTAR_BLOCK;
+  reader->data_read = size;
+
+  if (writer->buffer_offset == writer->record_blocks) {
+    return writer_flush(writer);
+  }
+  return MYTAR_OK;
+}
+
+/* Copies the current member's data and padding from the reader to the
+ * writer */
+static int rewrite_contents(Reader *reader, Writer *writer) {
+  long size;
+  off_t padded;
+  off_t copied;
+  double start = stats_now();
+
+  size = strtol((char *)reader->current_entry->header->size, NULL, OCTAL_SIZE);
+  padded = (size + USTAR_BLOCK - 1) / USTAR_BLOCK * USTAR_BLOCK;
+
+  if (padded <=
+      (writer->record_blocks - writer->buffer_offset) * USTAR_BLOCK) {
+    return rewrite_buffered(reader, writer, size, padded, start);
+  }
+
+  if (writer_flush(writer) != MYTAR_OK) {
+    return MYTAR_ERR_IO;
+  }
+
+  copied = reader_copy(reader, writer->dst_fd, padded, NULL);
+  stats_phase(reader->stats, PHASE_COPY, start);
+
+  if (copied == -1) {
+    perror("Failed to copy member contents");
+    return MYTAR_ERR_IO;
+  }
+
+  if (copied != padded) {
+    fprintf(stderr, "Unexpected end of archive\n");
+    return MYTAR_ERR_FORMAT;
+  }
+
+  writer->offset += copied;
+  reader->data_read = size;
+  return MYTAR_OK;
+}
+
+/* Writes the current member to the new archive under path */
+static int rewrite_entry(Flags *flags, Reader *reader, Writer *writer,
+                         char *path) {
+  Entry *entry = reader->current_entry;
+  TarHeader header;
+  char link_name[PATH_MAX];
+  int err;
+
+  if (!rewrite_name(flags, path)) {
+    return reader_skip_file_contents(reader);
+  }
+
+  memcpy(&header, entry->header, sizeof(TarHeader));
+  memset(header.name, 0, sizeof(header.name));
+  memset(header.prefix, 0, sizeof(header.prefix));
+  if ((err = populate_name(path, NULL, &header)) != MYTAR_OK) {
+    return err;
+  }
+
+  /* hard links name another member, which has been renamed as well */
+  if (header.typeflag == '1') {
+    memcpy(link_name, header.linkname, sizeof(header.linkname));
+    link_name[sizeof(header.linkname)] = '\0';
+    if (rewrite_name(flags, link_name) &&
+        strlen(link_name) <= sizeof(header.linkname)) {
+      memset(header.linkname, 0, sizeof(header.linkname));
+      memcpy(header.linkname, link_name, strlen(link_name));
+    }
+  }
+
+  populate_chksum(&header);
+  writer->header = &header;
+
+  if (entry->has_digest) {
+    err = writer_write_known_digest(writer, entry->digest);
+  } else if (header.typeflag == '0' || header.typeflag == '\0') {
+    err = writer_align(writer);
+  }
+  if (err != MYTAR_OK) {
+    return err;
+  }
+
+  if ((err = writer_write_header(writer)) != MYTAR_OK) {
+    return err;
+  }
+
+  if (flags->verbose) {
+    fprintf(writer->dst_fd == STDOUT_FILENO ? stderr : stdout, "%s\n", path);
+  }
+
+  return rewrite_contents(reader, writer);
+}
+
+static int rewrite_members(Flags *flags, Reader *reader, Writer *writer) {
+  char path[PATH_MAX];
+  int reader_status;
+  int err = MYTAR_OK;
+
+  while (err == MYTAR_OK && (reader_status = reader_cycle_entry(reader)) != 0) {
+
+    if (reader_status == MYTAR_ERR_STRICT) {
+      fprintf(stderr, "Encountered non-compliant entry. Skipping.\n");
+      err = reader_skip_file_contents(reader);
+      continue;
+    }
+
+    if (reader_status < 0) {
+      return reader_status;
+    }
+
+    memset(path, 0, sizeof(path));
+    extract_name(reader->current_entry->header, path);
+
+    if (path_matches(flags, path)) {
+      err = rewrite_entry(flags, reader, writer, path);
+    } else {
+      err = reader_skip_file_contents(reader);
+    }
+  }
+
+  if (err == MYTAR_OK && (err = writer_pad(writer)) == MYTAR_OK) {
+    err = writer_flush(writer);
+  }
+
+  return err;
+}
+
+/* Returns true if both fds are the same file, which rewriting would
+ * truncate before reading it */
+static bool same_file(int a, int b) {
+  struct stat a_stat;
+  struct stat b_stat;
+
+  return fstat(a, &a_stat) == 0 && fstat(b, &b_stat) == 0 &&
+         a_stat.st_dev == b_stat.st_dev && a_stat.st_ino == b_stat.st_ino &&
+         S_ISREG(a_stat.st_mode);
+}
+
+/* Copies the selected members of flags->tarfile into flags->rewrite */
+int rewrite_archive(Flags *flags) {
+  Reader reader;
+  Writer writer;
+  GzReader gz;
+  double start = stats_now();
+  int src_fd;
+  int dst_fd;
+  int err;
+  int gz_err;
+
+  if ((err = load_operands(flags)) != MYTAR_OK) {
+    return err;
+  }
+
+  if (strcmp(flags->tarfile, "-") == 0) {
+    src_fd = STDIN_FILENO;
+  } else {
+    stats_syscall(flags->stats, SYS_OPEN);
+    if ((src_fd = open(flags->tarfile, O_RDONLY)) == -1) {
+      perror("Could not open archive");
+      return MYTAR_ERR_IO;
+    }
+  }
+
+  /* opened without O_TRUNC, so the check below still sees the input */
+  if (strcmp(flags->rewrite, "-") == 0) {
+    dst_fd = STDOUT_FILENO;
+  } else {
+    stats_syscall(flags->stats, SYS_OPEN);
+    if ((dst_fd = open(flags->rewrite, O_WRONLY | O_CREAT, 0644)) == -1) {
+      perror(flags->rewrite);
+      err = MYTAR_ERR_IO;
+    }
+  }
+
+  if (err == MYTAR_OK && same_file(src_fd, dst_fd)) {
+    fprintf(stderr, "Cannot rewrite an archive into itself\n");
+    err = MYTAR_ERR_INVAL;
+  } else if (err == MYTAR_OK && dst_fd != STDOUT_FILENO &&
+             ftruncate(dst_fd, 0) == -1) {
+    perror(flags->rewrite);
+    err = MYTAR_ERR_IO;
+  }
+
+  if (err == MYTAR_OK) {
+    reader_init(&reader, flags->strict);
+    reader_set_record(&reader, flags->blocking_factor);
+    reader.stats = flags->stats;
+    reader_set_src(&reader,
+                   flags->gzip ? gz_reader_start(&gz, flags, src_fd) : src_fd);
+
+    writer_init(&writer);
+    writer.stats = flags->stats;
+    writer_set_dst(&writer, dst_fd);
+    writer.align = flags->align;
+    writer.record_blocks = flags->blocking_factor;
+
+    if (reader.src_fd == -1) {
+      err = MYTAR_ERR_IO;
+    } else {
+      err = rewrite_members(flags, &reader, &writer);
+    }
+
+    if (flags->gzip && reader.src_fd != -1 &&
+        (gz_err = gz_reader_finish(&gz)) != MYTAR_OK && err == MYTAR_OK) {
+      err = gz_err;
+    }
+    reader_free(&reader);
+  }
+  stats_phase(flags->stats, PHASE_TRAVERSAL, start);
+
+  if (dst_fd != STDOUT_FILENO && dst_fd != -1) {
+    stats_syscall(flags->stats, SYS_CLOSE);
+    close(dst_fd);
+  }
+  if (src_fd != STDIN_FILENO) {
+    stats_syscall(flags->stats, SYS_CLOSE);
+    close(src_fd);
+  }
+  return err;
+}
@@ -0,0 +1,8 @@
+#ifndef REWRITE
+#define REWRITE
+
+#include "mytar.h"
+
+int rewrite_archive(Flags *flags);
+
+#endif
@@ -0,0 +1,278 @@
+/* scan.c
+ * This file implements the parallel listing used by t with --threads N. A
+ * serial reader cannot find a header before it has parsed the size of the one
+ * in front of it, so instead the archive is mapped into memory and cut into N
+ * ranges of blocks. Each thread records every block in its range that looks
+ * like a header, meaning it carries the ustar magic and a valid checksum.
+ * Candidates found inside member data are harmless: a serial stitch pass then
+ * walks the real chain of headers from the start of the archive, hopping
+ * between candidates without touching any member data, and verifies that
+ * every link lands on a valid header.
+ */
+#define _GNU_SOURCE
+
+#include "scan.h"
+#include "archive.h"
+#include "header.h"
+#include "libmytar.h"
+#include "reader.h"
+#include "writer.h"
+#include <fcntl.h>
+#include <linux/limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+typedef struct {
+  long block;
+  long size;
+} Candidate;
+
+typedef struct {
+  const unsigned char *base;
+  long begin;
+  long end;
+  Candidate *found;
+  long count;
+  long capacity;
+  int err;
+  pthread_t thread;
+} ScanJob;
+
+/* walks the candidates of every job in block order */
+typedef struct {
+  ScanJob *jobs;
+  int n_jobs;
+  int job;
+  long index;
+} ScanCursor;
+
+static bool is_candidate(const TarHeader *header) {
+  return memcmp(header->magic, "ustar", 5) == 0 && is_valid_checksum(header);
+}
+
+/* Records every header candidate within the job's range of blocks */
+static void *scan_run(void *arg) {
+  ScanJob *job = arg;
+  const TarHeader *header;
+  Candidate *grown;
+  long block;
+
+  for (block = job->begin; block < job->end; block++) {
+    header = (const TarHeader *)(job->base + block * USTAR_BLOCK);
+    if (!is_candidate(header)) {
+      continue;
+    }
+
+    if (job->count == job->capacity) {
+      job->capacity = job->capacity ? job->capacity * 2 : 1024;
+      grown = realloc(job->found, job->capacity * sizeof(Candidate));
+      if (grown == NULL) {
+        job->err = MYTAR_ERR_NOMEM;
+        return NULL;
+      }
+      job->found = grown;
+    }
+
+    job->found[job->count].block = block;
+    job->found[job->count].size =
+        strtol((char *)header->size, NULL, OCTAL_SIZE);
+    job->count++;
+  }
+
+  return NULL;
+}
+
+/* Advances the cursor to the first candidate at or after block. Returns it,
+ * or NULL when none is left. */
+static Candidate *scan_seek(ScanCursor *cursor, long block) {
+  ScanJob *job;
+
+  while (cursor->job < cursor->n_jobs) {
+    job = &cursor->jobs[cursor->job];
+
+    while (cursor->index < job->count &&
+           job->found[cursor->index].block < block) {
+      cursor->index++;
+    }
+
+    if (cursor->index < job->count) {
+      return &job->found[cursor->index];
+    }
+
+    cursor->job++;
+    cursor->index = 0;
+  }
+
+  return NULL;
+}
+
+static int print_header(Flags *flags, const TarHeader *mapped) {
+  TarHeader header;
+  char path[PATH_MAX];
+
+  memcpy(&header, mapped, sizeof(TarHeader));
+  memset(path, 0, sizeof(path));
+  extract_name(&header, path);
+
+  if (!path_matches(flags, path)) {
+    return MYTAR_OK;
+  }
+
+  return list_member(flags, &header, path, strlen(path));
+}
+
+/* Follows the chain of headers from the first block, using the candidates
+ * to skip over member data. Headers without the ustar magic were never
+ * candidates, so they are checked here. */
+static int scan_stitch(Flags *flags, const unsigned char *base, long blocks,
+                       ScanJob *jobs, int n_jobs) {
+  ScanCursor cursor;
+  Candidate *candidate;
+  const TarHeader *header;
+  long block = 0;
+  long size;
+  int err;
+
+  cursor.jobs = jobs;
+  cursor.n_jobs = n_jobs;
+  cursor.job = 0;
+  cursor.index = 0;
+
+  while (block < blocks) {
+    header = (const TarHeader *)(base + block * USTAR_BLOCK);
+    candidate = scan_seek(&cursor, block);
+
+    if (candidate != NULL && candidate->block == block) {
+      size = candidate->size;
+    } else if (is_end_of_archive((TarHeader *)header)) {
+      return MYTAR_OK;
+    } else if (is_valid_checksum(header)) {
+      size = strtol((char *)header->size, NULL, OCTAL_SIZE);
+    } else {
+      fprintf(stderr, "Failed checksum.\n");
+      return MYTAR_ERR_FORMAT;
+    }
+
+    stats_entry(flags->stats, header);
+    block += 1 + (size + USTAR_BLOCK - 1) / USTAR_BLOCK;
+
+    if (size < 0 || block > blocks) {
+      fprintf(stderr, "Unexpected end of archive\n");
+      return MYTAR_ERR_FORMAT;
+    }
+
+    if (flags->strict &&
+        (strcmp((char *)header->magic, "ustar") != 0 ||
+         header->version[0] != '0' || header->version[1] != '0')) {
+      fprintf(stderr, "Encountered non-compliant entry. Skipping.\n");
+      continue;
+    }
+
+    /* extended headers describe the next member, they are not members */
+    if (header->typeflag != 'x' && header->typeflag != 'g' &&
+        (err = print_header(flags, header)) != MYTAR_OK) {
+      return err;
+    }
+  }
+
+  return MYTAR_OK;
+}
+
+/* Scans blocks [0, blocks) of the mapped archive with n_jobs threads and
+ * prints the listing */
+static int scan_mapped(Flags *flags, const unsigned char *base, long blocks) {
+  ScanJob *jobs;
+  int n_jobs = flags->threads;
+  int started;
+  int i;
+  int err = MYTAR_OK;
+  double start;
+
+  if ((jobs = calloc(n_jobs, sizeof(ScanJob))) == NULL) {
+    return MYTAR_ERR_NOMEM;
+  }
+
+  start = stats_now();
+  for (started = 0; started < n_jobs; started++) {
+    jobs[started].base = base;
+    jobs[started].begin = blocks * started / n_jobs;
+    jobs[started].end = blocks * (started + 1) / n_jobs;
+
+    if (pthread_create(&jobs[started].thread, NULL, scan_run,
+                       &jobs[started]) != 0) {
+      fprintf(stderr, "Failed to start scan thread\n");
+      err = MYTAR_ERR_IO;
+      break;
+    }
+  }
+
+  for (i = 0; i < started; i++) {
+    pthread_join(jobs[i].thread, NULL);
+    if (err == MYTAR_OK) {
+      err = jobs[i].err;
+    }
+  }
+  stats_phase(flags->stats, PHASE_HEADER, start);
+
+  if (err == MYTAR_OK) {
+    err = scan_stitch(flags, base, blocks, jobs, n_jobs);
+  }
+
+  for (i = 0; i < n_jobs; i++) {
+    free(jobs[i].found);
+  }
+  free(jobs);
+  return err;
+}
+
+/* Lists the archive with flags->threads scanning threads. Archives that
+ * cannot be mapped, such as f -, fall back to the serial listing. */
+int list_archive_parallel(Flags *flags) {
+  struct stat archive_stat;
+  void *base;
+  int fd;
+  int err;
+  double start = stats_now();
+
+  if ((err = load_operands(flags)) != MYTAR_OK) {
+    return err;
+  }
+
+  if (strcmp(flags->tarfile, "-") == 0) {
+    return list_members(flags);
+  }
+
+  stats_syscall(flags->stats, SYS_OPEN);
+  if ((fd = open(flags->tarfile, O_RDONLY)) == -1) {
+    perror("Could not open archive");
+    return MYTAR_ERR_IO;
+  }
+
+  stats_syscall(flags->stats, SYS_STAT);
+  if (fstat(fd, &archive_stat) == -1 || !S_ISREG(archive_stat.st_mode) ||
+      archive_stat.st_size < USTAR_BLOCK) {
+    stats_syscall(flags->stats, SYS_CLOSE);
+    close(fd);
+    return list_members(flags);
+  }
+
+  base = mmap(NULL, archive_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  stats_syscall(flags->stats, SYS_CLOSE);
+  close(fd);
+
+  if (base == MAP_FAILED) {
+    return list_members(flags);
+  }
+
+  madvise(base, archive_stat.st_size, MADV_SEQUENTIAL);
+  err = scan_mapped(flags, base, archive_stat.st_size / USTAR_BLOCK);
+
+  munmap(base, archive_stat.st_size);
+  stats_phase(flags->stats, PHASE_TRAVERSAL, start);
+  return err;
+}
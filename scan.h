@@ -0,0 +1,8 @@
+#ifndef SCAN
+#define SCAN
+
+#include "mytar.h"
+
+int list_archive_parallel(Flags *flags);
+
+#endif
@@ -0,0 +1,241 @@
+/* shard.c
+ * This file splits one create job into --shards N independent archives. The
+ * tree is walked once to collect every path, the paths are cut into N
+ * contiguous runs of roughly equal byte size, and each run is written to its
+ * own archive by its own thread. Members are never split, so a large one can
+ * leave a run, and its archive, empty. Every shard is a complete tar, and since
+ * directories come before their contents within a run, extracting all shards
+ * (in any order, or in parallel) reproduces the tree.
+ */
+
+#include "shard.h"
+#include "archive.h"
+#include "libmytar.h"
+#include "writer.h"
+#include <fcntl.h>
+#include <linux/limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+extern char *strdup(const char *);
+extern int snprintf(char *str, size_t size, const char *format, ...);
+
+typedef struct {
+  char *path;
+  long weight;
+} ShardEntry;
+
+typedef struct {
+  ShardEntry *entries;
+  long count;
+  long capacity;
+  long total;
+  Flags *flags;
+} ShardList;
+
+typedef struct {
+  Flags *flags;
+  ShardEntry *entries;
+  long begin;
+  long end;
+  char name[PATH_MAX];
+  Stats stats;
+  int err;
+  pthread_t thread;
+} ShardJob;
+
+/* Names shard index of tarfile: archive.tar becomes archive.<index>.tar, and
+ * any other name gets .<index> appended. */
+void shard_name(const char *tarfile, int index, char *name, size_t size) {
+  size_t len = strlen(tarfile);
+
+  if (len > 4 && strcmp(tarfile + len - 4, ".tar") == 0) {
+    snprintf(name, size, "%.*s.%d.tar", (int)(len - 4), tarfile, index);
+  } else {
+    snprintf(name, size, "%s.%d", tarfile, index);
+  }
+}
+
+/* Records a path and the number of archive bytes it will take up */
+static int collect_visit(const char *path, struct stat *path_stat,
+                         void *ctx) {
+  ShardList *list = ctx;
+  ShardEntry *grown;
+
+  if (matcher_skips(list->flags->matcher, path, S_ISDIR(path_stat->st_mode))) {
+    return WALK_PRUNE;
+  }
+
+  if (list->count == list->capacity) {
+    list->capacity = list->capacity ? list->capacity * 2 : 1024;
+    grown = realloc(list->entries, list->capacity * sizeof(ShardEntry));
+    if (grown == NULL) {
+      return MYTAR_ERR_NOMEM;
+    }
+    list->entries = grown;
+  }
+
+  if ((list->entries[list->count].path = strdup(path)) == NULL) {
+    return MYTAR_ERR_NOMEM;
+  }
+
+  list->entries[list->count].weight = USTAR_BLOCK;
+  if (S_ISREG(path_stat->st_mode)) {
+    list->entries[list->count].weight +=
+        (path_stat->st_size + USTAR_BLOCK - 1) / USTAR_BLOCK * USTAR_BLOCK;
+  }
+
+  list->total += list->entries[list->count].weight;
+  list->count++;
+
+  if (list->flags->no_recursion && S_ISDIR(path_stat->st_mode)) {
+    return WALK_PRUNE;
+  }
+  return MYTAR_OK;
+}
+
+static int collect_operand(Flags *flags, const char *path, void *ctx) {
+  return walk_path(path, collect_visit, ctx, flags->stats);
+}
+
+/* Writes one shard's run of paths into its own archive */
+static void *shard_run(void *arg) {
+  ShardJob *job = arg;
+  Writer writer;
+  long i;
+  int fd;
+
+  writer_init(&writer);
+  writer.stats = job->flags->stats != NULL ? &job->stats : NULL;
+
+  stats_syscall(writer.stats, SYS_OPEN);
+  if ((fd = open(job->name, O_WRONLY | O_CREAT | O_TRUNC, 0644)) == -1) {
+    perror(job->name);
+    job->err = MYTAR_ERR_IO;
+    return NULL;
+  }
+  writer_set_dst(&writer, fd);
+  writer.digest = job->flags->digest;
+  writer.align = job->flags->align;
+  writer.record_blocks = job->flags->blocking_factor;
+
+  job->err = MYTAR_OK;
+  for (i = job->begin; i < job->end && job->err == MYTAR_OK; i++) {
+    job->err =
+        archive_path(job->entries[i].path, &writer, job->flags->verbose);
+  }
+
+  if (job->err == MYTAR_OK && (job->err = writer_pad(&writer)) == MYTAR_OK) {
+    job->err = writer_flush(&writer);
+  }
+
+  stats_syscall(writer.stats, SYS_CLOSE);
+  close(fd);
+  return NULL;
+}
+
+/* Cuts the list into n contiguous runs by cumulative size and writes them in
+ * parallel. Each entry goes to the shard its middle byte falls in. A single
+ * member is never split across shards, so one larger than a shard's share
+ * can leave a shard empty; it is still written, as an empty archive, so no
+ * shard of an earlier run is left behind, and reported. */
+static int write_shards(Flags *flags, ShardList *list, int n) {
+  ShardJob *jobs;
+  long i;
+  long cumulative = 0;
+  double middle;
+  int target;
+  int shard = 0;
+  int started;
+  int err = MYTAR_OK;
+
+  if ((jobs = calloc(n, sizeof(ShardJob))) == NULL) {
+    return MYTAR_ERR_NOMEM;
+  }
+
+  for (i = 0; i < list->count; i++) {
+    /* the shard an entry belongs to only ever grows with i */
+    middle = cumulative + list->entries[i].weight / 2.0;
+    if ((target = middle * n / list->total) > n - 1) {
+      target = n - 1;
+    }
+    while (shard < target) {
+      jobs[++shard].begin = i;
+    }
+    cumulative += list->entries[i].weight;
+    jobs[shard].end = i + 1;
+  }
+
+  for (shard = 0; shard < n; shard++) {
+    if (jobs[shard].end < jobs[shard].begin) {
+      jobs[shard].end = jobs[shard].begin;
+    }
+    jobs[shard].flags = flags;
+    jobs[shard].entries = list->entries;
+    stats_init(&jobs[shard].stats);
+    shard_name(flags->tarfile, shard, jobs[shard].name,
+               sizeof(jobs[shard].name));
+    if (jobs[shard].end == jobs[shard].begin) {
+      fprintf(stderr, "%s: no members, as a member is never split\n",
+              jobs[shard].name);
+    }
+  }
+
+  for (started = 0; started < n; started++) {
+    if (pthread_create(&jobs[started].thread, NULL, shard_run,
+                       &jobs[started]) != 0) {
+      err = MYTAR_ERR_NOMEM;
+      break;
+    }
+  }
+
+  for (shard = 0; shard < started; shard++) {
+    pthread_join(jobs[shard].thread, NULL);
+    stats_merge(flags->stats, &jobs[shard].stats);
+    if (err == MYTAR_OK) {
+      err = jobs[shard].err;
+    }
+  }
+
+  free(jobs);
+  return err;
+}
+
+/* Creates flags->shards archives that together hold every path */
+int create_sharded_archive(Flags *flags) {
+  ShardList list;
+  long i;
+  int err;
+  double start = stats_now();
+
+  if (strcmp(flags->tarfile, "-") == 0) {
+    fprintf(stderr, "Shards cannot be written to stdout\n");
+    return MYTAR_ERR_INVAL;
+  }
+
+  if (flags->gzip) {
+    fprintf(stderr, "Shards cannot be compressed\n");
+    return MYTAR_ERR_INVAL;
+  }
+
+  memset(&list, 0, sizeof(list));
+  list.flags = flags;
+
+  err = for_each_operand(flags, collect_operand, &list);
+
+  if (err == MYTAR_OK) {
+    err = write_shards(flags, &list, flags->shards);
+  }
+  stats_phase(flags->stats, PHASE_TRAVERSAL, start);
+
+  for (i = 0; i < list.count; i++) {
+    free(list.entries[i].path);
+  }
+  free(list.entries);
+
+  return err;
+}
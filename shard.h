@@ -0,0 +1,10 @@
+#ifndef SHARD
+#define SHARD
+
+#include "mytar.h"
+#include <stddef.h>
+
+void shard_name(const char *tarfile, int index, char *name, size_t size);
+int create_sharded_archive(Flags *flags);
+
+#endif
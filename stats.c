@@ -0,0 +1,201 @@
+/* stats.c
+ * This file collects the instrumentation reported by --stats: entry counts,
+ * byte counts, syscall counts, per-phase timing and a histogram of member
+ * sizes. Every function accepts a NULL stats pointer so callers can
+ * instrument unconditionally.
+ */
+#define _POSIX_C_SOURCE 200809L
+
+#include "stats.h"
+#include "mytar.h"
+#include "writer.h"
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static const char *syscall_names[SYS_KINDS] = {"stat",  "open",  "read",
+                                               "write", "lseek", "close"};
+
+static const char *phase_names[PHASES] = {"traversal", "header", "copy",
+                                          "path_setup", "throttled"};
+
+/* inclusive upper bound of each histogram bucket, the last is unbounded */
+static const long hist_limits[HIST_BUCKETS - 1] = {
+    0, 512, 4096, 65536, 1048576, 16777216, 268435456};
+
+static const char *hist_labels[HIST_BUCKETS] = {
+    "0",      "1-512",     "513-4K",     "4K-64K",
+    "64K-1M", "1M-16M",    "16M-256M",   "256M+"};
+
+void stats_init(Stats *stats) {
+  memset(stats, 0, sizeof(Stats));
+  stats->start_time = stats_now();
+}
+
+/* Returns a monotonic timestamp in seconds */
+double stats_now() {
+  struct timespec ts;
+
+  if (clock_gettime(CLOCK_MONOTONIC, &ts) == -1) {
+    return 0;
+  }
+
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void stats_syscall(Stats *stats, int kind) {
+  if (stats != NULL) {
+    stats->syscalls[kind]++;
+  }
+}
+
+/* Adds the time elapsed since start to the given phase */
+void stats_phase(Stats *stats, int phase, double start) {
+  if (stats != NULL) {
+    stats->phase_time[phase] += stats_now() - start;
+  }
+}
+
+/* Counts an archive member by type, and accounts for its header, data and
+ * padding bytes. */
+void stats_entry(Stats *stats, const TarHeader *header) {
+  long size;
+  int i;
+
+  if (stats == NULL) {
+    return;
+  }
+
+  size = strtol((char *)header->size, NULL, OCTAL_SIZE);
+
+  switch (header->typeflag) {
+  case '0':
+  case '\0':
+    stats->entries_regular++;
+    break;
+  case '5':
+    stats->entries_directory++;
+    break;
+  case '2':
+    stats->entries_symlink++;
+    break;
+  default:
+    stats->entries_other++;
+    break;
+  }
+
+  stats->header_bytes += USTAR_BLOCK;
+  stats->data_bytes += size;
+  if (size % USTAR_BLOCK != 0) {
+    stats->padding_bytes += USTAR_BLOCK - size % USTAR_BLOCK;
+  }
+
+  for (i = 0; i < HIST_BUCKETS - 1 && size > hist_limits[i]; i++)
+    ;
+  stats->size_hist[i]++;
+}
+
+void stats_padding(Stats *stats, long bytes) {
+  if (stats != NULL) {
+    stats->padding_bytes += bytes;
+  }
+}
+
+/* Adds the counters of from into into, used to combine per-thread stats */
+void stats_merge(Stats *into, const Stats *from) {
+  int i;
+
+  if (into == NULL || from == NULL) {
+    return;
+  }
+
+  into->entries_regular += from->entries_regular;
+  into->entries_directory += from->entries_directory;
+  into->entries_symlink += from->entries_symlink;
+  into->entries_other += from->entries_other;
+
+  into->header_bytes += from->header_bytes;
+  into->data_bytes += from->data_bytes;
+  into->padding_bytes += from->padding_bytes;
+
+  for (i = 0; i < SYS_KINDS; i++) {
+    into->syscalls[i] += from->syscalls[i];
+  }
+
+  for (i = 0; i < PHASES; i++) {
+    into->phase_time[i] += from->phase_time[i];
+  }
+
+  for (i = 0; i < HIST_BUCKETS; i++) {
+    into->size_hist[i] += from->size_hist[i];
+  }
+}
+
+static void stats_print_json(Stats *stats, FILE *out, double total) {
+  int i;
+
+  fprintf(out,
+          "{\"entries\":{\"regular\":%ld,\"directory\":%ld,\"symlink\":%ld,"
+          "\"other\":%ld},",
+          stats->entries_regular, stats->entries_directory,
+          stats->entries_symlink, stats->entries_other);
+
+  fprintf(out, "\"bytes\":{\"header\":%ld,\"data\":%ld,\"padding\":%ld},",
+          stats->header_bytes, stats->data_bytes, stats->padding_bytes);
+
+  fprintf(out, "\"syscalls\":{");
+  for (i = 0; i < SYS_KINDS; i++) {
+    fprintf(out, "%s\"%s\":%ld", i ? "," : "", syscall_names[i],
+            stats->syscalls[i]);
+  }
+
+  fprintf(out, "},\"seconds\":{\"total\":%.6f", total);
+  for (i = 0; i < PHASES; i++) {
+    fprintf(out, ",\"%s\":%.6f", phase_names[i], stats->phase_time[i]);
+  }
+
+  fprintf(out, "},\"size_histogram\":{");
+  for (i = 0; i < HIST_BUCKETS; i++) {
+    fprintf(out, "%s\"%s\":%ld", i ? "," : "", hist_labels[i],
+            stats->size_hist[i]);
+  }
+  fprintf(out, "}}\n");
+}
+
+static void stats_print_text(Stats *stats, FILE *out, double total) {
+  int i;
+
+  fprintf(out, "entries: %ld regular, %ld directory, %ld symlink, %ld other\n",
+          stats->entries_regular, stats->entries_directory,
+          stats->entries_symlink, stats->entries_other);
+
+  fprintf(out, "bytes: %ld header, %ld data, %ld padding\n",
+          stats->header_bytes, stats->data_bytes, stats->padding_bytes);
+
+  fprintf(out, "syscalls:");
+  for (i = 0; i < SYS_KINDS; i++) {
+    fprintf(out, " %s=%ld", syscall_names[i], stats->syscalls[i]);
+  }
+
+  fprintf(out, "\ntime: total=%.6fs", total);
+  for (i = 0; i < PHASES; i++) {
+    fprintf(out, " %s=%.6fs", phase_names[i], stats->phase_time[i]);
+  }
+
+  fprintf(out, "\nsizes:");
+  for (i = 0; i < HIST_BUCKETS; i++) {
+    fprintf(out, " %s=%ld", hist_labels[i], stats->size_hist[i]);
+  }
+  fprintf(out, "\n");
+}
+
+/* Prints the collected statistics either as text or as a single JSON object */
+void stats_print(Stats *stats, FILE *out, bool json) {
+  double total = stats_now() - stats->start_time;
+
+  if (json) {
+    stats_print_json(stats, out, total);
+  } else {
+    stats_print_text(stats, out, total);
+  }
+}
@@ -0,0 +1,53 @@
+#ifndef STATS
+#define STATS
+
+#include "header.h"
+#include <stdbool.h>
+#include <stdio.h>
+
+/* syscall kinds counted by stats_syscall */
+#define SYS_STAT 0
+#define SYS_OPEN 1
+#define SYS_READ 2
+#define SYS_WRITE 3
+#define SYS_LSEEK 4
+#define SYS_CLOSE 5
+#define SYS_KINDS 6
+
+/* timed phases */
+#define PHASE_TRAVERSAL 0
+#define PHASE_HEADER 1
+#define PHASE_COPY 2
+#define PHASE_PATH_SETUP 3
+#define PHASE_THROTTLE 4
+#define PHASES 5
+
+#define HIST_BUCKETS 8
+
+typedef struct {
+  long entries_regular;
+  long entries_directory;
+  long entries_symlink;
+  long entries_other;
+
+  long header_bytes;
+  long data_bytes;
+  long padding_bytes;
+
+  long syscalls[SYS_KINDS];
+  double phase_time[PHASES];
+  double start_time;
+
+  long size_hist[HIST_BUCKETS];
+} Stats;
+
+void stats_init(Stats *stats);
+double stats_now();
+void stats_syscall(Stats *stats, int kind);
+void stats_phase(Stats *stats, int phase, double start);
+void stats_entry(Stats *stats, const TarHeader *header);
+void stats_padding(Stats *stats, long bytes);
+void stats_merge(Stats *into, const Stats *from);
+void stats_print(Stats *stats, FILE *out, bool json);
+
+#endif
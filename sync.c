@@ -0,0 +1,295 @@
+/* sync.c
+ * This file makes extracted files durable according to --sync:
+ *   none   never syncs.
+ *   end    calls syncfs once when the extraction completes.
+ *   batch  starts writeback of every file as soon as it is closed with
+ *          sync_file_range, and every SYNC_BATCH_FILES files waits for it and
+ *          commits the whole batch with a single syncfs. The directories that
+ *          gained entries are fsynced at the end.
+ *   file   fsyncs every file, directory and symlink, and the directory
+ *          holding it, before moving on, and calls syncfs once at the end
+ *          for the directory metadata restored last.
+ */
+#define _GNU_SOURCE
+
+#include "sync.h"
+#include "libmytar.h"
+#include <fcntl.h>
+#include <linux/limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+void syncer_init(Syncer *syncer, int mode) {
+  struct rlimit limit;
+
+  syncer->mode = mode;
+  syncer->n_pending = 0;
+
+  /* pending files stay open, so leave most descriptors to the extraction */
+  syncer->batch_files = SYNC_BATCH_FILES;
+  if (getrlimit(RLIMIT_NOFILE, &limit) == 0 &&
+      limit.rlim_cur < SYNC_BATCH_FILES * 4) {
+    syncer->batch_files = limit.rlim_cur > 8 ? limit.rlim_cur / 4 : 1;
+  }
+  syncer->dirs = NULL;
+  syncer->n_dirs = 0;
+  syncer->dirs_capacity = 0;
+}
+
+/* Writes the directory holding path into dir */
+static void parent_dir(const char *path, char *dir) {
+  size_t len = strlen(path);
+
+  while (len > 1 && path[len - 1] == '/') {
+    len--;
+  }
+  while (len > 0 && path[len - 1] != '/') {
+    len--;
+  }
+
+  if (len == 0) {
+    strcpy(dir, ".");
+  } else {
+    memcpy(dir, path, len);
+    dir[len] = '\0';
+  }
+}
+
+static int fsync_path(const char *path) {
+  int fd;
+  int err = MYTAR_OK;
+
+  if ((fd = open(path, O_RDONLY)) == -1) {
+    perror(path);
+    return MYTAR_ERR_IO;
+  }
+
+  if (fsync(fd) == -1) {
+    perror(path);
+    err = MYTAR_ERR_IO;
+  }
+
+  close(fd);
+  return err;
+}
+
+/* Waits for the writeback of every pending file, closes them, and commits
+ * the batch with one syncfs */
+static int syncer_commit(Syncer *syncer) {
+  int i;
+  int err = MYTAR_OK;
+
+  if (syncer->n_pending == 0) {
+    return MYTAR_OK;
+  }
+
+  for (i = 0; i < syncer->n_pending; i++) {
+    if (sync_file_range(syncer->pending[i], 0, 0,
+                        SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE |
+                            SYNC_FILE_RANGE_WAIT_AFTER) == -1) {
+      err = MYTAR_ERR_IO;
+    }
+  }
+
+  if (err == MYTAR_OK && syncfs(syncer->pending[0]) == -1) {
+    err = MYTAR_ERR_IO;
+  }
+
+  if (err != MYTAR_OK) {
+    perror("Failed to sync extracted files");
+  }
+
+  for (i = 0; i < syncer->n_pending; i++) {
+    close(syncer->pending[i]);
+  }
+  syncer->n_pending = 0;
+  return err;
+}
+
+/* FNV-1a, as match.c hashes its sets */
+static unsigned long dir_hash(const char *dir) {
+  unsigned long hash = 2166136261UL;
+
+  for (; *dir != '\0'; dir++) {
+    hash = (hash ^ (unsigned char)*dir) * 16777619UL;
+  }
+
+  return hash;
+}
+
+static void dirs_insert(char **slots, long capacity, char *dir) {
+  unsigned long i = dir_hash(dir) % capacity;
+
+  while (slots[i] != NULL) {
+    i = (i + 1) % capacity;
+  }
+  slots[i] = dir;
+}
+
+/* Adds a copy of dir to the set of directories fsynced at the end, keeping
+ * the table at most half full. Members usually come a directory at a time,
+ * but the same directory may gain entries all through the archive. */
+static int syncer_add_dir(Syncer *syncer, const char *dir) {
+  unsigned long i;
+  long j;
+  long capacity;
+  char **grown;
+  char *copy;
+
+  if (syncer->n_dirs > 0) {
+    for (i = dir_hash(dir) % syncer->dirs_capacity; syncer->dirs[i] != NULL;
+         i = (i + 1) % syncer->dirs_capacity) {
+      if (strcmp(syncer->dirs[i], dir) == 0) {
+        return MYTAR_OK;
+      }
+    }
+  }
+
+  if ((syncer->n_dirs + 1) * 2 > syncer->dirs_capacity) {
+    capacity = syncer->dirs_capacity ? syncer->dirs_capacity * 2 : 64;
+    if ((grown = calloc(capacity, sizeof(char *))) == NULL) {
+      return MYTAR_ERR_NOMEM;
+    }
+
+    for (j = 0; j < syncer->dirs_capacity; j++) {
+      if (syncer->dirs[j] != NULL) {
+        dirs_insert(grown, capacity, syncer->dirs[j]);
+      }
+    }
+
+    free(syncer->dirs);
+    syncer->dirs = grown;
+    syncer->dirs_capacity = capacity;
+  }
+
+  if ((copy = malloc(strlen(dir) + 1)) == NULL) {
+    return MYTAR_ERR_NOMEM;
+  }
+  strcpy(copy, dir);
+  dirs_insert(syncer->dirs, syncer->dirs_capacity, copy);
+  syncer->n_dirs++;
+  return MYTAR_OK;
+}
+
+/* Records that the directory holding path gained an entry, which is a
+ * directory itself if is_dir. batch fsyncs every such directory once at the
+ * end, and file fsyncs it, and a new directory too, right away. A symlink
+ * cannot be opened to be fsynced, so it is committed with its directory. */
+int syncer_touch(Syncer *syncer, const char *path, bool is_dir) {
+  char dir[PATH_MAX];
+  int err;
+
+  switch (syncer->mode) {
+  case SYNC_FILE:
+    if (is_dir && (err = fsync_path(path)) != MYTAR_OK) {
+      return err;
+    }
+    parent_dir(path, dir);
+    return fsync_path(dir);
+  case SYNC_BATCH:
+    parent_dir(path, dir);
+    return syncer_add_dir(syncer, dir);
+  default:
+    return MYTAR_OK;
+  }
+}
+
+/* Closes a file that was just extracted to path, syncing it as the mode
+ * requires. The syncer owns fd from here on. */
+int syncer_close(Syncer *syncer, int fd, const char *path) {
+  char dir[PATH_MAX];
+  int err = MYTAR_OK;
+
+  switch (syncer->mode) {
+  case SYNC_FILE:
+    if (fsync(fd) == -1) {
+      perror(path);
+      err = MYTAR_ERR_IO;
+    }
+    close(fd);
+
+    parent_dir(path, dir);
+    if (err == MYTAR_OK) {
+      err = fsync_path(dir);
+    }
+    return err;
+  case SYNC_BATCH:
+    /* only starts the writeback, the batch commit waits for it */
+    sync_file_range(fd, 0, 0, SYNC_FILE_RANGE_WRITE);
+    syncer->pending[syncer->n_pending++] = fd;
+
+    if ((err = syncer_touch(syncer, path, false)) == MYTAR_OK &&
+        syncer->n_pending == syncer->batch_files) {
+      err = syncer_commit(syncer);
+    }
+    return err;
+  default:
+    close(fd);
+    return MYTAR_OK;
+  }
+}
+
+/* Syncs the filesystem extraction happens in */
+static int syncfs_cwd(void) {
+  int fd;
+  int err = MYTAR_OK;
+
+  if ((fd = open(".", O_RDONLY)) == -1 || syncfs(fd) == -1) {
+    perror("Failed to sync extracted files");
+    err = MYTAR_ERR_IO;
+  }
+  if (fd != -1) {
+    close(fd);
+  }
+  return err;
+}
+
+/* Makes everything extracted so far durable, and frees the syncer */
+int syncer_finish(Syncer *syncer) {
+  long i;
+  int err = MYTAR_OK;
+
+  if (syncer->mode == SYNC_BATCH) {
+    err = syncer_commit(syncer);
+
+    for (i = 0; i < syncer->dirs_capacity; i++) {
+      if (syncer->dirs[i] == NULL) {
+        continue;
+      }
+      if (err == MYTAR_OK) {
+        err = fsync_path(syncer->dirs[i]);
+      }
+      free(syncer->dirs[i]);
+    }
+    free(syncer->dirs);
+    syncer->dirs = NULL;
+    syncer->n_dirs = 0;
+    syncer->dirs_capacity = 0;
+  }
+
+  /* file has synced every member, but not the directory modes and mtimes
+   * restored once everything is extracted */
+  if ((syncer->mode == SYNC_END || syncer->mode == SYNC_FILE) &&
+      err == MYTAR_OK) {
+    err = syncfs_cwd();
+  }
+
+  return err;
+}
+
+/* Makes everything extracted so far durable before a --checkpoint records
+ * it, whatever the mode. syncer may be NULL. */
+int syncer_checkpoint(Syncer *syncer) {
+  int err;
+
+  if (syncer != NULL && syncer->mode == SYNC_BATCH &&
+      (err = syncer_commit(syncer)) != MYTAR_OK) {
+    return err;
+  }
+
+  /* also covers the directories a batch would fsync at the end */
+  return syncfs_cwd();
+}
@@ -0,0 +1,36 @@
+#ifndef SYNC
+#define SYNC
+
+#include <stdbool.h>
+
+/* --sync modes, from fastest to most durable */
+#define SYNC_NONE 0
+#define SYNC_END 1
+#define SYNC_BATCH 2
+#define SYNC_FILE 3
+
+/* files whose writeback is started before the batch is committed */
+#define SYNC_BATCH_FILES 64
+
+typedef struct {
+  int mode;
+
+  /* batch: files written since the last commit, still open */
+  int pending[SYNC_BATCH_FILES];
+  int n_pending;
+  int batch_files;
+
+  /* batch: a hash set of the directories that gained entries, fsynced at the
+   * end */
+  char **dirs;
+  long n_dirs;
+  long dirs_capacity;
+} Syncer;
+
+void syncer_init(Syncer *syncer, int mode);
+int syncer_close(Syncer *syncer, int fd, const char *path);
+int syncer_touch(Syncer *syncer, const char *path, bool is_dir);
+int syncer_finish(Syncer *syncer);
+int syncer_checkpoint(Syncer *syncer);
+
+#endif
@@ -0,0 +1,42 @@
+#!/bin/sh
+# --align N starts the data of every regular file of at least N bytes at a
+# multiple of N, with or without digests and through --rewrite, and the
+# archive still extracts to the same tree.
+
+set -e
+mytar="$(pwd)/mytar"
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+cd "$dir"
+
+mkdir src
+for i in 1 2 3; do
+  { echo "MARKER$i"; head -c $((i * 5000)) /dev/urandom; } >"src/f$i"
+done
+echo "MARKER0 small" >src/small
+
+# prints every marker that starts at a multiple of 4096
+aligned() {
+  grep -obUa 'MARKER[0-9]' "$1" | while IFS=: read -r offset marker; do
+    if [ $((offset % 4096)) -eq 0 ]; then
+      echo "$marker"
+    fi
+  done | sort
+}
+
+"$mytar" cf plain.tar src/small src/f1 src/f2 src/f3
+for options in "--align 4096" "--align 4096 --digest=crc32c"; do
+  "$mytar" cf out.tar src/small src/f1 src/f2 src/f3 $options
+  if [ "$(aligned out.tar | tr '\n' ' ')" != "MARKER1 MARKER2 MARKER3 " ]; then
+    echo "align: '$options' did not align the large files:" >&2
+    aligned out.tar >&2
+    exit 1
+  fi
+  rm -rf out
+  mkdir out
+  (cd out && "$mytar" xf ../out.tar)
+  diff -r src out/src
+done
+
+"$mytar" f plain.tar --rewrite rewritten.tar --align 4096
+test "$(aligned rewritten.tar | wc -l)" -eq 3
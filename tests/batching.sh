@@ -0,0 +1,33 @@
+#!/bin/sh
+# c gathers headers and small members into whole records, so a tree of
+# hundreds of small files takes a few writes. The archive is the same
+# whatever the record size and whether it goes to a file or a pipe.
+
+set -e
+mytar="$(pwd)/mytar"
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+cd "$dir"
+
+mkdir src
+i=0
+while [ $i -lt 500 ]; do
+  echo "file $i" >"src/s$i"
+  i=$((i + 1))
+done
+head -c 300000 /dev/urandom >src/big
+
+"$mytar" cf out.tar src --stats 2>stats
+writes=$(sed -n 's/^syscalls: .* write=\([0-9]*\) .*/\1/p' stats)
+if [ "$writes" -gt 50 ]; then
+  echo "batching: $writes writes for 501 members" >&2
+  exit 1
+fi
+
+"$mytar" cf - src | cmp - out.tar
+"$mytar" cf one.tar src --blocking-factor 1
+cmp out.tar one.tar
+
+mkdir out
+(cd out && "$mytar" xf ../out.tar)
+diff -r src out/src
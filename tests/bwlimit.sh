@@ -0,0 +1,44 @@
+#!/bin/sh
+# --bwlimit paces member data to the given rate, on create and extract, and
+# --ionice=idle still produces the same archive.
+
+set -e
+mytar="$(pwd)/mytar"
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+cd "$dir"
+
+mkdir src
+head -c 2000000 /dev/urandom >src/big
+
+# prints the milliseconds between two runs of date +%s%N
+elapsed() {
+  echo $((($2 - $1) / 1000000))
+}
+
+start=$(date +%s%N)
+"$mytar" cf out.tar src --bwlimit 4m --stats 2>stats
+ms=$(elapsed "$start" "$(date +%s%N)")
+# 2000000 bytes at 4 MiB/s, less the 50ms the bucket may already hold
+if [ "$ms" -lt 400 ]; then
+  echo "bwlimit: create took ${ms}ms, too fast for --bwlimit 4m" >&2
+  exit 1
+fi
+if ! grep -q "throttled=0\.[1-9]" stats; then
+  echo "bwlimit: --stats reports no throttling:" >&2
+  cat stats >&2
+  exit 1
+fi
+
+mkdir out
+start=$(date +%s%N)
+(cd out && "$mytar" xf ../out.tar --bwlimit 8m)
+ms=$(elapsed "$start" "$(date +%s%N)")
+if [ "$ms" -lt 150 ]; then
+  echo "bwlimit: extract took ${ms}ms, too fast for --bwlimit 8m" >&2
+  exit 1
+fi
+cmp src/big out/src/big
+
+"$mytar" cf idle.tar src --ionice=idle
+cmp out.tar idle.tar
@@ -0,0 +1,55 @@
+#!/bin/sh
+# A create or extract killed after a --checkpoint is finished by --resume:
+# the archive comes out the same as an uninterrupted one, and an extract
+# leaves alone the members that were complete at the checkpoint.
+
+set -e
+mytar="$(pwd)/mytar"
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+cd "$dir"
+
+mkdir src
+for i in 1 2 3 4 5 6 7 8; do
+  head -c 1048576 /dev/urandom >"src/f$i"
+done
+"$mytar" cf ref.tar src
+
+# runs a slowed down mytar in the background and kills it once it has
+# written its first checkpoint
+interrupt() {
+  "$mytar" "$@" --checkpoint "$dir/ck" --checkpoint-every 1 --bwlimit 4m &
+  pid=$!
+  tries=0
+  while [ ! -s "$dir/ck" ] && [ $tries -lt 100 ]; do
+    sleep 0.05
+    tries=$((tries + 1))
+  done
+  kill -9 $pid
+  wait $pid 2>/dev/null || true
+  if [ ! -s "$dir/ck" ]; then
+    echo "checkpoint_resume: no checkpoint was written" >&2
+    exit 1
+  fi
+}
+
+interrupt cf out.tar src
+"$mytar" cf out.tar src --checkpoint ck --resume
+cmp ref.tar out.tar
+test ! -e ck
+
+mkdir out
+cd out
+interrupt xf ../ref.tar
+# the checkpoint names the last member it covers, which --resume must not
+# write again
+done=$(sed -n 3p ../ck)
+echo changed >"$done"
+"$mytar" xf ../ref.tar --checkpoint ../ck --resume
+echo changed | cmp - "$done"
+for i in 1 2 3 4 5 6 7 8; do
+  if [ "src/f$i" != "$done" ]; then
+    cmp "../src/f$i" "src/f$i"
+  fi
+done
+test ! -e ../ck
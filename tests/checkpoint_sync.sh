@@ -0,0 +1,25 @@
+#!/bin/sh
+# An extract that completes under --sync and --checkpoint removes its
+# checkpoint file, so a later --resume starts from the beginning.
+
+set -e
+mytar="$(pwd)/mytar"
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+cd "$dir"
+
+mkdir src
+for i in 1 2 3 4; do
+  head -c 1048576 /dev/zero >"src/f$i"
+done
+"$mytar" cf out.tar src
+
+for mode in end batch file; do
+  rm -rf src
+  "$mytar" xf out.tar --checkpoint ck --checkpoint-every 1 --sync=$mode
+  if [ -e ck ]; then
+    echo "checkpoint_sync: --sync=$mode left the checkpoint behind" >&2
+    exit 1
+  fi
+  test "$(wc -c <src/f4)" -eq 1048576
+done
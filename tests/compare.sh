@@ -0,0 +1,49 @@
+#!/bin/sh
+# d finds nothing to report on an unchanged tree, and otherwise names every
+# changed member and fails, with any number of threads and from a pipe. A
+# content change that keeps the size and mtime is found too.
+
+set -e
+mytar="$(pwd)/mytar"
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+cd "$dir"
+
+mkdir src
+head -c 200000 /dev/urandom >src/big
+echo a >src/a
+echo same >src/same
+ln -s a src/link
+"$mytar" cf in.tar src
+
+"$mytar" df in.tar >got
+test ! -s got
+
+touch -r src/big ref
+printf 'Z' | dd of=src/big bs=1 seek=150000 conv=notrunc 2>/dev/null
+touch -r ref src/big
+rm src/a src/link
+ln -s big src/link
+cat >want <<'EOF'
+src/a: Does not exist
+src/big: Contents differ
+src/link: Symlink differs
+EOF
+
+for option in "" "--threads 1" "--threads 4"; do
+  if "$mytar" df in.tar $option >got 2>/dev/null; then
+    echo "compare: differences passed with '$option'" >&2
+    exit 1
+  fi
+  sort got | cmp -s want - || {
+    echo "compare: unexpected report with '$option':" >&2
+    cat got >&2
+    exit 1
+  }
+done
+
+if "$mytar" df - <in.tar >got 2>/dev/null; then
+  echo "compare: differences passed from a pipe" >&2
+  exit 1
+fi
+sort got | cmp want -
@@ -0,0 +1,62 @@
+#!/bin/sh
+# --client runs a job through a --daemon as if it had been run directly: in
+# the client's directory, on its stdin and stdout, exiting with its status.
+# A second t of an unchanged archive lists from the daemon's cache.
+
+set -e
+mytar="$(pwd)/mytar"
+dir=$(mktemp -d)
+pid=
+trap '[ -z "$pid" ] || kill $pid; rm -rf "$dir"' EXIT
+cd "$dir"
+
+"$mytar" --daemon "$dir/sock" &
+pid=$!
+tries=0
+while [ ! -S sock ] && [ $tries -lt 100 ]; do
+  sleep 0.05
+  tries=$((tries + 1))
+done
+if [ ! -S sock ]; then
+  echo "daemon: no socket after 5 seconds" >&2
+  exit 1
+fi
+
+mkdir src
+head -c 100000 /dev/urandom >src/data
+echo small >src/aaaa
+"$mytar" cf ref.tar src
+
+"$mytar" --client sock cf out.tar src
+cmp ref.tar out.tar
+"$mytar" tvf ref.tar >want
+"$mytar" --client sock tvf out.tar >got
+cmp want got
+
+"$mytar" --client sock cf - src | "$mytar" --client sock tf - >got
+"$mytar" tf ref.tar | cmp - got
+
+mkdir out
+(cd out && "$mytar" --client "$dir/sock" xf ../out.tar)
+diff -r src out/src
+
+if "$mytar" --client sock tf missing.tar 2>err; then
+  echo "daemon: listing a missing archive succeeded" >&2
+  exit 1
+fi
+"$mytar" tf missing.tar 2>want || true
+cmp want err
+
+# renaming a member in place, which breaks its header checksum, and putting
+# back the mtime leaves the cached table in use, while S reads the archive
+# again and fails
+cp -p out.tar old.tar
+offset=$(grep -obUa src/aaaa out.tar | head -n 1 | cut -d: -f1)
+printf 'src/bbbb' | dd of=out.tar bs=1 seek="$offset" conv=notrunc 2>/dev/null
+touch -r old.tar out.tar
+"$mytar" --client sock tf out.tar >got
+"$mytar" tf old.tar | cmp - got
+if "$mytar" --client sock Stf out.tar >/dev/null 2>&1; then
+  echo "daemon: S listed from the cache" >&2
+  exit 1
+fi
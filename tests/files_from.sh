@@ -0,0 +1,42 @@
+#!/bin/sh
+# -T reads path operands from a file or stdin, one per line or NUL-separated
+# with --null. On create --no-recursion archives only the listed paths, and
+# on t, x and d the list selects members, also when listing in parallel.
+
+set -e
+mytar="$(pwd)/mytar"
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+cd "$dir"
+
+mkdir -p src/keep src/drop
+echo 1 >src/keep/a
+echo 2 >"src/keep/with space"
+echo 3 >src/drop/b
+
+printf 'src/keep\n' >list
+"$mytar" cf lines.tar -T list
+"$mytar" tf lines.tar | sort >got
+printf 'src/keep/\nsrc/keep/a\nsrc/keep/with space\n' >want
+cmp want got
+
+printf 'src/\000src/keep/with space\000' |
+  "$mytar" cf null.tar -T - --null --no-recursion
+"$mytar" tf null.tar >got
+printf 'src/\nsrc/keep/with space\n' >want
+cmp want got
+
+"$mytar" cf all.tar src
+printf 'src/drop/b\n' >select
+"$mytar" tf all.tar -T select >got
+echo src/drop/b | cmp - got
+"$mytar" tf all.tar -T select --threads 4 | cmp - got
+
+mkdir out
+(cd out && "$mytar" xf ../all.tar -T ../select)
+test -f out/src/drop/b
+test ! -e out/src/keep
+
+# only the selected member is compared, so the change elsewhere is missed
+echo changed >src/keep/a
+"$mytar" df all.tar -T select
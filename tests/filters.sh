@@ -0,0 +1,46 @@
+#!/bin/sh
+# --exclude, --exclude-from and --include filter what c archives, and the
+# members t and x act on. A pattern without a slash matches any component,
+# one with a slash the whole path, and excludes win over includes.
+
+set -e
+mytar="$(pwd)/mytar"
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+cd "$dir"
+
+mkdir -p src/node_modules/pkg src/lib src/build
+echo 1 >src/main.c
+echo 2 >src/main.o
+echo 3 >src/lib/util.c
+echo 4 >src/lib/util.h
+echo 5 >src/node_modules/pkg/index.js
+echo 6 >src/build/out.c
+printf 'src/build\n*.h\n' >patterns
+
+"$mytar" cf out.tar src --exclude node_modules --exclude '*.o' \
+  --exclude-from patterns
+"$mytar" tf out.tar | sort >got
+printf 'src/\nsrc/lib/\nsrc/lib/util.c\nsrc/main.c\n' >want
+if ! cmp -s want got; then
+  echo "filters: unexpected members on create:" >&2
+  diff want got >&2 || true
+  exit 1
+fi
+
+"$mytar" cf all.tar src
+"$mytar" tf all.tar --include '*.c' --exclude 'src/build/*' | sort >got
+# directories stay, so what is below them can be included
+printf 'src/\nsrc/build/\nsrc/lib/\nsrc/lib/util.c\nsrc/main.c\n' >want
+printf 'src/node_modules/\nsrc/node_modules/pkg/\n' >>want
+if ! cmp -s want got; then
+  echo "filters: unexpected members on list:" >&2
+  diff want got >&2 || true
+  exit 1
+fi
+
+mkdir out
+(cd out && "$mytar" xf ../all.tar --exclude '*.js' --exclude lib)
+test -f out/src/main.o
+test ! -e out/src/lib
+test ! -e out/src/node_modules/pkg/index.js
@@ -0,0 +1,43 @@
+#!/bin/sh
+# cz writes a multi-member gzip that gzip -d reads as a plain tar, tz lists
+# from its index, and xz with an operand inflates only the gzip members
+# holding the selected member.
+
+set -e
+mytar="$(pwd)/mytar"
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+cd "$dir"
+
+mkdir src
+i=1
+while [ $i -le 40 ]; do
+  head -c 100000 /dev/urandom >"src/f$i"
+  i=$((i + 1))
+done
+"$mytar" cf plain.tar src
+"$mytar" tvf plain.tar >want
+"$mytar" czf out.tgz src
+
+# the index follows the end of the archive, where tar readers stop
+gzip -dc out.tgz | head -c "$(wc -c <plain.tar)" | cmp - plain.tar
+gzip -dc out.tgz | "$mytar" tvf - | cmp - want
+"$mytar" tvzf out.tgz | cmp - want
+cat out.tgz | "$mytar" tvzf - | cmp - want
+
+# a damaged gzip member near the start, far from src/f20, only matters
+# when the archive is inflated from the start
+cp out.tgz bad.tgz
+printf 'XXXXXXXX' | dd of=bad.tgz bs=1 seek=50000 conv=notrunc 2>/dev/null
+mkdir one
+(cd one && "$mytar" xzf ../bad.tgz src/f20)
+cmp src/f20 one/src/f20
+test "$(ls one/src)" = f20
+if cat bad.tgz | (cd one && "$mytar" xzf - src/f20 2>/dev/null); then
+  echo "gzip_index: the damaged archive inflated from a pipe" >&2
+  exit 1
+fi
+
+mkdir all
+(cd all && "$mytar" xzf ../out.tgz)
+diff -r src all/src
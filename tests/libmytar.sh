@@ -0,0 +1,90 @@
+#!/bin/sh
+# libmytar writes an archive through a callback and reads it back member by
+# member, and reports failures as error codes instead of exiting.
+
+set -e
+root=$(pwd)
+mytar="$root/mytar"
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+cd "$dir"
+
+cat >api.c <<'EOF'
+#include "libmytar.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+static ssize_t to_fd(void *ctx, const void *buf, size_t len) {
+  return write(*(int *)ctx, buf, len);
+}
+
+static int print_entry(void *ctx, const MytarEntryInfo *info,
+                       MytarEntry *entry) {
+  char buf[64];
+  ssize_t len;
+
+  printf("%c %s %ld", info->type, info->name, info->size);
+  if (strcmp(info->name, "hello.txt") == 0) {
+    len = mytar_entry_read(entry, buf, sizeof(buf));
+    printf(" %.*s", (int)len, buf);
+  }
+  printf("\n");
+  return 0;
+}
+
+int main(int argc, char *argv[]) {
+  MytarWriter *writer;
+  char long_name[400];
+  int fd = open(argv[1], O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  int err;
+
+  memset(long_name, 'x', sizeof(long_name) - 1);
+  long_name[sizeof(long_name) - 1] = '\0';
+
+  if (mytar_writer_open_cb(&writer, to_fd, &fd) != MYTAR_OK ||
+      mytar_writer_add_buffer(writer, "hello.txt", "hello", 5, 0644, 0) !=
+          MYTAR_OK ||
+      mytar_writer_add_path(writer, "src") != MYTAR_OK) {
+    return 1;
+  }
+  err = mytar_writer_add_buffer(writer, long_name, "", 0, 0644, 0);
+  printf("long name: %s\n", err == MYTAR_ERR_NAME ? "name error" : "other");
+  if (mytar_writer_close(writer) != MYTAR_OK) {
+    return 1;
+  }
+  close(fd);
+
+  fd = open(argv[1], O_RDONLY);
+  err = mytar_read_fd(fd, 0, print_entry, NULL);
+  close(fd);
+
+  fd = open(argv[0], O_RDONLY);
+  printf("garbage: %s\n", mytar_read_fd(fd, 0, print_entry, NULL) == MYTAR_OK
+                              ? "ok"
+                              : "error");
+  close(fd);
+  return err;
+}
+EOF
+cc -I"$root" -o api api.c "$root/libmytar.a" -lz -pthread
+
+mkdir src
+echo data >src/file
+./api out.tar >got 2>/dev/null
+cat >want <<'EOF'
+long name: name error
+0 hello.txt 5 hello
+5 src/ 0
+0 src/file 5
+garbage: error
+EOF
+if ! cmp -s want got; then
+  echo "libmytar: unexpected output:" >&2
+  diff want got >&2 || true
+  exit 1
+fi
+
+# what the library wrote is an ordinary archive
+"$mytar" tf out.tar >/dev/null
@@ -0,0 +1,47 @@
+#!/bin/sh
+# tv prints mode, owner, size, local mtime and name in the columns mytar has
+# always used, and --print0 ends names, or with v every field, with a NUL.
+
+set -e
+mytar="$(pwd)/mytar"
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+cd "$dir"
+
+TZ=UTC
+export TZ
+
+tab=$(printf '\t')
+cat >manifest <<EOF
+dir${tab}dir:${tab}mode=750${tab}uname=alice${tab}gname=staff${tab}mtime=0
+dir/file${tab}content:hello${tab}uid=7${tab}gid=8${tab}mtime=1700000000
+dir/link${tab}symlink:file${tab}mtime=1700000059
+EOF
+"$mytar" cf out.tar --manifest manifest
+
+"$mytar" tvf out.tar >got
+{
+  printf '%-10s %-17s %8d %-16s %s\n' drwxr-x--- alice/staff 0 \
+    "1970-01-01 00:00" dir/
+  printf '%-10s %-17s %8d %-16s %s\n' -rw-r--r-- / 5 \
+    "2023-11-14 22:13" dir/file
+  printf '%-10s %-17s %8d %-16s %s\n' lrwxrwxrwx / 0 \
+    "2023-11-14 22:14" dir/link
+} >want
+if ! cmp -s want got; then
+  echo "listing: unexpected tv output:" >&2
+  diff want got >&2 || true
+  exit 1
+fi
+
+"$mytar" tf out.tar --print0 | tr '\0' '\n' >got
+printf 'dir/\ndir/file\ndir/link\n' | cmp - got
+
+"$mytar" tvf out.tar --print0 | tr '\0' '|' >got
+printf '5|750|alice|staff|0|0|dir/|0|644|||5|1700000000|dir/file|' >want
+printf '2|777|||0|1700000059|dir/link|' >>want
+if ! cmp -s want got; then
+  echo "listing: unexpected tv --print0 fields:" >&2
+  cat got >&2
+  exit 1
+fi
@@ -0,0 +1,37 @@
+#!/bin/sh
+# A verbose listing prints local times across a DST change. New York moves
+# from EST to EDT at 02:00 on 2026-03-08, so that day is 23 hours long. The
+# member after the change comes first, so the listing has to work out where
+# that day starts before it sees the members before the change.
+
+set -e
+mytar="$(pwd)/mytar"
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+cd "$dir"
+
+TZ=America/New_York
+export TZ
+
+tab=$(printf '\t')
+for mtime in 1772955000 1772944200 1772947800 1772951400 1773027000 \
+  1773030600; do
+  echo "m$mtime${tab}content:${tab}mtime=$mtime"
+done >manifest
+"$mytar" cf out.tar --manifest manifest
+
+"$mytar" tvf out.tar | awk '{ print $4, $5 }' >got
+cat >want <<EOF
+2026-03-08 03:30
+2026-03-07 23:30
+2026-03-08 00:30
+2026-03-08 01:30
+2026-03-08 23:30
+2026-03-09 00:30
+EOF
+
+if ! cmp -s want got; then
+  echo "listing_dst: wrong local times across the DST change:" >&2
+  diff want got >&2 || true
+  exit 1
+fi
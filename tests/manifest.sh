@@ -0,0 +1,54 @@
+#!/bin/sh
+# --manifest adds members named by each line, from a file, directory,
+# symlink or inline source, with attributes overridden by KEY=VALUE fields,
+# and rejects lines it cannot honour.
+
+set -e
+mytar="$(pwd)/mytar"
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+cd "$dir"
+
+TZ=UTC
+export TZ
+
+mkdir -p src/tree
+head -c 100000 /dev/urandom >src/data
+echo inside >src/tree/inside
+
+tab=$(printf '\t')
+cat >manifest <<EOF
+# comments and empty lines are skipped
+
+etc/${tab}dir:${tab}mtime=0
+etc/data.bin${tab}src/data${tab}mode=600
+etc/tree${tab}src/tree${tab}mtime=0
+etc/motd${tab}content:line one\\nline\\ttwo\\\\${tab}uid=0${tab}mtime=0
+etc/current${tab}symlink:motd${tab}mtime=0
+EOF
+"$mytar" cf out.tar --manifest manifest
+
+"$mytar" tf out.tar >got
+printf 'etc/\netc/data.bin\netc/tree/\netc/motd\netc/current\n' >want
+cmp want got
+
+mkdir out
+(cd out && "$mytar" xf ../out.tar)
+cmp src/data out/etc/data.bin
+test "$(stat -c %a out/etc/data.bin)" = 600
+printf 'line one\nline\ttwo\\' | cmp - out/etc/motd
+test "$(readlink out/etc/current)" = motd
+# a directory source is archived without its contents
+test -z "$(ls out/etc/tree)"
+
+# the same from stdin, NUL-separated
+tr '\n' '\0' <manifest | "$mytar" cf null.tar --manifest - --null
+cmp out.tar null.tar
+
+for line in "x${tab}content:${tab}colour=red" "x${tab}content:${tab}mode=99" \
+  "no source" "x${tab}src/missing"; do
+  if echo "$line" | "$mytar" cf bad.tar --manifest - 2>/dev/null; then
+    echo "manifest: accepted the line '$line'" >&2
+    exit 1
+  fi
+done
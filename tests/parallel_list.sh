@@ -0,0 +1,39 @@
+#!/bin/sh
+# t --threads N lists exactly what the serial listing does, even when member
+# data holds blocks that look like ustar headers, such as another archive.
+
+set -e
+mytar="$(pwd)/mytar"
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+cd "$dir"
+
+mkdir inner src
+for i in 1 2 3 4 5 6 7 8; do
+  echo "inner $i" >"inner/decoy$i"
+done
+"$mytar" cf src/inner.tar inner
+i=0
+while [ $i -lt 300 ]; do
+  head -c $((i * 37)) /dev/zero >"src/f$i"
+  i=$((i + 1))
+done
+"$mytar" cf out.tar src
+
+"$mytar" tvf out.tar >serial
+for threads in 2 4 7; do
+  "$mytar" tvf out.tar --threads $threads >parallel
+  if ! cmp -s serial parallel; then
+    echo "parallel_list: --threads $threads differs from the serial listing" >&2
+    diff serial parallel >&2 || true
+    exit 1
+  fi
+done
+
+if grep -q decoy serial; then
+  echo "parallel_list: the nested archive's members were listed" >&2
+  exit 1
+fi
+
+# stdin cannot be mapped and is listed serially
+"$mytar" tvf - --threads 4 <out.tar | cmp - serial
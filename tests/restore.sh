@@ -0,0 +1,35 @@
+#!/bin/sh
+# x restores mtimes, and modes less the umask or exactly with p. Directory
+# metadata is applied last, so a directory keeps its mtime after its
+# contents are created and a read-only one can still be filled.
+
+set -e
+mytar="$(pwd)/mytar"
+dir=$(mktemp -d)
+trap 'chmod -R u+w "$dir"; rm -rf "$dir"' EXIT
+cd "$dir"
+
+tab=$(printf '\t')
+cat >manifest <<EOF
+ro${tab}dir:${tab}mode=555${tab}mtime=1000000000
+ro/file${tab}content:data${tab}mode=664${tab}mtime=1100000000
+ro/tool${tab}content:run${tab}mode=4755${tab}mtime=1200000000
+EOF
+"$mytar" cf out.tar --manifest manifest
+
+umask 022
+mkdir plain exact
+(cd plain && "$mytar" xf ../out.tar)
+(cd exact && "$mytar" xpf ../out.tar)
+
+check() {
+  if [ "$(stat -c '%a %Y' "$1")" != "$2" ]; then
+    echo "restore: $1 is $(stat -c '%a %Y' "$1"), not $2" >&2
+    exit 1
+  fi
+}
+check plain/ro "555 1000000000"
+check plain/ro/file "644 1100000000"
+check plain/ro/tool "755 1200000000"
+check exact/ro/file "664 1100000000"
+check exact/ro/tool "4755 1200000000"
@@ -0,0 +1,45 @@
+#!/bin/sh
+# --rewrite copies selected members into a new archive under new names,
+# keeping their data and digests, and creates it with the same permissions
+# as c does.
+
+set -e
+mytar="$(pwd)/mytar"
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+cd "$dir"
+
+mkdir -p top/src top/obj
+head -c 100000 /dev/urandom >top/src/big
+echo small >top/src/small
+echo object >top/obj/x.o
+"$mytar" cf in.tar --digest=crc32c top
+
+"$mytar" f in.tar --rewrite out.tar --strip-components 1 --exclude '*.o' \
+  --rename src=code
+"$mytar" tf out.tar --verify | sort >got
+printf 'code/\ncode/big\ncode/small\nobj/\n' >want
+if ! cmp -s want got; then
+  echo "rewrite: unexpected members:" >&2
+  diff want got >&2 || true
+  exit 1
+fi
+
+mkdir out
+(cd out && "$mytar" xf ../out.tar)
+cmp top/src/big out/code/big
+cmp top/src/small out/code/small
+
+# the same from a pipe, into a pipe
+"$mytar" f - --rewrite - --strip-components 1 <in.tar >piped.tar
+"$mytar" tf piped.tar --verify >/dev/null
+
+# without a umask to hide the difference
+umask 000
+"$mytar" cf c.tar top
+"$mytar" f in.tar --rewrite r.tar
+if [ "$(stat -c %a r.tar)" != "$(stat -c %a c.tar)" ]; then
+  echo "rewrite: r.tar is mode $(stat -c %a r.tar)," \
+    "not $(stat -c %a c.tar) like c" >&2
+  exit 1
+fi
@@ -0,0 +1,33 @@
+#!/bin/sh
+# --same-owner falls back to a member's numeric ids when its owner names are
+# unknown here, and two members with the same unknown name keep their own ids.
+
+set -e
+mytar="$(pwd)/mytar"
+if [ "$(id -u)" -ne 0 ]; then
+  exit 0
+fi
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+cd "$dir"
+
+tab=$(printf '\t')
+name=mytar-no-such-owner
+cat >manifest <<EOF
+a${tab}content:a${tab}uname=$name${tab}gname=$name${tab}uid=1234${tab}gid=1234
+b${tab}content:b${tab}uname=$name${tab}gname=$name${tab}uid=2345${tab}gid=2345
+EOF
+"$mytar" cf out.tar --manifest manifest
+
+mkdir out
+cd out
+"$mytar" xf ../out.tar --same-owner
+for member in a:1234 b:2345; do
+  file=${member%:*}
+  id=${member#*:}
+  if [ "$(stat -c %u:%g "$file")" != "$id:$id" ]; then
+    echo "same_owner: $file is owned by $(stat -c %u:%g "$file")," \
+      "not $id:$id" >&2
+    exit 1
+  fi
+done
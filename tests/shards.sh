@@ -0,0 +1,50 @@
+#!/bin/sh
+# --shards N spreads a tree over N archives of about equal size that
+# together extract to the same tree. A member larger than a shard's share
+# gets a shard of its own instead of dragging everything before it into one,
+# and a shard left empty is still written and reported.
+
+set -e
+mytar="$(pwd)/mytar"
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+cd "$dir"
+
+mkdir src
+for i in 1 2 3 4 5 6 7 8 9; do
+  head -c 100000 /dev/urandom >"src/f$i"
+done
+"$mytar" cf eq.tar --shards 3 src
+for i in 0 1 2; do
+  if [ "$("$mytar" tf eq.$i.tar | grep -c '/f')" -ne 3 ]; then
+    echo "shards: eq.$i.tar does not hold a third of the files" >&2
+    exit 1
+  fi
+done
+
+mkdir out
+for i in 0 1 2; do
+  (cd out && "$mytar" xf ../eq.$i.tar)
+done
+diff -r src out/src
+
+# small members first, then one larger than all of them together
+mkdir small
+for i in 1 2 3 4 5 6 7 8 9 10 11 12; do
+  echo "$i" >"small/f$i"
+done
+head -c 3000000 /dev/zero >big
+"$mytar" cf late.tar --shards 3 small big 2>err
+if [ "$("$mytar" tf late.1.tar)" != big ]; then
+  echo "shards: the large member did not get a shard of its own" >&2
+  exit 1
+fi
+if [ "$("$mytar" tf late.0.tar | grep -c '/f')" -ne 12 ] ||
+  [ -n "$("$mytar" tf late.2.tar)" ]; then
+  echo "shards: the small members were not kept together" >&2
+  exit 1
+fi
+if ! grep -q "late.2.tar: no members" err; then
+  echo "shards: the empty shard was not reported" >&2
+  exit 1
+fi
@@ -0,0 +1,39 @@
+#!/bin/sh
+# --skip-identical=content leaves alone a file whose data matches the
+# member's digest even when its mtime differs, and replaces one whose data
+# differs even when its size and mtime match.
+
+set -e
+mytar="$(pwd)/mytar"
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+cd "$dir"
+
+mkdir src
+head -c 100000 /dev/zero >src/f
+touch -d "2020-01-01 00:00" src/f
+"$mytar" cf out.tar --digest=crc32c src
+
+mkdir out
+cd out
+"$mytar" xf ../out.tar
+
+# identical content under a new mtime is kept as it is
+touch -d "2021-01-01 00:00" src/f
+inode=$(stat -c %i src/f)
+mtime=$(stat -c %Y src/f)
+"$mytar" xf ../out.tar --skip-identical=content
+if [ "$(stat -c %i:%Y src/f)" != "$inode:$mtime" ] ||
+  ! cmp -s src/f ../src/f; then
+  echo "skip_identical: an identical file was rewritten" >&2
+  exit 1
+fi
+
+# different content of the same size and mtime is replaced
+printf 'X' | dd of=src/f bs=1 seek=70000 conv=notrunc 2>/dev/null
+touch -d "2020-01-01 00:00" src/f
+"$mytar" xf ../out.tar --skip-identical=content
+if ! cmp -s src/f ../src/f; then
+  echo "skip_identical: a changed file was not replaced" >&2
+  exit 1
+fi
@@ -0,0 +1,39 @@
+#!/bin/sh
+# --stats reports entry counts, byte counts and the size histogram on
+# stderr, in text or as a single JSON object, without touching the archive
+# written to stdout.
+
+set -e
+mytar="$(pwd)/mytar"
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+cd "$dir"
+
+mkdir src
+: >src/empty
+head -c 100 /dev/zero >src/small
+head -c 100000 /dev/zero >src/big
+ln -s big src/link
+
+"$mytar" cf - src --stats=json >out.tar 2>stats.json
+for field in '"entries":{"regular":3,"directory":1,"symlink":1,"other":0}' \
+  '"header":2560,"data":100100' '"0":3,"1-512":1' '"64K-1M":1'; do
+  if ! grep -qF "$field" stats.json; then
+    echo "stats: $field missing from:" >&2
+    cat stats.json >&2
+    exit 1
+  fi
+done
+if [ "$(wc -l <stats.json)" -ne 1 ]; then
+  echo "stats: the JSON report is not a single line" >&2
+  exit 1
+fi
+
+"$mytar" tf out.tar --stats >list 2>stats.txt
+test "$(wc -l <list)" -eq 5
+if ! grep -q "^entries: 3 regular, 1 directory, 1 symlink, 0 other$" \
+  stats.txt; then
+  echo "stats: unexpected text report:" >&2
+  cat stats.txt >&2
+  exit 1
+fi
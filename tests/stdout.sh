@@ -0,0 +1,31 @@
+#!/bin/sh
+# O writes the data of the selected regular files to stdout in archive
+# order, from a file or a pipe, and creates nothing on disk.
+
+set -e
+mytar="$(pwd)/mytar"
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+cd "$dir"
+
+mkdir -p src/etc
+head -c 200000 /dev/urandom >src/a
+echo config >src/etc/app.conf
+head -c 100000 /dev/urandom >src/b
+"$mytar" cf in.tar src/a src/etc src/b
+
+mkdir out
+cd out
+"$mytar" xOf ../in.tar src/etc/app.conf >conf
+cmp ../src/etc/app.conf conf
+
+"$mytar" xOf ../in.tar src/a src/b >both
+cat ../src/a ../src/b | cmp - both
+
+cat ../in.tar | "$mytar" xOf - src/b >piped
+cmp ../src/b piped
+
+if [ -e src ]; then
+  echo "stdout: O created files on disk" >&2
+  exit 1
+fi
@@ -0,0 +1,34 @@
+#!/bin/sh
+# f - writes the archive to stdout and reads it from stdin, so an archive
+# can go through a pipe: members are copied, listed, selected and skipped
+# without seeking, and verbose output stays out of the archive.
+
+set -e
+mytar="$(pwd)/mytar"
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+cd "$dir"
+
+mkdir -p src/sub
+head -c 300000 /dev/urandom >src/big
+echo small >src/sub/small
+ln -s big src/link
+
+mkdir out
+"$mytar" cvf - src 2>names | (cd out && "$mytar" xf -)
+diff -r src out/src
+test "$(wc -l <names)" -eq 5
+
+"$mytar" cf file.tar src/big src/link src/sub
+cat file.tar | "$mytar" tf - >piped
+"$mytar" tf file.tar >seeked
+cmp piped seeked
+
+# the big member is skipped in the pipe to reach the one after it
+mkdir only
+cat file.tar | (cd only && "$mytar" xf - src/sub/small)
+cmp src/sub/small only/src/sub/small
+if [ -e only/src/big ]; then
+  echo "stream: an unselected member was extracted" >&2
+  exit 1
+fi
@@ -0,0 +1,78 @@
+#!/bin/sh
+# Every --sync mode extracts the same tree. batch fsyncs each directory
+# that gained entries once, however the archive interleaves them, and file
+# fsyncs directories and the directories holding them and symlinks.
+
+set -e
+mytar="$(pwd)/mytar"
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+cd "$dir"
+
+# logs the path of every fsync to stderr
+cat >log.c <<'EOF'
+#define _GNU_SOURCE
+#include <dlfcn.h>
+#include <stdio.h>
+#include <unistd.h>
+
+int fsync(int fd) {
+  int (*real)(int) = (int (*)(int))dlsym(RTLD_NEXT, "fsync");
+  char link[64];
+  char path[4096];
+  ssize_t len;
+
+  snprintf(link, sizeof(link), "/proc/self/fd/%d", fd);
+  len = readlink(link, path, sizeof(path) - 1);
+  path[len > 0 ? len : 0] = '\0';
+  fprintf(stderr, "fsync %s\n", path);
+  return real(fd);
+}
+EOF
+cc -shared -fPIC -o log.so log.c -ldl
+
+mkdir -p src/a src/b src/ro
+i=0
+while [ $i -lt 100 ]; do
+  echo "$i" >"src/a/f$i"
+  echo "$i" >"src/b/f$i"
+  i=$((i + 1))
+done
+ln -s f1 src/b/link
+echo ro >src/ro/file
+chmod 555 src/ro
+
+# members alternate between the two directories
+i=0
+while [ $i -lt 100 ]; do
+  echo "src/a/f$i"
+  echo "src/b/f$i"
+  i=$((i + 1))
+done >list
+printf 'src/b/link\nsrc/ro\nsrc/ro/file\n' >>list
+"$mytar" cf out.tar src/ src/a/ src/b/ -T list --no-recursion
+
+for mode in none end batch file; do
+  mkdir "$mode"
+  (cd "$mode" && LD_PRELOAD="$dir/log.so" \
+    "$mytar" xf ../out.tar --sync=$mode 2>../$mode.log)
+  diff -r src "$mode/src"
+  chmod 755 "$mode/src/ro"
+done
+
+sed -n 's|^fsync .*/batch/||p' batch.log | sort >got
+printf 'src\nsrc/a\nsrc/b\nsrc/ro\n' >want
+if ! cmp -s want got; then
+  echo "sync: batch fsynced these directories:" >&2
+  sort batch.log | uniq -c >&2
+  exit 1
+fi
+
+# the symlink is last in src/b, and src/ro is a directory held by src
+tail -n 5 file.log | sed 's|^fsync .*/file/||' >got
+printf 'src/b\nsrc/ro\nsrc\nsrc/ro/file\nsrc/ro\n' >want
+if ! cmp -s want got; then
+  echo "sync: file did not sync the symlink and directory:" >&2
+  tail -n 6 file.log >&2
+  exit 1
+fi
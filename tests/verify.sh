@@ -0,0 +1,44 @@
+#!/bin/sh
+# t --verify reads back every member of a --digest=crc32c archive and checks
+# it against its digest, also for members that span several records, and
+# fails on a single changed byte.
+
+set -e
+mytar="$(pwd)/mytar"
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+cd "$dir"
+
+mkdir src
+head -c 100000 /dev/urandom >src/big
+echo small >src/small
+"$mytar" cf out.tar --digest=crc32c src
+
+# the default 64 KiB records, then one block at a time
+for option in "" "--blocking-factor 1"; do
+  if ! "$mytar" tf out.tar --verify $option >/dev/null; then
+    echo "verify: intact archive failed to verify with '$option'" >&2
+    exit 1
+  fi
+done
+
+# one flipped byte in the middle of the big member's data
+cp out.tar bad.tar
+byte=$(dd if=out.tar bs=1 skip=50000 count=1 2>/dev/null | od -An -tu1)
+printf "\\$(printf %03o $(((byte + 1) % 256)))" |
+  dd of=bad.tar bs=1 seek=50000 conv=notrunc 2>/dev/null
+if cmp -s out.tar bad.tar; then
+  echo "verify: failed to corrupt the archive" >&2
+  exit 1
+fi
+for option in "" "--blocking-factor 1"; do
+  if "$mytar" tf bad.tar --verify $option >/dev/null 2>err; then
+    echo "verify: corrupted archive passed with '$option'" >&2
+    exit 1
+  fi
+  if ! grep -q "do not match their digest" err; then
+    echo "verify: corrupted archive failed for another reason:" >&2
+    cat err >&2
+    exit 1
+  fi
+done
@@ -0,0 +1,96 @@
+/* throttle.c
+ * This file implements --bwlimit and --ionice. The bandwidth limit is a token
+ * bucket shared by every thread of the process. Each copy takes the tokens for
+ * the bytes it is about to move, and the bucket may go into debt: the caller
+ * then sleeps until the debt is repaid at the configured rate. The bucket
+ * holds at most 50ms worth of tokens, so data moves in small evenly spaced
+ * steps instead of bursts. Time spent asleep is reported by --stats.
+ */
+#define _GNU_SOURCE
+
+#include "throttle.h"
+#include "libmytar.h"
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+/* the I/O priority class and value layout of ioprio_set(2) */
+#define IOPRIO_WHO_PROCESS 1
+#define IOPRIO_CLASS_IDLE 3
+#define IOPRIO_CLASS_SHIFT 13
+
+typedef struct {
+  double rate;
+  double burst;
+  double tokens;
+  double last;
+  pthread_mutex_t lock;
+} Throttle;
+
+static Throttle throttle = {0, 0, 0, 0, PTHREAD_MUTEX_INITIALIZER};
+
+/* Limits data moved by copies to rate bytes per second, 0 for no limit */
+void throttle_set_rate(double rate) {
+  pthread_mutex_lock(&throttle.lock);
+  throttle.rate = rate;
+  throttle.burst = rate / 20;
+  throttle.tokens = throttle.burst;
+  throttle.last = stats_now();
+  pthread_mutex_unlock(&throttle.lock);
+}
+
+bool throttle_active() { return throttle.rate > 0; }
+
+/* Accounts for bytes about to be moved, sleeping first if they exceed what
+ * the rate allows */
+void throttle_take(size_t bytes, Stats *stats) {
+  struct timespec delay;
+  double now;
+  double wait = 0;
+  double start;
+
+  if (!throttle_active()) {
+    return;
+  }
+
+  pthread_mutex_lock(&throttle.lock);
+  now = stats_now();
+  throttle.tokens += (now - throttle.last) * throttle.rate;
+  if (throttle.tokens > throttle.burst) {
+    throttle.tokens = throttle.burst;
+  }
+  throttle.last = now;
+
+  throttle.tokens -= bytes;
+  if (throttle.tokens < 0) {
+    wait = -throttle.tokens / throttle.rate;
+  }
+  pthread_mutex_unlock(&throttle.lock);
+
+  if (wait <= 0) {
+    return;
+  }
+
+  start = stats_now();
+  delay.tv_sec = (time_t)wait;
+  delay.tv_nsec = (long)((wait - delay.tv_sec) * 1e9);
+  /* sleeps out the rest after a signal, and gives up on any other error */
+  while (nanosleep(&delay, &delay) == -1 && errno == EINTR) {
+  }
+  stats_phase(stats, PHASE_THROTTLE, start);
+}
+
+/* Moves the process into the idle I/O scheduling class, where it only gets
+ * disk time nobody else wants. Threads started afterwards inherit it. */
+int throttle_ionice_idle() {
+  if (syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0,
+              IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT) == -1) {
+    perror("Failed to set I/O priority");
+    return MYTAR_ERR_IO;
+  }
+
+  return MYTAR_OK;
+}
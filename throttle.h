@@ -0,0 +1,16 @@
+#ifndef THROTTLE
+#define THROTTLE
+
+#include "stats.h"
+#include <stdbool.h>
+#include <stddef.h>
+
+/* largest amount of data moved between two checks of the bucket */
+#define THROTTLE_CHUNK 262144
+
+void throttle_set_rate(double rate);
+bool throttle_active();
+void throttle_take(size_t bytes, Stats *stats);
+int throttle_ionice_idle();
+
+#endif
@@ -4,12 +4,20 @@
  * writer.h
  */
 #include "writer.h"
+#include "digest.h"
+#include "io.h"
+#include "libmytar.h"
+#include "throttle.h"
+#include <errno.h>
 #include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
+extern int snprintf(char *str, size_t size, const char *format, ...);
+extern ssize_t pwrite(int fd, const void *buf, size_t count, off_t offset);
+
 Writer *writer_init(Writer *writer) {
 
   writer->header = NULL;
@@ -18,11 +26,75 @@ Writer *writer_init(Writer *writer) {
 
   writer->dst_fd = 1;
 
+  writer->dst_is_pipe = false;
+
   writer->buffer_offset = 0;
 
+  writer->record_blocks = NUM_HUNKS;
+
+  writer->stats = NULL;
+
+  writer->offset = 0;
+
+  writer->digest = false;
+
+  writer->crc = 0;
+
+  writer->digest_offset = 0;
+
+  writer->align = 0;
+
+  writer->write_fn = NULL;
+
+  writer->write_ctx = NULL;
+
+  writer->begin_fn = NULL;
+
   return writer;
 }
 
+/* Sets the archive fd. Pipes get file contents spliced into them. */
+void writer_set_dst(Writer *writer, int fd) {
+  writer->dst_fd = fd;
+  writer->dst_is_pipe = io_is_pipe(fd);
+
+  if (io_is_seekable(fd) && (writer->offset = lseek(fd, 0, SEEK_CUR)) == -1) {
+    writer->offset = 0;
+  }
+}
+
+/* Sends len bytes to the destination, either the write callback or dst_fd.
+ * Short writes are retried until everything is written. */
+int writer_output(Writer *writer, const void *buf, size_t len) {
+  const unsigned char *p = buf;
+  ssize_t written;
+
+  if (writer->write_fn == NULL) {
+    if (io_write_full(writer->dst_fd, buf, len, writer->stats) != MYTAR_OK) {
+      return MYTAR_ERR_IO;
+    }
+    writer->offset += len;
+    return MYTAR_OK;
+  }
+
+  while (len > 0) {
+    written = writer->write_fn(writer->write_ctx, p, len);
+
+    if (written == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return MYTAR_ERR_IO;
+    }
+
+    p += written;
+    len -= written;
+    writer->offset += written;
+  }
+
+  return MYTAR_OK;
+}
+
 /* Returns the true index in the buffer as the buffer is handeled in blocks of
  * 512 */
 int get_buffer_index(Writer *writer) {
@@ -30,72 +102,322 @@ int get_buffer_index(Writer *writer) {
 }
 
 /* Flushes any content in the buffer to the file */
-void writer_flush(Writer *writer) {
+int writer_flush(Writer *writer) {
 
-  if (write(writer->dst_fd, writer->buf,
-            (writer->buffer_offset * USTAR_BLOCK)) == -1) {
+  if (writer_output(writer, writer->buf, get_buffer_index(writer)) !=
+      MYTAR_OK) {
     perror("Failed to flush buffer");
-    exit(EXIT_FAILURE);
+    return MYTAR_ERR_IO;
   }
 
   writer->buffer_offset = 0;
+  return MYTAR_OK;
 }
 
 /* Adds padding to the buffer in order to adhere to USTAR spec.*/
-void writer_pad(Writer *writer) {
+int writer_pad(Writer *writer) {
   /* If not enough space in buffer for padding */
 
-  if ((writer->buffer_offset + 2) > (NUM_HUNKS - 1)) {
-    writer_flush(writer);
+  if ((writer->buffer_offset + 2) > (writer->record_blocks - 1)) {
+    if (writer_flush(writer) != MYTAR_OK) {
+      return MYTAR_ERR_IO;
+    }
   }
 
   /* write two 512 byte blocks to buffer */
   memset(writer->buf + get_buffer_index(writer), 0, USTAR_BLOCK * 2);
+  stats_padding(writer->stats, USTAR_BLOCK * 2);
 
   writer->buffer_offset += 2;
+  return MYTAR_OK;
+}
+
+/* Copies the file straight into a pipe with splice, then writes the padding.
+ * The buffer is flushed first so the data lands after its header. */
+static int writer_splice_file(Writer *writer, long size) {
+  static const unsigned char zeros[USTAR_BLOCK];
+  off_t copied;
+  long missing;
+  int delta;
+
+  if (writer_flush(writer) != MYTAR_OK) {
+    return MYTAR_ERR_IO;
+  }
+
+  if ((copied = io_copy(writer->src_fd, writer->dst_fd, size,
+                        writer->stats)) == -1) {
+    perror("Failed to copy src file.");
+    return MYTAR_ERR_IO;
+  }
+  writer->offset += copied;
+
+  /* the file shrank since it was stated, keep the header's size */
+  for (missing = size - copied; missing > 0; missing -= USTAR_BLOCK) {
+    if (writer_output(writer, zeros,
+                      missing < USTAR_BLOCK ? missing : USTAR_BLOCK) !=
+        MYTAR_OK) {
+      return MYTAR_ERR_IO;
+    }
+  }
+
+  delta = (size % USTAR_BLOCK == 0) ? 0 : USTAR_BLOCK - (size % USTAR_BLOCK);
+  return writer_output(writer, zeros, delta);
 }
 
 /* Writes file contents to intermediary buffer, only calls flush if buffer
- * full.*/
-void writer_write_file(Writer *writer) {
-  int bytes_read;
-  int difference = 0;
-  int current_index;
+ * full. Exactly the size recorded in the header is written, so a file that
+ * changes while it is archived cannot corrupt the archive.*/
+int writer_write_file(Writer *writer) {
+  long size = strtol((char *)writer->header->size, NULL, 8);
+  ssize_t bytes_read;
+  size_t want;
+  size_t padded;
+  int err = MYTAR_OK;
+  double start = stats_now();
 
-  if (lseek(writer->src_fd, 0, SEEK_SET) == -1) {
-    perror("Failed to seek file. Exiting...\n");
-    exit(EXIT_FAILURE);
-  };
+  if (writer->dst_is_pipe && writer->write_fn == NULL) {
+    err = writer_splice_file(writer, size);
+    stats_phase(writer->stats, PHASE_COPY, start);
+    return err;
+  }
 
   /* Fill the buffer with file content */
-  while ((bytes_read =
-              read(writer->src_fd, writer->buf + get_buffer_index(writer),
-                   (NUM_HUNKS - writer->buffer_offset) * USTAR_BLOCK)) > 0) {
+  while (size > 0) {
+    want = (writer->record_blocks - writer->buffer_offset) * USTAR_BLOCK;
+    if (want > size) {
+      want = size;
+    }
 
-    /* if we need to add padding to the buffer block */
-    if (bytes_read % USTAR_BLOCK != 0) {
-      difference = USTAR_BLOCK - (bytes_read % USTAR_BLOCK);
-      current_index = get_buffer_index(writer) + bytes_read;
+    throttle_take(want, writer->stats);
+    bytes_read = io_read_full(writer->src_fd,
+                              writer->buf + get_buffer_index(writer), want,
+                              writer->stats);
 
-      memset(writer->buf + current_index, 0, difference);
+    if (bytes_read == -1) {
+      perror("Failed to read src file.");
+      err = MYTAR_ERR_IO;
+      break;
     }
 
-    writer->buffer_offset += (difference + bytes_read) / USTAR_BLOCK;
-    if (writer->buffer_offset == NUM_HUNKS) {
-      writer_flush(writer);
+    /* zero any padding, or the rest of a file that shrank */
+    padded = (want + USTAR_BLOCK - 1) / USTAR_BLOCK * USTAR_BLOCK;
+    memset(writer->buf + get_buffer_index(writer) + bytes_read, 0,
+           padded - bytes_read);
+
+    if (writer->digest) {
+      writer->crc =
+          crc32c(writer->crc, writer->buf + get_buffer_index(writer), want);
+    }
+
+    writer->buffer_offset += padded / USTAR_BLOCK;
+    size -= want;
+
+    if (writer->buffer_offset == writer->record_blocks &&
+        (err = writer_flush(writer)) != MYTAR_OK) {
+      break;
     }
   }
 
-  if (bytes_read == -1) {
-    perror("Failed to read src file.");
-    exit(EXIT_FAILURE);
+  stats_phase(writer->stats, PHASE_COPY, start);
+  return err;
+}
+
+/* Writes in-memory contents to the buffer, padded to a whole block, in the
+ * same way writer_write_file does for files. */
+int writer_write_buffer(Writer *writer, const void *data, size_t len) {
+  const unsigned char *p = data;
+  size_t room;
+  size_t chunk;
+  size_t padded;
+
+  while (len > 0) {
+    room = (writer->record_blocks - writer->buffer_offset) * USTAR_BLOCK;
+    chunk = len < room ? len : room;
+    padded = (chunk + USTAR_BLOCK - 1) / USTAR_BLOCK * USTAR_BLOCK;
+
+    memcpy(writer->buf + get_buffer_index(writer), p, chunk);
+    memset(writer->buf + get_buffer_index(writer) + chunk, 0, padded - chunk);
+
+    writer->buffer_offset += padded / USTAR_BLOCK;
+    p += chunk;
+    len -= chunk;
+
+    if (writer->buffer_offset == writer->record_blocks &&
+        writer_flush(writer) != MYTAR_OK) {
+      return MYTAR_ERR_IO;
+    }
   }
+
+  return MYTAR_OK;
 }
 
-void writer_write_header(Writer *writer) {
+/* Adds the header to the buffer, after whatever members precede it */
+int writer_write_header(Writer *writer) {
 
-  if (write(writer->dst_fd, writer->header, sizeof(*writer->header)) == -1) {
+  if (writer_write_buffer(writer, writer->header, sizeof(*writer->header)) !=
+      MYTAR_OK) {
     perror("Failed to write header to destination file");
-    exit(EXIT_FAILURE);
+    return MYTAR_ERR_IO;
   }
+
+  return MYTAR_OK;
+}
+
+/* Fills len bytes with a PAX comment record, which readers ignore */
+static void writer_comment_record(char *record, size_t len) {
+  int prefix = sprintf(record, "%lu comment=", (unsigned long)len);
+
+  memset(record + prefix, '0', len - prefix - 1);
+  record[len - 1] = '\n';
+}
+
+/* Returns the size of the PAX records that put the data of the member about
+ * to be written at a multiple of writer->align, given that records of at
+ * least min bytes are needed. Returns 0 if no PAX header is needed. Members
+ * smaller than align are left where they fall. */
+static size_t writer_pax_size(Writer *writer, size_t min) {
+  off_t data;
+  size_t size;
+
+  /* the data follows the PAX header, its records and the member's header */
+  data = writer->offset + get_buffer_index(writer) + 2 * USTAR_BLOCK;
+
+  /* without --align, or for files smaller than the alignment, no whole
+   * aligned extent could be shared, so only the needed records are written */
+  if (writer->align == 0 ||
+      strtol((char *)writer->header->size, NULL, 8) < writer->align) {
+    return min;
+  }
+
+  if (min == 0 && (data - USTAR_BLOCK) % writer->align == 0) {
+    return 0;
+  }
+
+  size = (writer->align - data % writer->align) % writer->align;
+  while (size < min + (min > 0 ? 32 : USTAR_BLOCK)) {
+    size += writer->align;
+  }
+  return size;
+}
+
+/* Adds the PAX header in front of the member about to be written, holding
+ * its digest unless crc is NULL, and padded with a comment record up to
+ * --align. Sets digest_offset to the archive offset of the digest record. */
+static int writer_write_pax(Writer *writer, const uint32_t *crc) {
+  TarHeader pax;
+  char *records;
+  char name[sizeof(writer->header->name) + 1];
+  char pax_name[sizeof(pax.name)];
+  size_t size;
+  size_t used = 0;
+  int err;
+
+  size = writer_pax_size(writer, crc != NULL ? DIGEST_RECORD_SIZE : 0);
+  if (size == 0) {
+    return MYTAR_OK;
+  }
+
+  memcpy(name, writer->header->name, sizeof(writer->header->name));
+  name[sizeof(writer->header->name)] = '\0';
+  snprintf(pax_name, sizeof(pax_name), "PaxHeaders/%s", name);
+
+  memset(&pax, 0, sizeof(TarHeader));
+  if ((err = populate_header_from_memory(
+           pax_name, size, 0644,
+           strtol((char *)writer->header->mtime, NULL, 8), &pax)) !=
+      MYTAR_OK) {
+    return err;
+  }
+  pax.typeflag = 'x';
+  populate_chksum(&pax);
+
+  /* one spare byte for the terminator sprintf writes */
+  if ((records = calloc(1, size + 1)) == NULL) {
+    return MYTAR_ERR_NOMEM;
+  }
+
+  if (crc != NULL) {
+    digest_record(records, *crc);
+    used = DIGEST_RECORD_SIZE;
+  }
+  if (used < size) {
+    writer_comment_record(records + used, size - used);
+  }
+
+  if (writer_write_buffer(writer, &pax, sizeof(pax)) != MYTAR_OK) {
+    err = MYTAR_ERR_IO;
+  } else {
+    writer->digest_offset = writer->offset + get_buffer_index(writer);
+    err = writer_write_buffer(writer, records, size);
+  }
+  free(records);
+
+  if (err != MYTAR_OK) {
+    perror("Failed to write extended header");
+    return err;
+  }
+
+  stats_entry(writer->stats, &pax);
+  return MYTAR_OK;
+}
+
+/* Writes the PAX header that carries the digest of the member about to be
+ * written, with a placeholder digest, and starts a new CRC. */
+int writer_write_digest_header(Writer *writer) {
+  uint32_t placeholder = 0;
+  int err;
+
+  if ((err = writer_write_pax(writer, &placeholder)) != MYTAR_OK) {
+    return err;
+  }
+
+  writer->crc = 0;
+  return MYTAR_OK;
+}
+
+/* Writes the PAX header of a member whose digest is already known, such as
+ * one copied from another archive */
+int writer_write_known_digest(Writer *writer, uint32_t crc) {
+  return writer_write_pax(writer, &crc);
+}
+
+/* Pads the archive with a PAX header, if needed, so that the data of the
+ * member about to be written starts at a multiple of --align */
+int writer_align(Writer *writer) {
+  return writer_write_pax(writer, NULL);
+}
+
+/* Patches the digest of the member just written into its PAX header. The
+ * header is usually still in the buffer, otherwise this needs a seekable
+ * archive. */
+int writer_write_digest(Writer *writer) {
+  char record[DIGEST_RECORD_SIZE + 1];
+
+  digest_record(record, writer->crc);
+
+  /* records start on a block boundary, so the record was flushed whole or
+   * not at all */
+  if (writer->digest_offset >= writer->offset) {
+    memcpy(writer->buf + (writer->digest_offset - writer->offset), record,
+           DIGEST_RECORD_SIZE);
+    return MYTAR_OK;
+  }
+
+  stats_syscall(writer->stats, SYS_WRITE);
+  if (pwrite(writer->dst_fd, record, DIGEST_RECORD_SIZE,
+             writer->digest_offset) != DIGEST_RECORD_SIZE) {
+    perror("Failed to write member digest");
+    return MYTAR_ERR_IO;
+  }
+
+  return MYTAR_OK;
+}
+
+/* Announces the member in writer->header, about to be written, to begin_fn */
+int writer_begin_member(Writer *writer) {
+  if (writer->begin_fn == NULL) {
+    return MYTAR_OK;
+  }
+
+  return writer->begin_fn(writer->write_ctx, writer);
 }
@@ -2,29 +2,69 @@
 #define WRITER
 
 #include "header.h"
+#include "stats.h"
+#include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <sys/types.h>
 
 #define USTAR_BLOCK 512
-#define NUM_HUNKS 8
+
+/* blocks per record, and the largest --blocking-factor. Headers, small files
+ * and padding accumulate in the buffer, which is only written out once a
+ * whole record is full. */
+#define NUM_HUNKS 128
 #define BUFFER_SIZE NUM_HUNKS *USTAR_BLOCK
 
 typedef unsigned char buffer[BUFFER_SIZE];
 
-typedef struct {
+typedef struct Writer {
 
   TarHeader *header;
   int src_fd;
   int dst_fd;
+  bool dst_is_pipe;
   buffer buf;
   int buffer_offset;
 
+  /* blocks written out at a time, at most NUM_HUNKS */
+  int record_blocks;
+  Stats *stats;
+
+  /* archive bytes output so far */
+  off_t offset;
+
+  /* when set, regular files are preceded by a PAX header holding the CRC32C
+   * of their contents, which is patched in once the data is written */
+  bool digest;
+  uint32_t crc;
+  off_t digest_offset;
+
+  /* when set, regular files' data starts at a multiple of this many bytes */
+  int align;
+
+  /* when set, output goes to write_fn instead of dst_fd */
+  ssize_t (*write_fn)(void *ctx, const void *buf, size_t len);
+  void *write_ctx;
+
+  /* when set, called with write_ctx before each member is written */
+  int (*begin_fn)(void *ctx, struct Writer *writer);
+
 } Writer;
 
 Writer *writer_init(Writer *writer);
+void writer_set_dst(Writer *writer, int fd);
 int get_buffer_index(Writer *writer);
-void writer_flush(Writer *writer);
-void writer_pad(Writer *writer);
-void writer_write_file(Writer *writer);
-void writer_write_header(Writer *writer);
+int writer_output(Writer *writer, const void *buf, size_t len);
+int writer_flush(Writer *writer);
+int writer_pad(Writer *writer);
+int writer_write_file(Writer *writer);
+int writer_write_buffer(Writer *writer, const void *data, size_t len);
+int writer_write_header(Writer *writer);
+int writer_write_digest_header(Writer *writer);
+int writer_write_digest(Writer *writer);
+int writer_write_known_digest(Writer *writer, uint32_t crc);
+int writer_align(Writer *writer);
+int writer_begin_member(Writer *writer);
 
 #endif